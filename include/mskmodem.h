@@ -25,8 +25,105 @@
 struct MSKModemContext_s;
 typedef struct MSKModemContext_s MSKModemContext;
 
+struct MSKModemBatch_s;
+typedef struct MSKModemBatch_s MSKModemBatch;
+
+// Sample rates the modem runs at: whatever the sound backend gives, in this
+// range. At 48kHz a bit is exactly 40 samples; elsewhere the bit clocks
+// carry fractions of a sample over and the filters are designed to suit.
+#define MSKMODEM_RATE_MIN 8000
+#define MSKMODEM_RATE_MAX 96000
+
+// The zero crossing discriminator needs a few samples a half cycle: below
+// this rate the incoherent, diversity and multiphase demodulators can't be
+// set, and the coherent one runs from the start
+#define MSKMODEM_RATE_DISC_MIN 12000
+
 typedef void(*MSKModemTxFn)(guint64* cw, void* userdata);
-typedef void(*MSKModemRxFn)(guint32 bit, void* userdata);
+
+// Received bit. When more than one demodulator runs on a channel each gives
+// its own bit stream, told apart by path (0 when there is only one).
+typedef void(*MSKModemRxFn)(guint32 bit, int path, void* userdata);
+
+// Receive quality over the last bits of a demodulator path
+typedef struct MSKModemRxQuality_s
+{
+  int bits;         // Bits measured, 0 if the path isn't measured (batch)
+  float snr;        // In band SNR (M2M4 moment estimate), dB
+  float eye;        // Eye opening: smallest margin over the mean one, 0-1
+  float timing;     // Mean timing error at bit transitions, samples at
+                    // the modem's rate; <0 if the demodulator has no
+                    // timing loop
+  int corrections;  // Bit clock corrections made
+  float imbalance;  // 1200Hz level over 1800Hz level, dB
+} MSKModemRxQuality;
+
+// Carrier came on or went off, sample being the count of samples received
+// since the modem was created at the point it did
+typedef void(*MSKModemCarrierFn)(int on, guint64 sample, void* userdata);
+
+typedef enum {
+  MSKMODEM_DEMOD_INCOHERENT = 0, // Zero crossing discriminator at full rate
+  MSKMODEM_DEMOD_DECIMATING,     // Decimated to about 12kHz, interpolated
+                                 // timing
+  MSKMODEM_DEMOD_COHERENT,       // I/Q correlators against both tones
+  MSKMODEM_DEMOD_DIVERSITY,      // Incoherent (path 0) and coherent (path 1)
+  MSKMODEM_DEMOD_MULTIPHASE,     // Discriminator sliced at MSKMODEM_PHASES
+                                 // fixed timing phases, one path each
+  MSKMODEM_DEMOD_COUNT
+} MSKModemDemod;
+
+// Timing phases (and so paths) of the multiphase demodulator
+#define MSKMODEM_PHASES 8
+
+typedef enum {
+  MSKMODEM_CARRIER_OFF = 0, // No carrier detection
+  MSKMODEM_CARRIER_DETECT,  // Carrier reported, everything demodulated
+  MSKMODEM_CARRIER_GATE,    // Carrier reported, and nothing demodulated
+                            // without it
+  MSKMODEM_CARRIER_COUNT
+} MSKModemCarrierMode;
+
+typedef enum {
+  MSKMODEM_EQ_OFF = 0,    // No equaliser
+  MSKMODEM_EQ_BURST,      // Trained on the start of each burst the carrier
+                          // detector finds, frozen in between
+  MSKMODEM_EQ_CONTINUOUS, // Always training (while there's carrier, if
+                          // it is detected)
+  MSKMODEM_EQ_COUNT
+} MSKModemEqMode;
+
+// Receive equaliser taps, spaced about 1/12000s apart (every fourth sample
+// at 48kHz)
+#define MSKMODEM_EQ_TAPS 9
+
+// Receive equaliser state
+typedef struct MSKModemEqState_s
+{
+  MSKModemEqMode mode;
+  float taps[MSKMODEM_EQ_TAPS]; // Newest sample first; a delay of half the
+                                // span (centre tap 1) is flat
+  float gain1200;   // Response at 1200Hz, dB
+  float gain1800;   // ...and at 1800Hz
+  int training;     // Taps being trained now
+  guint32 trainings; // Training runs finished
+  float dispersion; // RMS envelope error over the last one, relative to
+                    // the envelope: 0 for a constant one
+} MSKModemEqState;
+
+typedef enum {
+  MSKMODEM_TX_TABLE = 0, // Precomputed waveform per bit (an NCO where a
+                         // bit isn't a whole number of samples)
+  MSKMODEM_TX_NCO,       // Phase accumulator and sine table per sample
+  MSKMODEM_TX_COUNT
+} MSKModemTxMode;
+
+typedef enum {
+  MSKMODEM_SHAPE_NONE = 0, // Tone switched at the bit edge
+  MSKMODEM_SHAPE_COSINE,   // Raised cosine frequency change over half a
+                           // bit, centred on the edge
+  MSKMODEM_SHAPE_COUNT
+} MSKModemShape;
 
 int
 mskmodem_init
@@ -46,6 +143,164 @@ mskmodem_free
   MSKModemContext** ppCtx
 );
 
+// Sample rate the modem runs at, as its sound backend set it
+int
+mskmodem_rate
+(
+  MSKModemContext* ctx
+);
+
+int
+mskmodem_set_demod
+(
+  MSKModemContext* ctx,
+  MSKModemDemod demod
+);
+
+// Carrier detection. f is called on the audio thread with the modem's
+// userdata. Channels on a batch demodulator are reported but not gated.
+int
+mskmodem_set_carrier
+(
+  MSKModemContext* ctx,
+  MSKModemCarrierMode mode,
+  MSKModemCarrierFn f
+);
+
+// Receive quality of path over its last bits bits (at most 64). For use
+// from the rx callback, which it describes the bits up to.
+int
+mskmodem_rx_quality
+(
+  MSKModemContext* ctx,
+  int path,
+  int bits,
+  MSKModemRxQuality* q
+);
+
+// Modulator setup. level is the output amplitude, 1.0 being full scale.
+// Only while the modem is stopped.
+int
+mskmodem_set_modulator
+(
+  MSKModemContext* ctx,
+  MSKModemTxMode mode,
+  MSKModemShape shape,
+  float level
+);
+// Receive equaliser, in front of the demodulator: for radios whose audio
+// path tilts or delays one tone against the other. Burst training needs
+// carrier detection. Channels on a batch demodulator aren't equalised.
+int
+mskmodem_set_eq
+(
+  MSKModemContext* ctx,
+  MSKModemEqMode mode
+);
+
+void
+mskmodem_rx_eq
+(
+  MSKModemContext* ctx,
+  MSKModemEqState* state
+);
+
+// Renders codewords (with FCS) that will be sent over and over into the
+// modulator's waveform cache, and keeps them there. Only while the modem
+// is stopped, and after mskmodem_set_modulator.
+int
+mskmodem_tx_prefill
+(
+  MSKModemContext* ctx,
+  const guint64* cw,
+  int count
+);
+
+// Codewords played from the waveform cache, and rendered into it
+void
+mskmodem_tx_cache_stats
+(
+  MSKModemContext* ctx,
+  guint32* hits,
+  guint32* misses
+);
+
+// Split sound devices: capture and playback on their own sound cards (ALSA
+// device names, NULL to leave a side on JACK's physical ports), each
+// resampled to the modem's rate with the latency through it held
+// constant. Only while the modem is stopped.
+int
+mskmodem_set_sound_split
+(
+  MSKModemContext* ctx,
+  const char* capture,
+  const char* playback
+);
+
+void
+mskmodem_sound_stats
+(
+  MSKModemContext* ctx,
+  MSKModemSoundSplitStats* capture,
+  MSKModemSoundSplitStats* playback
+);
+
+// Pipelined processing: the sound callback only queues audio and the
+// modem runs on a worker thread, making transmit audio lookahead samples
+// (at least the sound period) ahead. That is then the extra delay from
+// the modem to the air, which the stats report. 0 runs the modem in the
+// sound callback. Only while the modem is stopped.
+int
+mskmodem_set_pipeline
+(
+  MSKModemContext* ctx,
+  int lookahead
+);
+
+void
+mskmodem_pipeline_stats
+(
+  MSKModemContext* ctx,
+  MSKModemSoundPipelineStats* stats
+);
+
+// Batch demodulator: runs the incoherent demodulator of many channels in
+// lock-step, several channels per vector instruction, on a thread of its
+// own. Attached channels use it instead of their own demodulator, and get
+// their bits on their own sound thread a period later than they would.
+// Only channels at 48kHz can be attached, and only while stopped.
+MSKModemBatch*
+mskmodem_batch_new
+(
+  int channels
+);
+
+void
+mskmodem_batch_free
+(
+  MSKModemBatch** ppBatch
+);
+
+int
+mskmodem_batch_attach
+(
+  MSKModemBatch* batch,
+  MSKModemContext* ctx
+);
+
+int
+mskmodem_batch_detach
+(
+  MSKModemContext* ctx
+);
+
+// Periods (and bits) dropped because the batch thread fell behind
+guint32
+mskmodem_batch_overruns
+(
+  MSKModemBatch* batch
+);
+
 int
 mskmodem_run
 (
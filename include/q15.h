@@ -0,0 +1,75 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+* 
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef Q15_H
+#define Q15_H
+
+#include <glib.h>
+#include <math.h>
+
+// Fixed point (Q15) helpers, used by the MSKMODEM_FIXED_POINT build.
+//
+// Samples are 16 bit signed with MSKMODEM_SOUND_FULLSCALE (32767) as full
+// scale. Arithmetic is done in 32 bits and saturated back to 16.
+
+#define Q15_ONE 32768
+
+static inline gint16 q15_sat(gint32 v)
+{
+  return v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+}
+
+static inline gint16 q15_from_float(float v)
+{
+  return q15_sat(lrintf(v * Q15_ONE));
+}
+
+static inline float q15_to_float(gint16 v)
+{
+  return v * (1.0f/Q15_ONE);
+}
+
+// Rounded Q15 multiply
+static inline gint16 q15_mul(gint16 a, gint16 b)
+{
+  return q15_sat(((gint32)a*b + (1<<14)) >> 15);
+}
+
+// Builds the lookup tables. Must be called before the functions below,
+// outside the audio thread (mskmodem_init does this).
+void
+mskmodem_q15_init
+(
+  void
+);
+
+// Sine of phase, where 2^32 is a full cycle
+gint16
+mskmodem_q15_sin
+(
+  guint32 phase
+);
+
+// Soft clipper: tanh of a Q15 value held in 32 bits
+gint16
+mskmodem_q15_tanh
+(
+  gint32 x
+);
+
+#endif /* Q15_H */
@@ -20,12 +20,32 @@
 #ifndef SOUND_H
 #define SOUND_H
 
+// The fixed point build runs the whole modem on 16 bit (Q15) samples; the
+// sound backend converts to and from its native format.
+#ifdef MSKMODEM_FIXED_POINT
+#define MSKMODEM_SOUND_FULLSCALE 32767
+typedef gint16 mskmodem_sound_t;
+#else
 #define MSKMODEM_SOUND_FULLSCALE 1.0f
 typedef float mskmodem_sound_t;
+#endif
 
 struct MSKModemSoundContext_s;
 typedef struct MSKModemSoundContext_s MSKModemSoundContext;
 
+// One side of split sound devices
+typedef struct MSKModemSoundSplitStats_s
+{
+  int active;      // The side is on its own device
+  int rate;        // The device's sample rate
+  float ppm;       // Resampling correction of the device's clock, ppm
+  float fill;      // Average samples buffered, at the modem's rate...
+  int target;      // ...and the fill held
+  int latency;     // Samples of delay through the device and buffer
+  guint32 slips;   // Buffer under and overruns, each a jump in latency
+  guint32 xruns;   // Device under and overruns
+} MSKModemSoundSplitStats;
+
 typedef void(*MSKModemSoundRxFn) (const mskmodem_sound_t* buf,
                                   gint32 samplecount,
                                   void* context);
@@ -34,6 +54,20 @@ typedef void(*MSKModemSoundTxFn) (mskmodem_sound_t* buf,
                                   gint32 samplecount,
                                   void* context);
 
+// Pipelined processing
+typedef struct MSKModemSoundPipelineStats_s
+{
+  int lookahead;   // Samples of transmit audio made ahead, and so the
+                   // extra delay from the modem to the sound card: 0
+                   // if not pipelined
+  int period;      // The backend's period
+  int backlog;     // Most received samples waiting for the modem
+  guint32 underruns; // Transmit audio not ready in time
+  guint32 overruns;  // Received audio dropped, the modem too far behind
+  guint32 tx_overruns; // Transmit audio dropped, made while catching up
+                       // with more received audio than it has room for
+} MSKModemSoundPipelineStats;
+
 int
 mskmodem_sound_init (
   MSKModemSoundContext** pCtx,
@@ -48,6 +82,48 @@ mskmodem_sound_free (
   MSKModemSoundContext** ctx
 );
 
+// Sample rate the backend runs at, fixed once it is set up
+int
+mskmodem_sound_rate (
+  MSKModemSoundContext* ctx
+);
+
+// Split devices: capture and playback on their own sound cards, with
+// their own clocks, rather than the backend's. Each is joined to the
+// backend's clock by an adaptive resampler that holds the latency through
+// it constant. NULL leaves a side where it was. Only while stopped.
+// Returns 1 if the backend can't or a device won't open.
+int
+mskmodem_sound_split (
+  MSKModemSoundContext* ctx,
+  const char* capture,
+  const char* playback
+);
+
+void
+mskmodem_sound_split_stats (
+  MSKModemSoundContext* ctx,
+  MSKModemSoundSplitStats* capture,
+  MSKModemSoundSplitStats* playback
+);
+
+// Pipelined processing: the backend's audio callback only moves samples
+// to and from rings, and the modem runs on a worker thread lookahead
+// samples of transmit audio ahead of it (at least a period). 0 runs the
+// modem in the callback. Only while stopped. Returns 1 if the backend
+// can't.
+int
+mskmodem_sound_pipeline (
+  MSKModemSoundContext* ctx,
+  int lookahead
+);
+
+void
+mskmodem_sound_pipeline_stats (
+  MSKModemSoundContext* ctx,
+  MSKModemSoundPipelineStats* stats
+);
+
 int
 mskmodem_sound_run (
   MSKModemSoundContext* ctx
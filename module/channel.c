@@ -22,8 +22,27 @@
 #include <math.h>
 
 #include "channel.h"
+#include "q15.h"
 
-#define SYNT 0x3B28     // 0011101100101000
+// Tones are 0.6 of full scale, mixed through a soft clipper
+#define TONE_LEVEL 19661 // Q15
+
+// Morse dot length, dots a second (3200 samples at 48kHz)
+#define MORSE_DOT_RATE 15
+
+// Batch demodulator shared by the channels using it: made for the first
+// and freed with the last
+static MSKModemBatch* channel_batch;
+static int channel_batch_users;
+static GMutex channel_batch_lock;
+
+// Rendered morse string
+typedef struct
+{
+  mskmodem_sound_t* pcm;
+  gint32 length;
+  int rate;      // Sample rate rendered at
+} MPT1327Pcm;
 
 const static char* const morsetable[] = {
   "A.-", "B-...", "C-.-.", "D-..", "E.", "F..-.", "G--.", "H....", "I..",
@@ -33,33 +52,207 @@ const static char* const morsetable[] = {
   "7--...", "8---..", "9----.", NULL
 };
 
+// FCS CRC register update for each byte shifted in: polynomial 0x6815
+// applied before the shift, i.e. 0xD02A in the usual MSB first form
+static const guint16 fcs_table[256] = {
+  0x0000, 0xD02A, 0x707E, 0xA054, 0xE0FC, 0x30D6, 0x9082, 0x40A8,
+  0x11D2, 0xC1F8, 0x61AC, 0xB186, 0xF12E, 0x2104, 0x8150, 0x517A,
+  0x23A4, 0xF38E, 0x53DA, 0x83F0, 0xC358, 0x1372, 0xB326, 0x630C,
+  0x3276, 0xE25C, 0x4208, 0x9222, 0xD28A, 0x02A0, 0xA2F4, 0x72DE,
+  0x4748, 0x9762, 0x3736, 0xE71C, 0xA7B4, 0x779E, 0xD7CA, 0x07E0,
+  0x569A, 0x86B0, 0x26E4, 0xF6CE, 0xB666, 0x664C, 0xC618, 0x1632,
+  0x64EC, 0xB4C6, 0x1492, 0xC4B8, 0x8410, 0x543A, 0xF46E, 0x2444,
+  0x753E, 0xA514, 0x0540, 0xD56A, 0x95C2, 0x45E8, 0xE5BC, 0x3596,
+  0x8E90, 0x5EBA, 0xFEEE, 0x2EC4, 0x6E6C, 0xBE46, 0x1E12, 0xCE38,
+  0x9F42, 0x4F68, 0xEF3C, 0x3F16, 0x7FBE, 0xAF94, 0x0FC0, 0xDFEA,
+  0xAD34, 0x7D1E, 0xDD4A, 0x0D60, 0x4DC8, 0x9DE2, 0x3DB6, 0xED9C,
+  0xBCE6, 0x6CCC, 0xCC98, 0x1CB2, 0x5C1A, 0x8C30, 0x2C64, 0xFC4E,
+  0xC9D8, 0x19F2, 0xB9A6, 0x698C, 0x2924, 0xF90E, 0x595A, 0x8970,
+  0xD80A, 0x0820, 0xA874, 0x785E, 0x38F6, 0xE8DC, 0x4888, 0x98A2,
+  0xEA7C, 0x3A56, 0x9A02, 0x4A28, 0x0A80, 0xDAAA, 0x7AFE, 0xAAD4,
+  0xFBAE, 0x2B84, 0x8BD0, 0x5BFA, 0x1B52, 0xCB78, 0x6B2C, 0xBB06,
+  0xCD0A, 0x1D20, 0xBD74, 0x6D5E, 0x2DF6, 0xFDDC, 0x5D88, 0x8DA2,
+  0xDCD8, 0x0CF2, 0xACA6, 0x7C8C, 0x3C24, 0xEC0E, 0x4C5A, 0x9C70,
+  0xEEAE, 0x3E84, 0x9ED0, 0x4EFA, 0x0E52, 0xDE78, 0x7E2C, 0xAE06,
+  0xFF7C, 0x2F56, 0x8F02, 0x5F28, 0x1F80, 0xCFAA, 0x6FFE, 0xBFD4,
+  0x8A42, 0x5A68, 0xFA3C, 0x2A16, 0x6ABE, 0xBA94, 0x1AC0, 0xCAEA,
+  0x9B90, 0x4BBA, 0xEBEE, 0x3BC4, 0x7B6C, 0xAB46, 0x0B12, 0xDB38,
+  0xA9E6, 0x79CC, 0xD998, 0x09B2, 0x491A, 0x9930, 0x3964, 0xE94E,
+  0xB834, 0x681E, 0xC84A, 0x1860, 0x58C8, 0x88E2, 0x28B6, 0xF89C,
+  0x439A, 0x93B0, 0x33E4, 0xE3CE, 0xA366, 0x734C, 0xD318, 0x0332,
+  0x5248, 0x8262, 0x2236, 0xF21C, 0xB2B4, 0x629E, 0xC2CA, 0x12E0,
+  0x603E, 0xB014, 0x1040, 0xC06A, 0x80C2, 0x50E8, 0xF0BC, 0x2096,
+  0x71EC, 0xA1C6, 0x0192, 0xD1B8, 0x9110, 0x413A, 0xE16E, 0x3144,
+  0x04D2, 0xD4F8, 0x74AC, 0xA486, 0xE42E, 0x3404, 0x9450, 0x447A,
+  0x1500, 0xC52A, 0x657E, 0xB554, 0xF5FC, 0x25D6, 0x8582, 0x55A8,
+  0x2776, 0xF75C, 0x5708, 0x8722, 0xC78A, 0x17A0, 0xB7F4, 0x67DE,
+  0x36A4, 0xE68E, 0x46DA, 0x96F0, 0xD658, 0x0672, 0xA626, 0x760C,
+};
+
+// Codeword as sent from the scheduler's form of it
+static guint64 channel_encode(guint64 cw)
+{
+  if (cw==1)
+    return 0xAAAAAAAAAAAA0000LL | MPT1327_SYNT; // Traffic channel sync word
+  else if (cw>1)
+    return mpt1327_channel_fcs_add(cw);
+  return 0;
+}
+
+// Wakes the controller thread if that can be done without waiting. If not
+// it is awake anyway, or looks again at its next timeout.
+static void channel_wake(MPT1327Channel* ch)
+{
+  if (g_mutex_trylock(&ch->ctl_mutex)) {
+    g_cond_signal(&ch->ctl_cond);
+    g_mutex_unlock(&ch->ctl_mutex);
+  }
+}
+
+// Called on the sound thread, transmit side: passes on a codeword or carrier
+// change to the controller thread, dropping it if the ring is full
+static void channel_post_rx(MPT1327Channel* ch, const MPT1327RxEvent* e)
+{
+  int wr = ch->cbrx_wr;
+  int next = (wr + 1) % MPT1327_RX_QUEUE;
+
+  if (next == g_atomic_int_get(&ch->cbrx_rd)) {
+    ch->rx_overflows++;
+    return;
+  }
+
+  ch->cbrx[wr] = *e;
+  g_atomic_int_set(&ch->cbrx_wr, next);
+  channel_wake(ch);
+}
+
+// Called on the sound thread, transmit side: passes on what was received,
+// then has the scheduler decide the next codeword
 static void modem_tx(guint64* cw, void* userdata)
 {
   MPT1327Channel* ch = userdata;
-  guint64 cwtmp = ch->tx_callback(ch->userdata);
-  if (cwtmp==1)
-    *cw = 0xAAAAAAAAAAAA0000LL | SYNT; // Traffic channel sync word
-  else if (cwtmp>1)
-    *cw = mpt1327_channel_fcs_add(cwtmp);
+  int rd = ch->cbin_rd;
+  guint64 cwtmp;
+
+  while (rd != g_atomic_int_get(&ch->cbin_wr)) {
+    MPT1327RxEvent* e = &ch->cbin[rd];
+    if (e->carrier >= 0) {
+      mpt1327_sched_carrier(&ch->sched, e->carrier);
+      if (ch->carrier_callback)
+        channel_post_rx(ch, e);
+    }
+    else if (!mpt1327_sched_rx(&ch->sched, e->cw))
+      channel_post_rx(ch, e);
+    rd = (rd + 1) % MPT1327_RX_QUEUE;
+    g_atomic_int_set(&ch->cbin_rd, rd);
+  }
+
+  cwtmp = mpt1327_sched_next(&ch->sched);
+  if (cwtmp)
+    *cw = channel_encode(cwtmp);
+}
+
+// Called on the sound thread, receive side: passes a codeword (carrier
+// -1) or carrier change on, dropping it if the ring is full
+static void channel_post_in(MPT1327Channel* ch, guint64 cw, int carrier,
+                            const MPT1327RxInfo* info)
+{
+  int wr = ch->cbin_wr;
+  int next = (wr + 1) % MPT1327_RX_QUEUE;
+
+  if (next == g_atomic_int_get(&ch->cbin_rd)) {
+    ch->rx_stats.overflows++;
+    return;
+  }
+
+  ch->cbin[wr].cw = cw;
+  ch->cbin[wr].carrier = carrier;
+  if (info)
+    ch->cbin[wr].info = *info;
+  g_atomic_int_set(&ch->cbin_wr, next);
 }
 
-static void modem_rx(guint32 bit, void* userdata)
+static void modem_rx(guint32 bit, int path, void* userdata)
 {
   MPT1327Channel* ch = userdata;
-  static int x;
+  MPT1327RxInfo info;
+  guint64 cw;
 
-  // Store new bit
-  ch->rx_cw <<= 1;
-  ch->rx_cw |= bit;
+  if (path < 0 || path >= MPT1327_RX_PATHS)
+    return;
+  if (path == 0)
+    ch->rx_bits++;
 
-  // TODO: improve this. We need carrier detect for starters.
-  //       probably nice to know which SYNC/SYNT was used too
-  if (mpt1327_channel_fcs(ch->rx_cw>>16)==(ch->rx_cw&0xFFFF))
-  {
-    // Strip fcs from received data
-    ch->rx_callback(ch->userdata, ch->rx_cw>>16);
+  if (!mpt1327_framer_bit(&ch->rx_framer[path], bit, ch->rx_sync_tolerance,
+                          ch->rx_correct, &cw, &info))
+    return;
+  info.path = path;
+
+  // With several paths the same codeword turns up on each, a few bits
+  // apart. Real repeats are at least a codeword apart.
+  if (cw == ch->rx_last_cw && ch->rx_bits - ch->rx_last_bit < 32)
+    return;
+  ch->rx_last_cw = cw;
+  ch->rx_last_bit = ch->rx_bits;
+
+  ch->rx_stats.codewords++;
+  if (info.corrected)
+    ch->rx_stats.corrected++;
+
+  mskmodem_rx_quality(ch->modem, path, 64, &info.quality);
+
+  channel_post_in(ch, cw, -1, &info);
+
+}
+
+// A frame doesn't carry on over a break in the carrier, so the framers
+// start afresh when it comes back
+static void modem_carrier(int on, guint64 sample, void* userdata)
+{
+  MPT1327Channel* ch = userdata;
+  int n;
+
+  if (on) {
+    for (n=0; n<MPT1327_RX_PATHS; n++)
+      mpt1327_framer_reset(&ch->rx_framer[n]);
+    ch->rx_stats.carriers++;
+  }
+
+  // The scheduler counts random access collisions by it
+  channel_post_in(ch, sample, on, NULL);
+}
+
+// Controller thread: passes on what was received
+static gpointer channel_control(gpointer data)
+{
+  MPT1327Channel* ch = data;
+  MPT1327RxEvent* e;
+  int rd;
+
+  g_mutex_lock(&ch->ctl_mutex);
+  for (;;) {
+    g_mutex_unlock(&ch->ctl_mutex);
+
+    rd = ch->cbrx_rd;
+    while (rd != g_atomic_int_get(&ch->cbrx_wr)) {
+      e = &ch->cbrx[rd];
+      if (e->carrier < 0)
+        ch->rx_callback(ch->userdata, e->cw, &e->info);
+      else if (ch->carrier_callback)
+        ch->carrier_callback(ch->userdata, e->carrier, e->cw);
+      rd = (rd + 1) % MPT1327_RX_QUEUE;
+      g_atomic_int_set(&ch->cbrx_rd, rd);
+    }
+
+    g_mutex_lock(&ch->ctl_mutex);
+    if (ch->ctl_quit)
+      break;
+    g_cond_wait_until(&ch->ctl_cond, &ch->ctl_mutex,
+                      g_get_monotonic_time() + 10*G_TIME_SPAN_MILLISECOND);
   }
+  g_mutex_unlock(&ch->ctl_mutex);
 
+  return NULL;
 }
 
 static void sound_rx(const mskmodem_sound_t* buf, 
@@ -82,10 +275,167 @@ static void sound_rx(const mskmodem_sound_t* buf,
 
 }
 
+static inline mskmodem_sound_t tone_sample(guint32 phase)
+{
+#ifdef MSKMODEM_FIXED_POINT
+  return (TONE_LEVEL * mskmodem_q15_sin(phase) + (1<<14)) >> 15;
+#else
+  return mskmodem_q15_sin(phase) *
+         ((float)TONE_LEVEL / Q15_ONE * MSKMODEM_SOUND_FULLSCALE / 32767);
+#endif
+}
+
+#ifdef MSKMODEM_FIXED_POINT
+static inline mskmodem_sound_t tone_clip(gint32 v)
+{
+  return mskmodem_q15_tanh(v);
+}
+#else
+// Pade approximant of tanh: within 0.025 of it, and meets +-1 at +-3
+static inline mskmodem_sound_t tone_clip(float v)
+{
+  if (v > 3.0f)
+    return 1.0f;
+  if (v < -3.0f)
+    return -1.0f;
+  return v * (27.0f + v*v) / (27.0f + 9.0f*v*v);
+}
+#endif
+
+// Called on the sound thread: must not block. A slot was reserved when
+// the tone (or codeword) was queued, so there is always room.
+static MPT1327Completion* channel_completion_begin(MPT1327Channel* ch)
+{
+  return &ch->cbcompl[ch->cbcompl_wr];
+}
+
+static void channel_completion_end(MPT1327Channel* ch)
+{
+  g_atomic_int_set(&ch->cbcompl_wr, (ch->cbcompl_wr + 1) % ch->cbtone_size);
+
+  // Wake the dispatcher if that can be done without waiting. If not it is
+  // awake anyway, or picks this up at its next timeout.
+  if (g_mutex_trylock(&ch->compl_mutex)) {
+    g_cond_signal(&ch->compl_cond);
+    g_mutex_unlock(&ch->compl_mutex);
+  }
+}
+
+static void channel_post_completion(MPT1327Channel* ch,
+                                    mpt1327_channel_completion_fn fcomp,
+                                    void* userdata)
+{
+  MPT1327Completion* c = channel_completion_begin(ch);
+
+  c->fcomp = fcomp;
+  c->fsent = NULL;
+  c->freply = NULL;
+  c->userdata = userdata;
+  channel_completion_end(ch);
+}
+
+// The same for a codeword sent, or dropped
+static void channel_post_sent(MPT1327Channel* ch,
+                              mpt1327_channel_sent_fn fsent,
+                              void* userdata, int expired)
+{
+  MPT1327Completion* c = channel_completion_begin(ch);
+
+  c->fcomp = NULL;
+  c->fsent = fsent;
+  c->freply = NULL;
+  c->userdata = userdata;
+  c->expired = expired;
+  channel_completion_end(ch);
+}
+
+// The same for a reply, or its timeout
+static void channel_post_reply(MPT1327Channel* ch,
+                               mpt1327_channel_reply_fn freply,
+                               void* userdata, int timeout,
+                               const guint64* cw, int count)
+{
+  MPT1327Completion* c = channel_completion_begin(ch);
+
+  c->fcomp = NULL;
+  c->fsent = NULL;
+  c->freply = freply;
+  c->userdata = userdata;
+  c->timeout = timeout;
+  c->count = count;
+  memcpy(c->cw, cw, count * sizeof(*cw));
+  channel_completion_end(ch);
+}
+
+// Scheduler events, on the sound thread. An item dropped at its deadline
+// won't get a reply either.
+static void sched_sent(void* userdata, const MPT1327TxItem* item)
+{
+  if (item->fsent)
+    channel_post_sent(userdata, item->fsent, item->sentdata, item->expired);
+  if (item->expired && item->freply)
+    channel_post_reply(userdata, item->freply, item->replydata, 1,
+                       item->cw, 0);
+}
+
+static void sched_reply(void* userdata, const MPT1327TxItem* item,
+                        int timeout, const guint64* cw, int count)
+{
+  if (item->freply)
+    channel_post_reply(userdata, item->freply, item->replydata, timeout,
+                       cw, count);
+}
+
+// Ident plays from the next sound buffer; the scheduler sends silence
+// until it ends
+static void sched_ident(void* userdata)
+{
+  MPT1327Channel* ch = userdata;
+  MPT1327Pcm* r = g_atomic_pointer_get(&ch->ident);
+
+  ch->ident_pcm = r->pcm;
+  ch->ident_left = r->length;
+}
+
+// Dispatcher thread: calls completions away from the sound thread, as
+// they may take locks (the Python one, say) and take their time
+static gpointer channel_dispatch(gpointer data)
+{
+  MPT1327Channel* ch = data;
+  MPT1327Completion c;
+  int rd;
+
+  g_mutex_lock(&ch->compl_mutex);
+  for (;;) {
+    rd = ch->cbcompl_rd;
+    while (rd != g_atomic_int_get(&ch->cbcompl_wr)) {
+      c = ch->cbcompl[rd];
+      rd = (rd + 1) % ch->cbtone_size;
+      g_atomic_int_set(&ch->cbcompl_rd, rd);
+      g_mutex_unlock(&ch->compl_mutex);
+      if (c.fcomp)
+        c.fcomp(c.userdata);
+      else if (c.fsent)
+        c.fsent(c.userdata, c.expired);
+      else
+        c.freply(c.userdata, c.timeout, c.cw, c.count);
+      g_atomic_int_add(&ch->compl_pending, -1);
+      g_mutex_lock(&ch->compl_mutex);
+    }
+    if (ch->compl_quit)
+      break;
+    g_cond_wait_until(&ch->compl_cond, &ch->compl_mutex,
+                      g_get_monotonic_time() + 10*G_TIME_SPAN_MILLISECOND);
+  }
+  g_mutex_unlock(&ch->compl_mutex);
+
+  return NULL;
+}
+
 static void sound_tx(mskmodem_sound_t* buf, gint32 samples, void* userdata)
 {
   MPT1327Channel* ch = userdata; 
-  int i, bufavail;
+  int i, rd, wr, bufavail;
   int p = 0;
 
   // Sound buffer (rx->tx)
@@ -112,67 +462,117 @@ static void sound_tx(mskmodem_sound_t* buf, gint32 samples, void* userdata)
     p++;
   }
 
-  g_mutex_lock(&ch->mutex); //TODO: don't lock so long
-
-  // Mix in tones
-  if (ch->cbtone_ready) {
-    MPT1327Tone* t = &ch->cbtone[ch->cbtone_rd];
+  // Mix in tones. This thread is the only reader of the queue and never
+  // waits on it: whatever the producer has published is played.
+  rd = ch->cbtone_rd;
+  wr = g_atomic_int_get(&ch->cbtone_wr);
+  i = 0;
+  while (i<samples && rd!=wr) {
+    MPT1327Tone* t = &ch->cbtone[rd];
     if (t->fcomp) {
-      t->fcomp(t->userdata);
+      channel_post_completion(ch, t->fcomp, t->userdata);
       t->fcomp = NULL;
     }
-    for (i=0; i<samples && t->duration>0; i++) {
-      mskmodem_sound_t v = buf[i] + 0.6 * MSKMODEM_SOUND_FULLSCALE *  
-                           sin(2.0*G_PI*t->duration*t->freq/48000.0);
-      buf[i] = tanhf(v);
-      t->duration -= 1;
-      if (t->duration==0) {
-        ch->cbtone_rd = (ch->cbtone_rd + 1) % ch->cbtone_size;
-        ch->cbtone_ready -= 1;
-        t = &ch->cbtone[ch->cbtone_rd];
+    for (; i<samples && t->duration>0; i++) {
+      if (t->pcm)
+        buf[i] = tone_clip(buf[i] + t->pcm[t->length - t->duration]);
+      else {
+        ch->tone_phase += t->step;
+        buf[i] = tone_clip(buf[i] + tone_sample(ch->tone_phase));
       }
+      t->duration -= 1;
+    }
+    if (t->duration<=0) {
+      rd = (rd + 1) % ch->cbtone_size;
+      ch->tone_phase = 0;
+      g_atomic_int_set(&ch->cbtone_rd, rd);
+    }
+  }
+
+  // Morse ident, between control channel frames
+  if (ch->ident_pcm) {
+    for (i=0; i<samples && ch->ident_left>0; i++, ch->ident_left--)
+      buf[i] = tone_clip(buf[i] + *ch->ident_pcm++);
+    if (ch->ident_left<=0) {
+      ch->ident_pcm = NULL;
+      mpt1327_sched_ident_done(&ch->sched);
     }
   }
 
-  g_mutex_unlock(&ch->mutex);
+}
+
+// Takes the queue for writing if it has room for n more tones, and a
+// completion if compl is set. Returns -1, the queue not taken, if not.
+static int channel_queue_begin(MPT1327Channel* ch, int n, int compl)
+{
+  int space;
+
+  g_mutex_lock(&ch->tone_lock);
 
+  space = (g_atomic_int_get(&ch->cbtone_rd) - ch->cbtone_wr - 1 +
+           ch->cbtone_size) % ch->cbtone_size;
+  if (n > space || (compl && g_atomic_int_get(&ch->compl_pending) >=
+                    ch->cbtone_size - 1)) {
+    ch->tone_overflows++;
+    g_mutex_unlock(&ch->tone_lock);
+    return -1;
+  }
+
+  if (compl)
+    g_atomic_int_inc(&ch->compl_pending);
+  ch->cbtone_put = ch->cbtone_wr;
+  return 0;
 }
 
-void mpt1327_channel_queue_tone(
+static void channel_queue_put(
   MPT1327Channel* ch,
-  gint16 freq, 
+  gint16 freq,
   gint32 duration,
+  const mskmodem_sound_t* pcm,
   mpt1327_channel_completion_fn fcomp,
   void* userdata
 )
 {
-  g_mutex_lock(&ch->mutex);
-
-  // If full just bomb TODO: improve this, it will leak completions!
-  if (ch->cbtone_ready >= ch->cbtone_size)
-    return;
+  MPT1327Tone* t = &ch->cbtone[ch->cbtone_put];
 
-  // Put tone into buffer
-  ch->cbtone[ch->cbtone_wr].freq = freq;
-  ch->cbtone[ch->cbtone_wr].duration = duration;
-  ch->cbtone[ch->cbtone_wr].fcomp = fcomp;
-  ch->cbtone[ch->cbtone_wr].userdata = userdata;
-  ch->cbtone_wr = (ch->cbtone_wr + 1) % ch->cbtone_size;
-  ch->cbtone_ready += 1;
+  t->step = ((guint64)freq << 32) / mskmodem_rate(ch->modem);
+  t->duration = duration;
+  t->pcm = pcm;
+  t->length = duration;
+  t->fcomp = fcomp;
 
-  g_mutex_unlock(&ch->mutex);
+  t->userdata = userdata;
+  ch->cbtone_put = (ch->cbtone_put + 1) % ch->cbtone_size;
+}
 
-}  
+// Hands the tones put since channel_queue_begin to the sound thread
+static void channel_queue_end(MPT1327Channel* ch)
+{
+  g_atomic_int_set(&ch->cbtone_wr, ch->cbtone_put);
+  g_mutex_unlock(&ch->tone_lock);
+}
 
-void mpt1327_channel_queue_morse(
-  MPT1327Channel* ch, 
-  const char* str,
+int mpt1327_channel_queue_tone(
+  MPT1327Channel* ch,
+  gint16 freq, 
+  gint32 duration,
   mpt1327_channel_completion_fn fcomp,
   void* userdata
 )
 {
+  if (channel_queue_begin(ch, 1, fcomp!=NULL))
+    return -1;
+  channel_queue_put(ch, freq, duration, NULL, fcomp, userdata);
+  channel_queue_end(ch);
+  return 0;
+}
 
-  const int c = 3200;
+typedef void (*morse_tone_fn)(gpointer data, gint16 freq, gint32 duration);
+
+// Calls fn with each tone (or space) of a morse string
+static void morse_tones(const char* str, int c, morse_tone_fn fn,
+                        gpointer data)
+{
 
   const char* s = str;
   while (*s) {
@@ -184,12 +584,12 @@ void mpt1327_channel_queue_morse(
         const char* r = *p+1;
         while (*r) {
           if (*r=='.')
-            mpt1327_channel_queue_tone(ch, 800, 1 * c, NULL, NULL);
+            fn(data, 800, 1 * c);
           else
-            mpt1327_channel_queue_tone(ch, 800, 3 * c, NULL, NULL);
+            fn(data, 800, 3 * c);
           r++;
           // Signaling space (ITU-R M.1667-1 2009 2.2)
-          mpt1327_channel_queue_tone(ch, 0, 1 * c, NULL, NULL);
+          fn(data, 0, 1 * c);
         }
         break;
       }
@@ -197,19 +597,110 @@ void mpt1327_channel_queue_morse(
     }
 
     // Letter space is 3 dots (including signal space above)
-    mpt1327_channel_queue_tone(ch, 0, 2 * c, NULL, NULL);
+    fn(data, 0, 2 * c);
 
     // Word space is 7 dots (including letter space and signal space above)
     if (*s==' ')
-      mpt1327_channel_queue_tone(ch, 0, 4 * c, NULL, NULL);
+      fn(data, 0, 4 * c);
 
     s++;
   }
+
+}
+
+static void morse_count(gpointer data, gint16 freq, gint32 duration)
+{
+  (*(int*)data)++;
+}
+
+static void morse_queue_tone(gpointer data, gint16 freq, gint32 duration)
+{
+  channel_queue_put(data, freq, duration, NULL, NULL, NULL);
+}
+
+static void morse_measure(gpointer data, gint16 freq, gint32 duration)
+{
+  ((MPT1327Pcm*)data)->length += duration;
+}
+
+// Renders the tones as the mixer would play them
+static void morse_render(gpointer data, gint16 freq, gint32 duration)
+{
+  MPT1327Pcm* r = data;
+  guint32 step = ((guint64)freq << 32) / r->rate;
+  guint32 phase = 0;
+  int i;
+
+  for (i=0; i<duration; i++) {
+    phase += step;
+    r->pcm[r->length++] = tone_sample(phase);
+  }
+}
+
+static void morse_pcm_free(gpointer data)
+{
+  MPT1327Pcm* r = data;
+  g_free(r->pcm);
+  g_free(r);
+}
+
+// Rendered morse for a string, from the cache or made now. NULL when the
+// cache is full: that string is then queued as separate tones.
+static MPT1327Pcm* morse_get(MPT1327Channel* ch, const char* str, int c)
+{
+  gchar* key = g_strdup_printf("%d:%s", c, str);
+  MPT1327Pcm* r = g_hash_table_lookup(ch->morse_cache, key);
+
+  if (r || g_hash_table_size(ch->morse_cache) >= MPT1327_MORSE_CACHE) {
+    g_free(key);
+    return r;
+  }
+
+  r = g_new0(MPT1327Pcm, 1);
+  r->rate = mskmodem_rate(ch->modem);
+  morse_tones(str, c, morse_measure, r);
+  r->pcm = g_new(mskmodem_sound_t, r->length);
+  r->length = 0;
+  morse_tones(str, c, morse_render, r);
+  g_hash_table_insert(ch->morse_cache, key, r);
+
+  return r;
+}
+
+int mpt1327_channel_queue_morse(
+  MPT1327Channel* ch, 
+  const char* str,
+  mpt1327_channel_completion_fn fcomp,
+  void* userdata
+)
+{
+
+  const int c = mskmodem_rate(ch->modem) / MORSE_DOT_RATE;
+  int n = 0;
+
+  // Rendered once, then replayed straight from the cache
+  MPT1327Pcm* r = morse_get(ch, str, c);
+  if (r)
+    n = r->length ? 1 : 0;
+  else
+    morse_tones(str, c, morse_count, &n);
+
+  // All or nothing: a partly queued ident would be worse than none
+  if (channel_queue_begin(ch, n + (fcomp ? 1 : 0), fcomp!=NULL))
+    return -1;
+
+  if (r && r->length)
+    channel_queue_put(ch, 0, r->length, r->pcm, NULL, NULL);
+  else if (!r)
+    morse_tones(str, c, morse_queue_tone, ch);
   
-  // Queue completion callback (TODO: improve readability)
+  // Completion is called as the trailing silence starts
   if (fcomp)
-    mpt1327_channel_queue_tone(ch, 0, 4 * c, fcomp, userdata);
+    channel_queue_put(ch, 0, 4 * c, NULL, fcomp, userdata);
 
+  channel_queue_end(ch);
+
+  return 0;
 }
 
 void mpt1327_channel_bridge(
@@ -220,39 +711,326 @@ void mpt1327_channel_bridge(
   ch->enable_bridge = bridge;
 }
 
+int
+mpt1327_channel_set_demod(
+  MPT1327Channel* ch,
+  MSKModemDemod demod
+)
+{
+  return mskmodem_set_demod(ch->modem, demod);
+}
+
+int
+mpt1327_channel_set_modulator(
+  MPT1327Channel* ch,
+  MSKModemTxMode mode,
+  MSKModemShape shape,
+  float level
+)
+{
+  return mskmodem_set_modulator(ch->modem, mode, shape, level);
+}
+
+void
+mpt1327_channel_set_correction(
+  MPT1327Channel* ch,
+  int enable
+)
+{
+  ch->rx_correct = enable;
+}
+
+int
+mpt1327_channel_set_sync_tolerance(
+  MPT1327Channel* ch,
+  int errors
+)
+{
+  if (errors < 0 || errors > MPT1327_SYNC_TOLERANCE_MAX)
+    return -1;
+  ch->rx_sync_tolerance = errors;
+  return 0;
+}
+
+int
+mpt1327_channel_set_carrier(
+  MPT1327Channel* ch,
+  MSKModemCarrierMode mode,
+  mpt1327_channel_carrier_fn carrierfn
+)
+{
+  if (mode < 0 || mode >= MSKMODEM_CARRIER_COUNT)
+    return -1;
+
+  ch->carrier_callback = carrierfn;
+  mskmodem_set_carrier(ch->modem, mode, modem_carrier);
+
+  return 0;
+}
+
+int
+mpt1327_channel_set_eq(
+  MPT1327Channel* ch,
+  MSKModemEqMode mode
+)
+{
+  return mskmodem_set_eq(ch->modem, mode) ? -1 : 0;
+}
+
+void
+mpt1327_channel_eq_state(
+  MPT1327Channel* ch,
+  MSKModemEqState* state
+)
+{
+  mskmodem_rx_eq(ch->modem, state);
+}
+
+int
+mpt1327_channel_set_split(
+  MPT1327Channel* ch,
+  const char* capture,
+  const char* playback
+)
+{
+  return mskmodem_set_sound_split(ch->modem, capture, playback) ? -1 : 0;
+}
+
+void
+mpt1327_channel_split_stats(
+  MPT1327Channel* ch,
+  MSKModemSoundSplitStats* capture,
+  MSKModemSoundSplitStats* playback
+)
+{
+  mskmodem_sound_stats(ch->modem, capture, playback);
+}
+
+int
+mpt1327_channel_set_pipeline(
+  MPT1327Channel* ch,
+  int lookahead
+)
+{
+  return mskmodem_set_pipeline(ch->modem, lookahead) ? -1 : 0;
+}
+
+void
+mpt1327_channel_pipeline_stats(
+  MPT1327Channel* ch,
+  MSKModemSoundPipelineStats* stats
+)
+{
+  mskmodem_pipeline_stats(ch->modem, stats);
+}
+
+int
+mpt1327_channel_set_batch(
+  MPT1327Channel* ch,
+  int enable
+)
+{
+  int ret = 0;
+
+  if (g_atomic_int_get(&ch->running))
+    return -1;
+
+  g_mutex_lock(&channel_batch_lock);
+  if (enable && !ch->rx_batch) {
+    if (!channel_batch)
+      channel_batch = mskmodem_batch_new(MPT1327_BATCH_CHANNELS);
+    if (mskmodem_batch_attach(channel_batch, ch->modem))
+      ret = -1;
+    else {
+      ch->rx_batch = TRUE;
+      channel_batch_users++;
+    }
+  }
+  else if (!enable && ch->rx_batch) {
+    mskmodem_batch_detach(ch->modem);
+    ch->rx_batch = FALSE;
+    channel_batch_users--;
+  }
+  if (channel_batch && !channel_batch_users)
+    mskmodem_batch_free(&channel_batch);
+  g_mutex_unlock(&channel_batch_lock);
+
+  return ret;
+}
+
+int
+mpt1327_channel_send(
+  MPT1327Channel* ch,
+  MPT1327Mode mode,
+  const MPT1327TxItem* item
+)
+{
+  int compl = (item->fsent ? 1 : 0) + (item->freply ? 1 : 0);
+
+  // Completion slots are reserved as for tones
+  if (g_atomic_int_add(&ch->compl_pending, compl) + compl >
+      ch->cbtone_size - 1 ||
+      mpt1327_sched_put(&ch->sched, mode, item)) {
+    g_atomic_int_add(&ch->compl_pending, -compl);
+    ch->queue_overflows++;
+    return -1;
+  }
+
+  return 0;
+}
+
+int
+mpt1327_channel_set_control(
+  MPT1327Channel* ch,
+  guint64 ccsc,
+  guint64 alh,
+  guint64 dummy
+)
+{
+  if (g_atomic_int_get(&ch->running))
+    return -1;
+
+  ch->sched.ccsc = ccsc;
+  ch->sched.alh = alh;
+  ch->sched.dummy = dummy;
+  return 0;
+}
+
+int
+mpt1327_channel_ident(
+  MPT1327Channel* ch,
+  const char* str
+)
+{
+  MPT1327Pcm* r;
+
+  // One at a time, and only rendered ones
+  if (g_atomic_int_get(&ch->sched.ident) ||
+      !(r = morse_get(ch, str, mskmodem_rate(ch->modem) / MORSE_DOT_RATE)) ||
+      !r->length)
+    return -1;
+
+  g_atomic_pointer_set(&ch->ident, r);
+  mpt1327_sched_ident(&ch->sched);
+  return 0;
+}
+
+int
+mpt1327_channel_prefill(
+  MPT1327Channel* ch,
+  const guint64* cw,
+  int count
+)
+{
+  guint64* enc = g_new(guint64, count);
+  int n, ret;
+
+  for (n=0; n<count; n++)
+    enc[n] = channel_encode(cw[n]);
+  ret = mskmodem_tx_prefill(ch->modem, enc, count);
+  g_free(enc);
+
+  return ret;
+}
+
+void
+mpt1327_channel_tx_stats(
+  MPT1327Channel* ch,
+  MPT1327TxStats* stats
+)
+{
+  mskmodem_tx_cache_stats(ch->modem, &stats->cache_hits,
+                          &stats->cache_misses);
+  stats->tone_overflows = ch->tone_overflows;
+  stats->queue_overflows = ch->queue_overflows;
+}
+
+void
+mpt1327_channel_queue_stats(
+  MPT1327Channel* ch,
+  MPT1327QueueStats stats[MPT1327_TX_QUEUES]
+)
+{
+  mpt1327_sched_stats(&ch->sched, stats);
+}
+
+int
+mpt1327_channel_set_aloha(
+  MPT1327Channel* ch,
+  int min,
+  int max,
+  int variants
+)
+{
+  return mpt1327_sched_aloha(&ch->sched, min, max, variants);
+}
+
+void
+mpt1327_channel_aloha_stats(
+  MPT1327Channel* ch,
+  MPT1327AlohaStats* stats
+)
+{
+  mpt1327_sched_aloha_stats(&ch->sched, stats);
+}
+
+void
+mpt1327_channel_rx_stats(
+  MPT1327Channel* ch,
+  MPT1327RxStats* stats
+)
+{
+  *stats = ch->rx_stats;
+  stats->overflows += ch->rx_overflows;
+
+  g_mutex_lock(&channel_batch_lock);
+  if (ch->rx_batch)
+    stats->batch_overruns = mskmodem_batch_overruns(channel_batch);
+  g_mutex_unlock(&channel_batch_lock);
+}
+
 int
 mpt1327_channel_stop(
   MPT1327Channel* ch
 )
 {
-  return mskmodem_stop(ch->modem);
+  int ret = mskmodem_stop(ch->modem);
+
+  g_atomic_int_set(&ch->running, 0);
+  return ret;
 }
 
 int mpt1327_channel_start(MPT1327Channel* ch)
 {
-  return mskmodem_run(ch->modem);
+  int ret;
+
+  g_atomic_int_set(&ch->running, 1);
+  ret = mskmodem_run(ch->modem);
+  if (ret)
+    g_atomic_int_set(&ch->running, 0);
+  return ret;
 }
 
 guint16 mpt1327_channel_fcs(guint64 cw) {
 
-  guint64 ck = 0;
-  int parity = 0, n, b;
+  guint16 ck = 0;
+  int n;
 
-  // Calculate checksum
-  for (n=0;n<48;n++) {
-    b = cw >> (47-n) & 1;
-    parity ^= b;
-    if ((b ^ (ck >> 15)) & 1) 
-      ck ^= 0x6815;
-    ck <<= 1;
-  }
+  // Calculate checksum a byte at a time
+  for (n=40; n>=0; n-=8)
+    ck = ck << 8 ^ fcs_table[(ck >> 8 ^ cw >> n) & 0xFF];
   ck = (ck ^ 0x0002) & 0xFFFE;
 
-  // Calculate parity
-  for (n=0;n<16;n++)
-    parity ^= ck >> (15-n) & 1;
+  // Parity over data and checksum
+  return ck | __builtin_parityll((cw & 0xFFFFFFFFFFFFULL) ^ ck);
+}
+
+void mpt1327_channel_fcs_many(const guint64* cw, guint16* fcs, int count) {
+
+  int n;
 
-  return ck | parity;
+  for (n=0; n<count; n++)
+    fcs[n] = mpt1327_channel_fcs(cw[n]);
 }
 
 guint64 mpt1327_channel_fcs_add(guint64 cw) {
@@ -264,23 +1042,33 @@ int
 mpt1327_channel_init( 
   MPT1327Channel** ppCh,
   const char* channelId,
+  MPT1327Mode mode,
   mpt1327_channel_recv_fn recvfn,
-  mpt1327_channel_txcv_fn txcvfn,
   void* context
 )
 {
   
   MPT1327Channel* ch = g_new0(MPT1327Channel, 1);
+  int n;
+
+  for (n=0; n<MPT1327_RX_PATHS; n++)
+    mpt1327_framer_reset(&ch->rx_framer[n]);
+  ch->rx_sync_tolerance = MPT1327_SYNC_TOLERANCE;
+
+  mpt1327_sched_init(&ch->sched, mode);
+  ch->sched.on_sent = sched_sent;
+  ch->sched.on_reply = sched_reply;
+  ch->sched.on_ident = sched_ident;
+  ch->sched.userdata = ch;
   
   mskmodem_init(&ch->modem, channelId,
                 modem_rx, modem_tx,
                 sound_rx, sound_tx, ch);
+  mskmodem_set_carrier(ch->modem, MSKMODEM_CARRIER_GATE, modem_carrier);
 
   ch->userdata = context;
   ch->rx_callback = recvfn;
-  ch->tx_callback = txcvfn;
 
-  g_mutex_init(&ch->mutex);
 
   // Sound bridge circular buffer
   ch->cbsnd_size = 10240; //TODO: arbitrary value: calculate properly
@@ -289,6 +1077,20 @@ mpt1327_channel_init(
   // Tones queue
   ch->cbtone_size = 512;
   ch->cbtone = g_new(MPT1327Tone, ch->cbtone_size);
+  g_mutex_init(&ch->tone_lock);
+  ch->morse_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                          g_free, morse_pcm_free);
+
+  // Completion dispatcher
+  ch->cbcompl = g_new(MPT1327Completion, ch->cbtone_size);
+  g_mutex_init(&ch->compl_mutex);
+  g_cond_init(&ch->compl_cond);
+  ch->compl_thread = g_thread_new("mpt1327-compl", channel_dispatch, ch);
+
+  // Controller thread
+  g_mutex_init(&ch->ctl_mutex);
+  g_cond_init(&ch->ctl_cond);
+  ch->ctl_thread = g_thread_new("mpt1327-ctl", channel_control, ch);
 
   *ppCh = ch;
 
@@ -302,9 +1104,34 @@ void mpt1327_channel_free(MPT1327Channel** ppCh)
   {
     MPT1327Channel* ch = *ppCh;
     mpt1327_channel_stop(ch);
+    mpt1327_channel_set_batch(ch, FALSE);
     mskmodem_free(&ch->modem);
+
+    // Codewords already received are still passed on
+    g_mutex_lock(&ch->ctl_mutex);
+    ch->ctl_quit = TRUE;
+    g_cond_signal(&ch->ctl_cond);
+    g_mutex_unlock(&ch->ctl_mutex);
+    g_thread_join(ch->ctl_thread);
+    g_cond_clear(&ch->ctl_cond);
+    g_mutex_clear(&ch->ctl_mutex);
+
+    // Codewords not sent and replies awaited complete as dropped and
+    // timed out; those and completions already posted are still called
+    mpt1327_sched_clear(&ch->sched);
+    g_mutex_lock(&ch->compl_mutex);
+    ch->compl_quit = TRUE;
+    g_cond_signal(&ch->compl_cond);
+    g_mutex_unlock(&ch->compl_mutex);
+    g_thread_join(ch->compl_thread);
+    g_cond_clear(&ch->compl_cond);
+    g_mutex_clear(&ch->compl_mutex);
+    g_free(ch->cbcompl);
+
+    g_mutex_clear(&ch->tone_lock);
     g_free(ch->cbsnd);
     g_free(ch->cbtone);
+    g_hash_table_destroy(ch->morse_cache);
     g_free(ch);
     *ppCh = NULL;
   }
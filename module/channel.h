@@ -22,68 +22,186 @@
 
 #include <mskmodem.h>
 
-typedef void (*mpt1327_channel_recv_fn)(void* userdata, guint64 cw);
-typedef guint64 (*mpt1327_channel_txcv_fn)(void* userdata);
-typedef guint64 (*mpt1327_channel_completion_fn)(void* userdata);
+#include "framer.h"
+#include "scheduler.h"
+
+// Most demodulator bit streams (paths) a channel decodes at once; the
+// multiphase demodulator has the most
+#define MPT1327_RX_PATHS MSKMODEM_PHASES
+
+// Received codewords and carrier changes waiting for the controller (one
+// slot is always left empty)
+#define MPT1327_RX_QUEUE 64
+
+// Most channels on the shared batch demodulator
+#define MPT1327_BATCH_CHANNELS 32
+
+// Receive counters
+typedef struct MPT1327RxStats_s
+{
+  guint32 codewords; // Codewords passed up
+  guint32 corrected; // ...of which had a bit corrected
+  guint32 carriers;  // Times carrier came on
+  guint32 overflows; // Codewords and carrier changes dropped, the
+                     // controller too far behind to take them
+  guint32 batch_overruns; // Periods the shared batch demodulator dropped,
+                          // on all its channels
+} MPT1327RxStats;
+
+// Transmit counters
+typedef struct MPT1327TxStats_s
+{
+  guint32 cache_hits;   // Codewords played from the waveform cache
+  guint32 cache_misses; // ...and rendered into it
+  guint32 tone_overflows; // Tones and morse refused, the tone queue full
+  guint32 queue_overflows; // Codewords refused, the transmit queue full
+} MPT1327TxStats;
+
+typedef void (*mpt1327_channel_recv_fn)(void* userdata, guint64 cw,
+                                        const MPT1327RxInfo* info);
+typedef void (*mpt1327_channel_carrier_fn)(void* userdata, int on,
+                                           guint64 sample);
 
 typedef struct MPT1327Tone_s
 {
-  gint16 freq;
-  gint32 duration;
+  guint32 step;     // Oscillator phase step, 2^32 is a cycle
+  gint32 duration;  // Samples left
+  const mskmodem_sound_t* pcm; // Pre-rendered sound instead, if not NULL
+  gint32 length;               // ...and its length
   mpt1327_channel_completion_fn fcomp;
   void* userdata;
 } MPT1327Tone;
 
+// Completion due, passed from the sound thread to the dispatcher thread
+typedef struct MPT1327Completion_s
+{
+  mpt1327_channel_completion_fn fcomp;
+  mpt1327_channel_sent_fn fsent;   // A codeword sent (or dropped) instead
+  mpt1327_channel_reply_fn freply; // ...or a reply (or its timeout)
+  void* userdata;
+  int expired;
+  int timeout;
+  int count;
+  guint64 cw[MPT1327_REPLY_MAX];
+} MPT1327Completion;
+
+// Codeword received or carrier change, passed from the sound thread to the
+// controller thread
+typedef struct MPT1327RxEvent_s
+{
+  guint64 cw;   // Codeword, or the sample the carrier changed at
+  int carrier;  // -1 for a codeword, else the carrier's new state
+  MPT1327RxInfo info;
+} MPT1327RxEvent;
+
+// Most different morse strings kept rendered
+#define MPT1327_MORSE_CACHE 8
+
 typedef struct MPT1327Channel_s
 {
   // Modem thread
   MSKModemContext* modem;
   
   // Codeword transmission
-  mpt1327_channel_txcv_fn tx_callback;
+  MPT1327Scheduler sched;
+  guint32 queue_overflows;
 
-  // Codeword reception
-  guint64 rx_cw;
+  // Codeword reception, one framer per demodulator path
+  MPT1327Framer rx_framer[MPT1327_RX_PATHS];
   mpt1327_channel_recv_fn rx_callback;
+  guint64 rx_last_cw;  // Last codeword passed up, to drop copies from
+  guint32 rx_last_bit; // other paths; rx_bits when it was received
+  guint32 rx_bits;     // Path 0 bit count
+  gboolean rx_correct; // Correct single bit errors at expected codeword ends
+  int rx_sync_tolerance; // Sync word bit errors accepted
+  mpt1327_channel_carrier_fn carrier_callback;
+  MPT1327RxStats rx_stats;
+  gboolean rx_batch;   // On the shared batch demodulator
+
+  // Received codewords and carrier changes go from the receive side of the
+  // sound thread to the transmit side (cbin), where the scheduler takes the
+  // replies it waits for. The rest go on to the controller thread (cbrx).
+  // Both are single producer, single consumer rings with a slot left empty.
+  MPT1327RxEvent cbin[MPT1327_RX_QUEUE];
+  gint cbin_wr;
+  gint cbin_rd;
+  MPT1327RxEvent cbrx[MPT1327_RX_QUEUE];
+  gint cbrx_wr;
+  gint cbrx_rd;
+  guint32 rx_overflows; // On the transmit side, for cbrx
+
+  // Controller thread: calls rx_callback and carrier_callback, which may
+  // take locks (the Python one, say) and take their time, off the sound
+  // thread
+  GThread* ctl_thread;
+  GMutex ctl_mutex;
+  GCond ctl_cond;
+  gboolean ctl_quit;
+  gint running;
 
   // Sound bridge
   gboolean enable_bridge;
-  float* cbsnd;
+  mskmodem_sound_t* cbsnd;
   int cbsnd_size;   // Buffer size
   int cbsnd_ready;  // Ready count
   int cbsnd_wr;     // Write index
   int cbsnd_rd;     // Read index
 
-  // Tone synthesiser
+  // Tone synthesiser. The queue is a single producer, single consumer
+  // ring: the sound thread reads it without locking, tone_lock only keeps
+  // queueing threads from writing at once. One slot is always left empty.
   MPT1327Tone* cbtone;
   int cbtone_size;   // Buffer size
-  int cbtone_ready;  // Ready count
-  int cbtone_wr;     // Write index
-  int cbtone_rd;     // Read index
+  gint cbtone_wr;    // Write index, set by the producer
+  gint cbtone_rd;    // Read index, set by the sound thread
+  int cbtone_put;    // Producer's write index before publishing
+  GMutex tone_lock;
+  guint32 tone_phase; // Oscillator phase
+  guint32 tone_overflows;
+  GHashTable* morse_cache; // "dot:text" to rendered morse (MPT1327Pcm)
+
+  // Morse ident the scheduler sends between frames: set by the queueing
+  // thread, then played from the start by the sound thread
+  gpointer ident;          // MPT1327Pcm
+  const mskmodem_sound_t* ident_pcm;
+  gint32 ident_left;
+
+  // Completions, posted by the sound thread as their tones start and called
+  // on the dispatcher thread. Queueing reserves a slot for each one so the
+  // sound thread never finds this ring full.
+  MPT1327Completion* cbcompl; // cbtone_size entries
+  gint cbcompl_wr;
+  gint cbcompl_rd;
+  gint compl_pending; // Completions queued and not yet called
+  GThread* compl_thread;
+  GMutex compl_mutex;
+  GCond compl_cond;
+  gboolean compl_quit;
 
   // Misc
   void* userdata;
-  GMutex mutex;
 
 } MPT1327Channel;
 
 int mpt1327_channel_init(MPT1327Channel** ppCh, const char* channelId,
+                         MPT1327Mode mode,
                          mpt1327_channel_recv_fn recvfn,
-                         mpt1327_channel_txcv_fn txcvfn,
                          void* context);
 void mpt1327_channel_free(MPT1327Channel** ppCh);
 int mpt1327_channel_stop(MPT1327Channel* ch);
 int mpt1327_channel_start(MPT1327Channel* ch);
 guint16 mpt1327_channel_fcs(guint64 cw);
+void mpt1327_channel_fcs_many(const guint64* cw, guint16* fcs, int count);
 guint64 mpt1327_channel_fcs_add(guint64 cw);
-void mpt1327_channel_queue_tone(
+// duration is in samples at the modem's rate (mskmodem_rate)
+int mpt1327_channel_queue_tone(
     MPT1327Channel* ch,
     gint16 freq,
     gint32 duration,
     mpt1327_channel_completion_fn fcomp,
     void* userdata
 );
-void mpt1327_channel_queue_morse(
+int mpt1327_channel_queue_morse(
     MPT1327Channel* ch,
     const char* morse,
     mpt1327_channel_completion_fn fcomp,
@@ -93,6 +211,114 @@ void mpt1327_channel_bridge(
     MPT1327Channel* ch,
     int bridge
 );
+int mpt1327_channel_set_demod(
+    MPT1327Channel* ch,
+    MSKModemDemod demod
+);
+int mpt1327_channel_set_modulator(
+    MPT1327Channel* ch,
+    MSKModemTxMode mode,
+    MSKModemShape shape,
+    float level
+);
+void mpt1327_channel_set_correction(
+    MPT1327Channel* ch,
+    int enable
+);
+int mpt1327_channel_set_sync_tolerance(
+    MPT1327Channel* ch,
+    int errors
+);
+int mpt1327_channel_set_carrier(
+    MPT1327Channel* ch,
+    MSKModemCarrierMode mode,
+    mpt1327_channel_carrier_fn carrierfn
+);
+int mpt1327_channel_set_eq(
+    MPT1327Channel* ch,
+    MSKModemEqMode mode
+);
+void mpt1327_channel_eq_state(
+    MPT1327Channel* ch,
+    MSKModemEqState* state
+);
+int mpt1327_channel_set_split(
+    MPT1327Channel* ch,
+    const char* capture,
+    const char* playback
+);
+void mpt1327_channel_split_stats(
+    MPT1327Channel* ch,
+    MSKModemSoundSplitStats* capture,
+    MSKModemSoundSplitStats* playback
+);
+int mpt1327_channel_set_pipeline(
+    MPT1327Channel* ch,
+    int lookahead
+);
+void mpt1327_channel_pipeline_stats(
+    MPT1327Channel* ch,
+    MSKModemSoundPipelineStats* stats
+);
+// Moves the channel on to or off the batch demodulator it shares with the
+// other channels asking for it (when stopped). It demodulates incoherently,
+// at 48kHz only.
+int mpt1327_channel_set_batch(
+    MPT1327Channel* ch,
+    int enable
+);
+// Queues a codeword to send in a mode: control channel codewords take the
+// next free address slot, traffic channel ones go after a SYNT
+int mpt1327_channel_send(
+    MPT1327Channel* ch,
+    MPT1327Mode mode,
+    const MPT1327TxItem* item
+);
+// Codewords (callback form) an idle control channel sends: its CCSC, an
+// ALH with N 0, and a dummy AHY to withdraw slots. Only while stopped.
+int mpt1327_channel_set_control(
+    MPT1327Channel* ch,
+    guint64 ccsc,
+    guint64 alh,
+    guint64 dummy
+);
+// Sends a morse ident between the next control channel frames
+int mpt1327_channel_ident(
+    MPT1327Channel* ch,
+    const char* str
+);
+int mpt1327_channel_prefill(
+    MPT1327Channel* ch,
+    const guint64* cw,
+    int count
+);
+void mpt1327_channel_tx_stats(
+    MPT1327Channel* ch,
+    MPT1327TxStats* stats
+);
+void mpt1327_channel_rx_stats(
+    MPT1327Channel* ch,
+    MPT1327RxStats* stats
+);
+// Transmit queues: each control channel class (MPT1327_PRIO_*), then the
+// traffic channel's
+void mpt1327_channel_queue_stats(
+    MPT1327Channel* ch,
+    MPT1327QueueStats stats[MPT1327_TX_QUEUES]
+);
+// Aloha frame lengths the control channel picks from as the random access
+// load changes (min and max equal for a fixed length), and whether it may
+// use ALHR and ALHX frames in overload
+int mpt1327_channel_set_aloha(
+    MPT1327Channel* ch,
+    int min,
+    int max,
+    int variants
+);
+void mpt1327_channel_aloha_stats(
+    MPT1327Channel* ch,
+    MPT1327AlohaStats* stats
+);
 
 #endif /* CHANNEL_H */
 
@@ -21,231 +21,201 @@
 """Implementation of MPT1327 channel controller"""
 
 import sys
+import math
 import logging
-from libmpt1327modem import MPT1327Modem
+from libmpt1327modem import MPT1327Modem, MODE_CONTROL, MODE_TRAFFIC, \
+  PRIO_EMERGENCY, PRIO_CALL, PRIO_ACK, PRIO_HOUSEKEEPING, TX_CODEWORDS
 import mpt1327 as mpt
-from queue import Queue
-
-class TRAF:
-  """Traffic SYNC codeword"""
-  def cw(self):
-    return 1 # Special meaning
-  def __str__(self):
-    return "TRAFFIC"
-
-class TXItem:
-  """TX queue item"""
-  def __init__(self, cw, txcompletionitem=None, rxcompletionitem=None):
-    self.cw = cw
-    self.txcomplete = txcompletionitem
-    self.rxcomplete = rxcompletionitem
-
-class TXCompletionItem:
-  """TX completion item"""
-  def __init__(self, cfunc, data=None):
-    self.cfunc = cfunc
-    self.data = data
-  def complete(self, ch):
-    return self.cfunc(self.data, ch)
-
-class RXCompletionItem:
-  """Solicited RX completion item"""
-  def __init__(self, size, cfunc, data=None):
-    self.size = size
-    self.remaining = size
-    self.cfunc = cfunc
-    self.data = data
-    self.cws = []
-    self.slottimeout = 4 # 64-bit slots
-
-  def addcw(self, ch, cw):
-    self.cws += [cw]
-    self.remaining -= 1
-    self.slottimeout = 4 # Reset timeout
-    if self.remaining>0:
-      return 0 # More codewords needed
-    else:
-      self.cfunc(self.data, 0, ch, self.cws)
-      return 1
 
-  def tick(self, ch):
-    self.slottimeout -= 1
-    if self.slottimeout==0:
-      ch.rxcomplete = None # We timed out of our slot so no point waiting
-      self.cfunc(self.data, 1, ch, None)      
+# A codeword's time on air, seconds
+CW_TIME = 64 / 1200
 
 class Channel:
-  """MPT1327 channel controller"""
-
-  def __init__(self, syscode, channelnumber, rxfunc, rxfuncdata, txstate=0):
+  """MPT1327 channel controller
+
+  Codewords are decided as they are sent by the scheduler in the modem
+  module: CCSC and ALH (or queued codewords) in Aloha frames on a control
+  channel, queued codewords after a SYNT on a traffic channel. Tx() and
+  TxTraf() queue them, with callbacks for when they've been sent and for
+  the reply in the slots reserved after them. Control channel codewords
+  are sent highest class (PRIO_*) first, and any with a deadline that are
+  still waiting at it are dropped. A list of codewords (up to
+  TX_CODEWORDS) is sent as one: in consecutive slots with nothing else
+  between them, and with one txfunc call after the last. Aloha frames are
+  as long as the random access load measured in the frames before them
+  needs (SetAloha(), AlohaStats())."""
+
+  def __init__(self, syscode, channelnumber, rxfunc, rxfuncdata,
+               mode=MODE_CONTROL):
     self.syscode = syscode
     self.channelnumber = channelnumber
     self.rxfunc = rxfunc
     self.rxfuncdata = rxfuncdata
-    self.ahlcount = 0           # Aloha frame counter
-    self.rxcomplete = None      # RX completion object for solicited message
-    self.txcomplete = None      # TX completion object
-    self.txqueue = Queue()      # Control channel transmission queue
-    self.txtrafqueue = Queue()  # Traffic channel transmission queue
-    self.txstate = txstate      # TX state machine state
-    self.txreserved = 0         # Slot reservations
-    self.txreserveditem = None  # RX completion object holder
-    channelId = "TSC-Ch.%d" % channelnumber
-    self.modem = MPT1327Modem(channelId, Channel._rxcv, Channel._txcv, self)
     self.logger = logging.getLogger(__name__)
-    self.morse = None
-    self.lastcw = None
-
-  def _tick(self):
-    if self.rxcomplete:
-      self.rxcomplete.tick(self)
-
-  def _txcvimpl(self):
-    cw = None
-    n = 0
-
-    # Log last transmitted
-    if self.lastcw:
-      self.logger.debug("TX[%d]: %s", self.channelnumber, self.lastcw)
-      self.lastcw = None
-
-    # Transmission provides our ticker for time-outs
-    self._tick()
-
-    # Call transmission complete item
-    if self.txcomplete:
-      nextstate = self.txcomplete.complete(self)
-      self.txcomplete = None
-      if nextstate is not None:
-        self.txstate = nextstate
-
-    # Queue received item for action by receiver
-    if self.txreserveditem:
-      self.rxcomplete = self.txreserveditem
-      self.txreserveditem = None
-
-    if self.txstate==0: # STATE:0 - DECIDE OR BEGIN CODEWORD
-
-      # Morse ident transmission - begins outside MPT1327 frame only
-      if not self.morse==None and self.ahlcount==0:
-        self.modem.morse(self.morse, Channel._morse_done, self)
-        self.morse = None
-        self.txstate = 4
-      else:
-        cw = mpt.CCSC(self.syscode)
-        self.txstate = 1
-
-    elif self.txstate==1: # STATE:1 - CONTROL CHANNEL CODEWORD
-      self.txstate = 0
-      
-      # Frame handling
-      if self.ahlcount==0:
-        self.ahlcount = 5
-        n = self.ahlcount
-      self.ahlcount -= 1
-      if self.ahlcount<0:
-        self.ahlcount = 0
-
-      # Withdrawn slots handling (7.2.5)
-      if self.txreserved:
-        self.txreserved -= 1
-      if self.txreserved: # Multi slot...
-          cw = mpt.AHY(0, mpt.DUMMYI, mpt.DUMMYI, 0, 0, 0, 0 ,0)
-
-      # Queue handling
-      elif not self.txqueue.empty():
-        o = self.txqueue.get_nowait()
-        cw = o.cw
-        self.txcomplete= o.txcomplete
-        self.txreserved = 0
-        if o.rxcomplete:
-          self.txreserved = o.rxcomplete.size
-          self.txreserveditem = o.rxcomplete
-      else:
-        cw = mpt.ALH(0,0,self.channelnumber,6,0,0,n)
-
-    elif self.txstate==2: # STATE:2 - TRAFFIC CHANNEL QUIESCENT STATE
-      self.alhcount = 0
-      if not self.txtrafqueue.empty(): 
-        #cw = mpt.DCSC(self.syscode)
-        cw = TRAF()
-        self.txstate = 3
-
-    elif self.txstate==3: # STATE:3 - TRAFFIC CHANNEL CODEWORD STATE
-      self.txstate = 2
-      o = self.txtrafqueue.get_nowait()
-      cw = o.cw
-      self.txcomplete = o.txcomplete
-      self.txreserved = 0
-      if o.rxcomplete:
-        self.txreserved = o.rxcomplete.size
-        self.txreserveditem = o.rxcomplete
-
-    elif self.txstate==4: # STATE:4 - MORSE IDENT/ETC (TODO)
-      pass
-
-    # Encode codeword and return
-    if cw:
-      self.lastcw = cw
-      return cw.cw()
-    else:
-      return 0
+    channelId = "TSC-Ch.%d" % channelnumber
+    self.modem = MPT1327Modem(channelId, mode, Channel._rxcv, self)
 
-  def _rxcvimpl(self, cw):
+  @property
+  def morse(self):
+    return None
 
-    # If we're expecting a response in reserved slot(s)...
-    if self.rxcomplete:
-      self.logger.debug("RX[%d] RSVD: 0x%x", self.channelnumber, cw)
-      if self.rxcomplete.addcw(self, cw):
-        self.rxcomplete = None
-      return 0
+  @morse.setter
+  def morse(self, text):
+    """Send a morse ident between the next control channel frames"""
+    if text and self.modem.ident(text):
+      self.logger.warning("TX[%d] Morse ident dropped", self.channelnumber)
 
-    # Otherwise this is a random access which *must* be an address codeword
-    else:
-      o = mpt.RUtoTSCDecode(cw)
-      self.logger.debug("RX[%d]: 0x%x %s", self.channelnumber, cw, o)
-      if (o):
-        self.rxfunc(self.rxfuncdata, self, o)
+  def _rxcvimpl(self, cw, info):
+
+    # Replies in reserved slots went to their rxfunc, so this is a random
+    # access which *must* be an address codeword
+    o = mpt.RUtoTSCDecode(cw)
+    self.logger.debug("RX[%d]: 0x%x %s %s", self.channelnumber, cw, o, info)
+    if (o):
+      self.rxfunc(self.rxfuncdata, self, o)
 
-  def _morse_done(self):
-    self.txstate = 0
+  def _rxcv(self, cw, info):
+    try:
+      return self._rxcvimpl(cw, info)
+    except:
+      self.logger.exception("RX[%d] Exception", self.channelnumber)
 
-  def _txcv(self):
+  def _sent(ctx, expired):
+    self, cw, txfunc, txdata = ctx
+    if expired:
+      self.logger.warning("TX[%d] Deadline passed, %s dropped",
+                          self.channelnumber, cw)
     try:
-      return self._txcvimpl()
+      if expired and txfunc:
+        txfunc(txdata, self, expired=True)
+      elif txfunc:
+        txfunc(txdata, self)
     except:
       self.logger.exception("TX[%d] Exception", self.channelnumber)
 
-  def _rxcv(self, cw):
+  def _reply(ctx, timeout, cws):
+    self, rxfunc, rxdata = ctx
+    self.logger.debug("RX[%d] RSVD: %s%s", self.channelnumber,
+                      ["0x%x" % cw for cw in cws or []],
+                      " timeout" if timeout else "")
     try:
-      return self._rxcvimpl(cw)
+      rxfunc(rxdata, timeout, self, cws)
     except:
       self.logger.exception("RX[%d] Exception", self.channelnumber)
 
-  def _Tx(self, queue, cw, txfunc, txdata, rxlen, rxfunc, rxdata):
-
-    # TX completion object
-    txcompl = None
-    if txfunc:
-      txcompl = TXCompletionItem(txfunc, txdata)
+  def _Tx(self, queue, cw, txfunc, txdata, rxlen, rxfunc, rxdata, mode,
+          prio, deadline):
 
-    # Solicited reply - reserve rxlen frames after transmission
-    rxcompl = None
-    if rxlen>0:
-      rxcompl = RXCompletionItem(rxlen, rxfunc, rxdata)
-   
-    # Add to transmit queue
-    queue.put(TXItem(cw, txcompl, rxcompl))
+    # Solicited reply - reserve rxlen slots after transmission. Anything
+    # with a deadline is told if it's dropped, if only to log it.
+    self.logger.debug("TX[%d]: %s", self.channelnumber, cw)
+    if isinstance(cw, (list, tuple)):
+      cws = [c.cw() for c in cw]
+      if not 0 < len(cws) <= TX_CODEWORDS:
+        raise ValueError("Tx needs 1 to %d codewords" % TX_CODEWORDS)
+    else:
+      cws = cw.cw()
+    if deadline is None:
+      deadline = 0
+    else:
+      deadline = max(1, math.ceil(deadline / CW_TIME))
+    if self.modem.send(queue, cws, -1 if mode is None else mode, rxlen,
+                       Channel._sent if txfunc or deadline else None,
+                       (self, cw, txfunc, txdata),
+                       Channel._reply if rxfunc else None,
+                       (self, rxfunc, rxdata),
+                       prio, deadline):
+      self.logger.warning("TX[%d] Queue full, %s dropped",
+                          self.channelnumber, cw)
+      return -1
+    return 0
 
   def Start(self):
+    # An idle control channel sends these over and over (its frames the
+    # shortest there are): render them once
+    self.modem.prefill([mpt.CCSC(self.syscode).cw(),
+                        mpt.ALH(0,0,self.channelnumber,6,0,0,0).cw(),
+                        mpt.ALH(0,0,self.channelnumber,6,0,0,1).cw()])
+    self.modem.control(mpt.CCSC(self.syscode).cw(),
+                       mpt.ALH(0,0,self.channelnumber,6,0,0,0).cw(),
+                       mpt.AHY(0, mpt.DUMMYI, mpt.DUMMYI, 0, 0, 0, 0, 0).cw())
     self.modem.start()
 
-  def Tx(self, cw, txfunc=None, txdata=None, rxlen=0, rxfunc=None, rxdata=None):
-    self._Tx(self.txqueue, cw, txfunc, txdata, rxlen, rxfunc, rxdata)
+  def SetDemod(self, demod):
+    """Select the demodulator, one of libmpt1327modem.DEMOD_*"""
+    return self.modem.demod(demod)
+
+  def SetEq(self, mode):
+    """Set the receive equaliser mode, one of libmpt1327modem.EQ_*"""
+    return self.modem.eq(mode)
+
+  def EqState(self):
+    """Receive equaliser taps and training state, as a dict"""
+    return self.modem.eq_state()
+
+  def SetSplit(self, capture=None, playback=None):
+    """Put capture and/or playback on their own ALSA devices, e.g.
+    "plughw:CARD=Device", rather than JACK's. Before Start()."""
+    return self.modem.split(capture, playback)
+
+  def SplitStats(self):
+    """Clock tracking of the split sound devices, as a dict per side"""
+    return self.modem.split_stats()
+
+  def SetPipeline(self, lookahead):
+    """Run the modem off the JACK callback, lookahead samples of transmit
+    audio ahead (0 for off). Before Start()."""
+    return self.modem.pipeline(lookahead)
+
+  def PipelineStats(self):
+    """Pipeline delay (lookahead, samples), transmit underruns, and
+    received (overruns) and transmit (tx_overruns) audio dropped, as a
+    dict"""
+    return self.modem.pipeline_stats()
+
+  def SetBatch(self, enable):
+    """Demodulate on the batch demodulator shared with the other channels
+    using it, a sound period behind. Incoherent demodulation at 48kHz only.
+    Before Start()."""
+    return self.modem.batch(enable)
+
+  def QueueStats(self):
+    """Transmit queue depths, codewords dropped at their deadline and
+    waits (in codeword times), for each control channel class (a list
+    indexed by PRIO_*) and the traffic channel, as a dict"""
+    return self.modem.queue_stats()
+
+  def SetAloha(self, min=1, max=32, variants=True):
+    """Aloha frame lengths (slots) to pick from as the random access load
+    changes, the same for a fixed length, and whether ALHR and ALHX frames
+    may be used when more RUs contend than the longest frame suits"""
+    return self.modem.aloha(min, max, variants)
+
+  def AlohaStats(self):
+    """Random access slots, successes, collisions and empty slots, the
+    estimated RUs contending (backlog) and share of registrations, and the
+    frame in progress (N, length and ALH variant), as a dict"""
+    stats = self.modem.aloha_stats()
+    stats["variant"] = mpt.ALH_Base.alhstr[stats["func"]]
+    return stats
+
+  def Tx(self, cw, txfunc=None, txdata=None, rxlen=0, rxfunc=None,
+         rxdata=None, mode=None, prio=PRIO_HOUSEKEEPING, deadline=None):
+    """Queue a control channel codeword (or a list of them, sent as one)
+    in a class (PRIO_*). txfunc(txdata, ch) is called once it is sent,
+    rxfunc(rxdata, timeout, ch, cws) with the reply in the rxlen slots
+    after (with rxlen 0, just a timeout), and the channel changes to mode
+    (MODE_*) if given. If it isn't sent within deadline seconds it is
+    dropped: txfunc(txdata, ch, expired=True) and rxfunc's timeout say
+    so."""
+    return self._Tx(MODE_CONTROL, cw, txfunc, txdata, rxlen, rxfunc, rxdata,
+                    mode, prio, deadline)
   
   def TxTraf(self, cw, txfunc=None, txdata=None, rxlen=0, rxfunc=None, 
-             rxdata=None):
-    self._Tx(self.txtrafqueue, cw, txfunc, txdata, rxlen, rxfunc, rxdata)
+             rxdata=None, mode=None, deadline=None):
+    """Queue a traffic channel codeword, as Tx()"""
+    return self._Tx(MODE_TRAFFIC, cw, txfunc, txdata, rxlen, rxfunc, rxdata,
+                    mode, PRIO_HOUSEKEEPING, deadline)
 
 if __name__=="__main__":
 
@@ -263,7 +233,6 @@ if __name__=="__main__":
 
   def gtccompl(data, ch):
     print("GTC complete.")
-    return 2
 
   logging.basicConfig(filename="tsc-debug.log", 
                       filemode="w",
@@ -285,8 +254,8 @@ if __name__=="__main__":
       ch.Start()
 
     if a=="g":
-      ch.Tx(mpt.GTC(0, 3, 0, 1, mpt.PABXI, 0))
-      ch.Tx(mpt.GTC(0, 3, 0, 1, mpt.PABXI, 0), gtccompl)
+      ch.Tx([mpt.GTC(0, 3, 0, 1, mpt.PABXI, 0)] * 2, gtccompl,
+            mode=MODE_TRAFFIC)
 
     if a=="?":
       ch.Tx(mpt.AHY(0, 3, mpt.TSCI, 1, 0, 0, 0, 0), txcompl, None)
@@ -294,7 +263,9 @@ if __name__=="__main__":
     if a=="s":
       ch.Tx(mpt.AHYC(0, 3, mpt.TSCI, 1, 0), None, None, 1, sammis, None)
 
+    if a=="a":
+      print(ch.AlohaStats())
+
     if a=="c":
-      ch.TxTraf(mpt.CLEAR(1, 0, 0, 0))
-      ch.TxTraf(mpt.CLEAR(1, 0, 0, 0))
+      ch.TxTraf([mpt.CLEAR(1, 0, 0, 0)] * 2, mode=MODE_CONTROL)
 
@@ -0,0 +1,396 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "codec.h"
+#include "channel.h"
+
+#define PREAMBLE 0xAAAA
+
+// Fixed bits of category 000 messages, and of system broadcasts
+#define C000(typ, func) (G_GUINT64_CONSTANT(0x200001) << 26 | \
+                         (guint64)(typ) << 21 | (guint64)(func) << 18)
+#define BCAST(sysdef)   (C000(3, 4) | (guint64)(sysdef) << 42)
+
+// Category 001 (SAMIS etc.)
+#define C001 (G_GUINT64_CONSTANT(0x200001) << 26 | 1 << 23)
+
+#define F(name, shift, width, fmt) { name, shift, width, MPT1327_FMT_##fmt }
+
+#define PFIX_IDENT1 F("pfix", 40, 7, PFIX), F("ident1", 27, 13, IDENT)
+
+#define ALH_FIELDS 7, { PFIX_IDENT1, F("chan4", 14, 4, DEC), \
+  F("wt", 11, 3, DEC), F("rsvd", 9, 2, RSVD), F("m", 4, 5, DEC), \
+  F("n", 0, 4, ALOHA4) }
+
+#define ACK_FIELDS 5, { PFIX_IDENT1, F("ident2", 5, 13, IDENT), \
+  F("qual", 4, 1, DEC), F("n", 0, 4, DEC) }
+
+#define CONTROL_FIELDS 4, { F("sys", 27, 15, DEC), F("chan", 8, 10, DEC), \
+  F("spare", 6, 2, DEC), F("rsvd", 0, 6, DEC) }
+
+const MPT1327MsgDesc mpt1327_msg_desc[MPT1327_MSG_COUNT] = {
+
+  [MPT1327_MSG_CCSC] = { "CCSC", "Control channel system codeword", 0,
+    1, { F("syscode", 0, 16, HEX) } },
+  [MPT1327_MSG_DCSC] = { "DCSC", "Data channel system codeword", 0,
+    1, { F("syscode", 0, 16, HEX) } },
+
+  [MPT1327_MSG_GTC] = { "GTC", "Go to traffic channel message",
+    G_GUINT64_CONSTANT(1) << 47,
+    6, { PFIX_IDENT1, F("d", 25, 1, DEC), F("chan", 15, 10, DEC),
+         F("ident2", 2, 13, IDENT), F("n", 0, 2, ALOHA2) } },
+
+  [MPT1327_MSG_ALH] = { "ALH", "Aloha - Any single codeword message invited.",
+    C000(0, 0), ALH_FIELDS },
+  [MPT1327_MSG_ALHS] = { "ALHS", "Aloha - Messages invited, except RQD.",
+    C000(0, 1), ALH_FIELDS },
+  [MPT1327_MSG_ALHD] = { "ALHD", "Aloha - Messages invited, except RQS.",
+    C000(0, 2), ALH_FIELDS },
+  [MPT1327_MSG_ALHE] = { "ALHE",
+    "Aloha - Emergency requests (RQE) only invited.", C000(0, 3), ALH_FIELDS },
+  [MPT1327_MSG_ALHR] = { "ALHR",
+    "Aloha - Registration (RQR) or emergency requests (RQE) invited.",
+    C000(0, 4), ALH_FIELDS },
+  [MPT1327_MSG_ALHX] = { "ALHX", "Aloha - Messages invited, except RQR.",
+    C000(0, 5), ALH_FIELDS },
+  [MPT1327_MSG_ALHF] = { "ALHF", "Aloha - Fall back mode (system dependent)",
+    C000(0, 6), ALH_FIELDS },
+
+  [MPT1327_MSG_AHY] = { "AHY", "General availability check", C000(2, 0),
+    8, { PFIX_IDENT1, F("ident2", 5, 13, IDENT), F("d", 4, 1, DEC),
+         F("point", 3, 1, DEC), F("check", 2, 1, DEC), F("e", 1, 1, DEC),
+         F("ad", 0, 1, DEC) } },
+  [MPT1327_MSG_AHYX] = { "AHYX", "Cancel alert/Waiting state message",
+    C000(2, 2),
+    4, { PFIX_IDENT1, F("ident2", 5, 13, IDENT), F("point", 0, 5, DEC) } },
+  [MPT1327_MSG_AHYP] = { "AHYP", "Called unit presence monitoring",
+    C000(2, 5),
+    4, { PFIX_IDENT1, F("ident2", 5, 13, IDENT), F("rsvd", 0, 5, DEC) } },
+  [MPT1327_MSG_AHYQ] = { "AHYQ", "Status ahoy message", C000(2, 6),
+    4, { PFIX_IDENT1, F("ident2", 5, 13, IDENT), F("status", 0, 5, DEC) } },
+  [MPT1327_MSG_AHYC] = { "AHYC", "Short data invitation message", C000(2, 7),
+    5, { PFIX_IDENT1, F("ident2", 5, 13, IDENT), F("slots", 3, 2, DEC),
+         F("desc", 0, 3, DEC) } },
+
+  // 12 bits of bit reversals at the end
+  [MPT1327_MSG_CLEAR] = { "CLEAR", "Clear down traffic channel",
+    C000(3, 2) | 0xAAA,
+    4, { F("chan", 37, 10, DEC), F("cont", 27, 10, DEC),
+         F("rsvd", 14, 3, DEC), F("spare", 12, 2, DEC) } },
+
+  // spare lands on rsvd's low bit, as it does in the reference
+  [MPT1327_MSG_MOVE] = { "MOVE", "Move to control channel", C000(3, 3),
+    6, { PFIX_IDENT1, F("cont", 8, 10, DEC), F("m", 3, 5, DEC),
+         F("rsvd", 1, 2, DEC), F("spare", 1, 1, DEC) } },
+
+  [MPT1327_MSG_BCAST_ADDCONTROL] = { "BCAST_ADDCONTROL",
+    "Broadcast: add control channel", BCAST(0), CONTROL_FIELDS },
+  [MPT1327_MSG_BCAST_DELCONTROL] = { "BCAST_DELCONTROL",
+    "Broadcast: remove control channel", BCAST(0), CONTROL_FIELDS },
+  [MPT1327_MSG_BCAST_MAINT] = { "BCAST_MAINT",
+    "Broadcast: call maintenance parameters", BCAST(2),
+    7, { F("sys", 27, 15, DEC), F("per", 17, 1, DEC), F("ival", 12, 5, DEC),
+         F("pon", 11, 1, DEC), F("id", 10, 1, DEC), F("rsvd", 8, 2, DEC),
+         F("spare", 0, 8, DEC) } },
+  [MPT1327_MSG_BCAST_REG] = { "BCAST_REG",
+    "Broadcast: registration parameters", BCAST(3),
+    3, { F("sys", 27, 15, DEC), F("rsvd", 14, 4, DEC),
+         F("spare", 0, 14, DEC) } },
+
+  [MPT1327_MSG_ACK] = { "ACK", "General acknowledgement", C000(1, 0),
+    ACK_FIELDS },
+  [MPT1327_MSG_ACKI] = { "ACKI", "Intermediate acknowledgement", C000(1, 1),
+    ACK_FIELDS },
+  [MPT1327_MSG_ACKQ] = { "ACKQ", "Call queued", C000(1, 2), ACK_FIELDS },
+  [MPT1327_MSG_ACKX] = { "ACKX", "Message rejected", C000(1, 3), ACK_FIELDS },
+  [MPT1327_MSG_ACKV] = { "ACKV", "Called unit unavailable", C000(1, 4),
+    ACK_FIELDS },
+  [MPT1327_MSG_ACKE] = { "ACKE", "Acknowledge emergency call", C000(1, 5),
+    ACK_FIELDS },
+  [MPT1327_MSG_ACKT] = { "ACKT", "Try on different address", C000(1, 6),
+    ACK_FIELDS },
+  [MPT1327_MSG_ACKB] = { "ACKB",
+    "Acknowledge, call-back or negative acknowledgement", C000(1, 7),
+    ACK_FIELDS },
+
+  [MPT1327_MSG_MAINT] = { "MAINT", "Call maintenance message", C000(3, 1),
+    5, { PFIX_IDENT1, F("chan", 8, 10, DEC), F("oper", 5, 3, OPER),
+         F("rsvd", 0, 5, DEC) } },
+
+  [MPT1327_MSG_RQS] = { "RQS", "Request Simple call", C000(2, 0),
+    8, { PFIX_IDENT1, F("ident2", 5, 13, IDENT), F("dt", 4, 1, DEC),
+         F("level", 3, 1, DEC), F("ext", 2, 1, DEC), F("flag1", 1, 1, DEC),
+         F("flag2", 0, 1, DEC) } },
+  [MPT1327_MSG_RQX] = { "RQX", "Request call cancel / abort transaction",
+    C000(2, 2),
+    4, { PFIX_IDENT1, F("ident2", 5, 13, IDENT), F("rsvd", 0, 5, DEC) } },
+  [MPT1327_MSG_RQT] = { "RQT", "Request call diversion", C000(2, 3),
+    2, { PFIX_IDENT1 } },
+  [MPT1327_MSG_RQE] = { "RQE", "Request emergency call", C000(2, 4),
+    8, { PFIX_IDENT1, F("ident2", 5, 13, IDENT), F("d", 4, 1, DEC),
+         F("rsvd", 3, 1, DEC), F("ext", 2, 1, DEC), F("flag1", 1, 1, DEC),
+         F("flag2", 0, 1, DEC) } },
+  [MPT1327_MSG_RQR] = { "RQR", "Request to register", C000(2, 5),
+    4, { PFIX_IDENT1, F("info", 3, 15, DEC), F("rsvd", 0, 3, DEC) } },
+  [MPT1327_MSG_RQQ] = { "RQQ", "Request status transaction", C000(2, 6),
+    4, { PFIX_IDENT1, F("ident2", 5, 13, IDENT), F("status", 0, 5, DEC) } },
+  [MPT1327_MSG_RQC] = { "RQC", "Request to send short data message",
+    C000(2, 7),
+    7, { PFIX_IDENT1, F("ident2", 5, 13, IDENT), F("slots", 3, 2, DEC),
+         F("ext", 2, 1, DEC), F("flag1", 1, 1, DEC),
+         F("flag2", 0, 1, DEC) } },
+
+  // The last four are parts of the first three
+  [MPT1327_MSG_SAMIS] = { "SAMIS", "Inbound Solicited Single Address Message",
+    C001,
+    7, { F("desc", 18, 3, HIDDEN), F("parameters1", 27, 20, HIDDEN),
+         F("parameters2", 0, 18, HIDDEN), F("mfgcode", 39, 8, HIDDEN),
+         F("model", 35, 4, HIDDEN), F("chkbits", 27, 8, HIDDEN),
+         F("serial", 0, 18, HIDDEN) } },
+};
+
+// System codeword for a system code: the codeword whose FCS is the sync
+// word, found by choosing its check bits (appendix 3)
+static guint64 msg_syscode(guint64 syscode, guint64 ccs, int parity)
+{
+  guint64 f = mpt1327_channel_fcs(ccs | syscode << 1);
+
+  if ((f & 1) != parity)
+    f = 1 << 16 | mpt1327_channel_fcs(ccs | syscode << 1 | 1);
+  f = (f >> 1) ^ 1;
+
+  return syscode << 32 | f << 16 | PREAMBLE;
+}
+
+guint64
+mpt1327_msg_encode
+(
+  const MPT1327Msg* msg
+)
+{
+  const MPT1327MsgDesc* d = &mpt1327_msg_desc[msg->type];
+  guint64 cw = d->fixed;
+  int n;
+
+  switch (msg->type) {
+  case MPT1327_MSG_CCSC:
+    return msg_syscode(msg->v[0], G_GUINT64_CONSTANT(0xAAAAC4D40000), 1);
+  case MPT1327_MSG_DCSC:
+    return msg_syscode(msg->v[0], G_GUINT64_CONSTANT(0xAAAA3B2A0000), 0);
+  }
+
+  for (n=0; n<d->nfields; n++)
+    cw |= (guint64)(msg->v[n] & ((1 << d->field[n].width) - 1)) <<
+          d->field[n].shift;
+
+  return cw;
+}
+
+void
+mpt1327_msg_fields
+(
+  MPT1327Msg* msg,
+  MPT1327MsgType type,
+  guint64 cw
+)
+{
+  const MPT1327MsgDesc* d = &mpt1327_msg_desc[type];
+  int n;
+
+  msg->type = type;
+  for (n=0; n<d->nfields; n++)
+    msg->v[n] = (cw >> d->field[n].shift) & ((1 << d->field[n].width) - 1);
+}
+
+MPT1327MsgType
+mpt1327_msg_decode
+(
+  MPT1327Msg* msg,
+  guint64 cw
+)
+{
+  MPT1327MsgType type = MPT1327_MSG_NONE;
+  int func = (cw >> 18) & 0x7;
+
+  msg->type = MPT1327_MSG_NONE;
+
+  // Address codewords, and not GTC (s2.0)
+  if (!(cw >> 47 & 1) || !(cw >> 26 & 1))
+    return MPT1327_MSG_NONE;
+
+  switch ((cw >> 23) & 0x7) { // Category
+
+  case 0:
+    switch ((cw >> 21) & 0x3) { // Type
+    case 1:
+      type = MPT1327_MSG_ACK + func;
+      break;
+    case 2:
+      switch (func) {
+      case 0: type = MPT1327_MSG_RQS; break;
+      case 2: type = MPT1327_MSG_RQX; break;
+      case 3: type = MPT1327_MSG_RQT; break;
+      case 4: type = MPT1327_MSG_RQE; break;
+      case 5: type = MPT1327_MSG_RQR; break;
+      case 6: type = MPT1327_MSG_RQQ; break;
+      case 7: type = MPT1327_MSG_RQC; break;
+      }
+      break;
+    case 3:
+      if (func == 1)
+        type = MPT1327_MSG_MAINT;
+      break;
+    }
+    break;
+
+  case 1:
+    if (func == 0) // Descriptor (TODO: This is a little more nuanced)
+      type = MPT1327_MSG_SAMIS;
+    break;
+
+  }
+
+  if (type != MPT1327_MSG_NONE)
+    mpt1327_msg_fields(msg, type, cw);
+  return type;
+}
+
+void
+mpt1327_msg_encode_many
+(
+  const MPT1327Msg* msg,
+  guint64* cw,
+  int count
+)
+{
+  int n;
+
+  for (n=0; n<count; n++)
+    cw[n] = mpt1327_msg_encode(&msg[n]);
+}
+
+void
+mpt1327_msg_decode_many
+(
+  const guint64* cw,
+  MPT1327Msg* msg,
+  int count
+)
+{
+  int n;
+
+  for (n=0; n<count; n++)
+    mpt1327_msg_decode(&msg[n], cw[n]);
+}
+
+static const char* msg_ident(guint32 i)
+{
+  switch (i) {
+  case 8191: return "ALLI";
+  case 8190: return "TSCI";
+  case 8189: return "IPFIXI";
+  case 8188: return "SDMI";
+  case 8187: return "DIVERTI";
+  case 8186: return "INCI";
+  case 8185: return "REGI";
+  case 8103: return "DNI";
+  case 8102: return "PABXI";
+  case 8101: return "PSTNGI";
+  case 0:    return "DUMMYI";
+  }
+  return NULL;
+}
+
+// Aloha number tables (s7.3.3)
+static const int alhtolength2bit[4] = { 0, 1, 3, 6 };
+static const int alhtolength4bit[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                         12, 15, 19, 25, 32 };
+
+static const char* operstr[8] = { "Presel On", "Presel Off", "Periodic",
+                                  "Disconnect", "Spare", "Reserved",
+                                  "Clear down", "Disable TX" };
+
+int
+mpt1327_msg_str
+(
+  const MPT1327Msg* msg,
+  char* buf,
+  int len
+)
+{
+  const MPT1327MsgDesc* d = &mpt1327_msg_desc[msg->type];
+  const MPT1327Field* f;
+  const guint32* v = msg->v;
+  const char* sep = "";
+  int n, k = 0;
+
+  // Keeps count past the end of buf
+  #define OUT(...) \
+    k += snprintf(buf + MIN(k, len), len - MIN(k, len), __VA_ARGS__)
+
+  if (msg->type == MPT1327_MSG_SAMIS) {
+    OUT("SAMIS[esn=%03d/%02d/%06d chkbits=0x%x]", v[3], v[4], v[6], v[5]);
+    return k;
+  }
+
+  OUT("%s[", d->name);
+  for (n=0; n<d->nfields; n++) {
+    f = &d->field[n];
+    switch (f->fmt) {
+    case MPT1327_FMT_DEC:
+      OUT("%s%s=%d", sep, f->name, v[n]);
+      break;
+    case MPT1327_FMT_HEX:
+      OUT("%s%s=0x%x", sep, f->name, v[n]);
+      break;
+    case MPT1327_FMT_PFIX:
+      OUT("%s%s=0x%02x", sep, f->name, v[n]);
+      break;
+    case MPT1327_FMT_RSVD:
+      OUT("%s%s=%04x", sep, f->name, v[n]);
+      break;
+    case MPT1327_FMT_IDENT:
+      if (msg_ident(v[n]))
+        OUT("%s%s=%04d(%s)", sep, f->name, v[n], msg_ident(v[n]));
+      else
+        OUT("%s%s=%04d", sep, f->name, v[n]);
+      break;
+    case MPT1327_FMT_ALOHA2:
+      OUT("%s%s=%d(=%d)", sep, f->name, v[n], alhtolength2bit[v[n] & 0x3]);
+      break;
+    case MPT1327_FMT_ALOHA4:
+      OUT("%s%s=%d(=%d)", sep, f->name, v[n], alhtolength4bit[v[n] & 0xF]);
+      break;
+    case MPT1327_FMT_OPER:
+      OUT("%s%s=%d (%s)", sep, f->name, v[n], operstr[v[n] & 0x7]);
+      break;
+    default:
+      continue;
+    }
+    sep = " ";
+  }
+  OUT("]");
+
+  #undef OUT
+
+  return k;
+}
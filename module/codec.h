@@ -0,0 +1,173 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <glib.h>
+
+// MPT1327 codeword messages, encoded and decoded as mpt1327.py does (the
+// reference implementation). Codewords are the 48 bits before the FCS.
+
+#define MPT1327_MSG_FIELDS 8
+
+// Message types. The names are those of the mpt1327.py classes.
+typedef enum
+{
+  MPT1327_MSG_NONE = -1,
+
+  // TSC to RU
+  MPT1327_MSG_CCSC = 0,
+  MPT1327_MSG_DCSC,
+  MPT1327_MSG_GTC,
+  MPT1327_MSG_ALH,      // ALH..ALHF in function code order
+  MPT1327_MSG_ALHS,
+  MPT1327_MSG_ALHD,
+  MPT1327_MSG_ALHE,
+  MPT1327_MSG_ALHR,
+  MPT1327_MSG_ALHX,
+  MPT1327_MSG_ALHF,
+  MPT1327_MSG_AHY,
+  MPT1327_MSG_AHYX,
+  MPT1327_MSG_AHYP,
+  MPT1327_MSG_AHYQ,
+  MPT1327_MSG_AHYC,
+  MPT1327_MSG_CLEAR,
+  MPT1327_MSG_MOVE,
+  MPT1327_MSG_BCAST_ADDCONTROL,
+  MPT1327_MSG_BCAST_DELCONTROL,
+  MPT1327_MSG_BCAST_MAINT,
+  MPT1327_MSG_BCAST_REG,
+
+  // Either way
+  MPT1327_MSG_ACK,      // ACK..ACKB in function code order
+  MPT1327_MSG_ACKI,
+  MPT1327_MSG_ACKQ,
+  MPT1327_MSG_ACKX,
+  MPT1327_MSG_ACKV,
+  MPT1327_MSG_ACKE,
+  MPT1327_MSG_ACKT,
+  MPT1327_MSG_ACKB,
+  MPT1327_MSG_MAINT,
+
+  // RU to TSC
+  MPT1327_MSG_RQS,
+  MPT1327_MSG_RQX,
+  MPT1327_MSG_RQT,
+  MPT1327_MSG_RQE,
+  MPT1327_MSG_RQR,
+  MPT1327_MSG_RQQ,
+  MPT1327_MSG_RQC,
+  MPT1327_MSG_SAMIS,
+
+  MPT1327_MSG_COUNT
+} MPT1327MsgType;
+
+// How a field is shown by mpt1327_msg_str
+typedef enum
+{
+  MPT1327_FMT_DEC = 0,
+  MPT1327_FMT_HEX,      // 0x%x
+  MPT1327_FMT_PFIX,     // 0x%02x
+  MPT1327_FMT_RSVD,     // %04x
+  MPT1327_FMT_IDENT,    // With the name of a special ident
+  MPT1327_FMT_ALOHA2,   // Aloha number, with the length it stands for...
+  MPT1327_FMT_ALOHA4,   // ...from the 2 or 4 bit table (s7.3.3)
+  MPT1327_FMT_OPER,     // MAINT operation, with its name
+  MPT1327_FMT_HIDDEN
+} MPT1327FieldFmt;
+
+typedef struct MPT1327Field_s
+{
+  const char* name;
+  guint8 shift;
+  guint8 width;
+  guint8 fmt;
+} MPT1327Field;
+
+typedef struct MPT1327MsgDesc_s
+{
+  const char* name;
+  const char* doc;
+  guint64 fixed;   // Bits every codeword of the type has
+  int nfields;
+  MPT1327Field field[MPT1327_MSG_FIELDS];
+} MPT1327MsgDesc;
+
+extern const MPT1327MsgDesc mpt1327_msg_desc[MPT1327_MSG_COUNT];
+
+// A message: its field values in the order the descriptor has them (and
+// the reference constructor takes them)
+typedef struct MPT1327Msg_s
+{
+  int type;
+  guint32 v[MPT1327_MSG_FIELDS];
+} MPT1327Msg;
+
+guint64
+mpt1327_msg_encode
+(
+  const MPT1327Msg* msg
+);
+
+// Fields of a codeword taken as the given type, whatever it really is
+void
+mpt1327_msg_fields
+(
+  MPT1327Msg* msg,
+  MPT1327MsgType type,
+  guint64 cw
+);
+
+// Decodes a codeword sent by an RU to the TSC. Returns its type, and
+// MPT1327_MSG_NONE for one that isn't an RU to TSC message.
+MPT1327MsgType
+mpt1327_msg_decode
+(
+  MPT1327Msg* msg,
+  guint64 cw
+);
+
+void
+mpt1327_msg_encode_many
+(
+  const MPT1327Msg* msg,
+  guint64* cw,
+  int count
+);
+
+void
+mpt1327_msg_decode_many
+(
+  const guint64* cw,
+  MPT1327Msg* msg,
+  int count
+);
+
+// As the reference __str__, e.g. "GTC[pfix=0x00 ident1=0003 ...]".
+// Returns the length it needed, like snprintf.
+int
+mpt1327_msg_str
+(
+  const MPT1327Msg* msg,
+  char* buf,
+  int len
+);
+
+#endif /* CODEC_H */
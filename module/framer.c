@@ -0,0 +1,156 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <string.h>
+
+#include "channel.h"
+#include "framer.h"
+
+#define FCS_POLY 0x6815
+
+// Syndrome (codeword FCS xor received FCS) to 1 + position of the single
+// bit error that causes it, 0 where no single bit error does.
+static guint8 syndrome_bit[1<<16];
+
+// CRC register contribution of a data bit followed by n more bits. Entry 48
+// is the contribution of the bit leaving the 48 bit data window.
+static guint16 crc_bit[49];
+
+static inline guint16 crc_step(guint16 crc, int b)
+{
+  if ((b ^ (crc >> 15)) & 1)
+    crc ^= FCS_POLY;
+  return crc << 1;
+}
+
+static gpointer framer_tables(gpointer data)
+{
+  guint16 crc = crc_step(0, 1);
+  guint64 e;
+  int n;
+
+  for (n=0; n<49; n++) {
+    crc_bit[n] = crc;
+    crc = crc_step(crc, 0);
+  }
+
+  // The FCS is affine so an error's syndrome doesn't depend on the data
+  for (n=0; n<64; n++) {
+    e = 1ULL << n;
+    syndrome_bit[mpt1327_channel_fcs(e>>16) ^ mpt1327_channel_fcs(0) ^
+                 (e & 0xFFFF)] = n+1;
+  }
+
+  return NULL;
+}
+
+void
+mpt1327_framer_reset
+(
+  MPT1327Framer* fr
+)
+{
+  static GOnce once = G_ONCE_INIT;
+  g_once(&once, framer_tables, NULL);
+
+  memset(fr, 0, sizeof(*fr));
+}
+
+int
+mpt1327_framer_bit
+(
+  MPT1327Framer* fr,
+  guint32 bit,
+  int tolerance,
+  int correct,
+  guint64* cw,
+  MPT1327RxInfo* info
+)
+{
+  int in = fr->sr >> 15 & 1;
+  int out = fr->sr >> 63;
+  guint16 fcs, syndrome;
+  int sync, end, errors, n, ok = 0;
+
+  // Bit 15 moves into the data part and bit 63 leaves it: roll the CRC
+  // register and parity on by one bit and take the old bit's part out
+  fr->crc = crc_step(fr->crc, in) ^ (out ? crc_bit[48] : 0);
+  fr->parity ^= in ^ out;
+  fr->sr = fr->sr << 1 | (bit & 1);
+
+  fcs = (fr->crc ^ 0x0002) & 0xFFFE;
+  fcs |= fr->parity ^ __builtin_parity(fcs);
+  syndrome = fcs ^ (fr->sr & 0xFFFF);
+
+  // Sync word that ended 64 bits ago, if any
+  sync = fr->sync_hist[fr->bits & 63];
+  end = fr->frame_count && --fr->frame_count == 0;
+
+  if (sync || end) {
+
+    // A codeword is due to end here. Only here is correction tried:
+    // anywhere else it would mostly "correct" noise into codewords.
+    info->corrected = 0;
+    if (syndrome && correct && syndrome_bit[syndrome]) {
+      n = syndrome_bit[syndrome]-1;
+      fr->sr ^= 1ULL << n;
+      if (n >= 16) {
+        fr->crc ^= crc_bit[n-16];
+        fr->parity ^= 1;
+      }
+      syndrome = 0;
+      info->corrected = 1;
+    }
+
+    if (!syndrome) {
+      // New frame from the sync word, or the next codeword of this one
+      if (sync) {
+        fr->frame_type = sync & 3;
+        fr->frame_errors = sync >> 2;
+        fr->frame_offset = 64;
+      }
+      else
+        fr->frame_offset += 64;
+
+      // Another codeword may follow straight on
+      fr->frame_count = 64;
+
+      *cw = fr->sr >> 16;
+      info->sync = fr->frame_type;
+      info->sync_errors = fr->frame_errors;
+      info->offset = fr->frame_offset;
+      ok = 1;
+    }
+  }
+
+  // Correlate the last 16 bits against the sync words. SYNT is the
+  // complement of SYNC so one count gives both distances.
+  errors = __builtin_popcount((fr->sr ^ MPT1327_SYNC) & 0xFFFF);
+  if (errors <= tolerance)
+    sync = MPT1327_SYNC_CONTROL | errors << 2;
+  else if (16-errors <= tolerance)
+    sync = MPT1327_SYNC_TRAFFIC | (16-errors) << 2;
+  else
+    sync = 0;
+  fr->sync_hist[fr->bits & 63] = sync;
+  fr->bits++;
+
+  return ok;
+}
@@ -0,0 +1,94 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAMER_H
+#define FRAMER_H
+
+#include <glib.h>
+#include <mskmodem.h>
+
+#define MPT1327_SYNC 0xC4D7     // 1100010011010111
+#define MPT1327_SYNT 0x3B28     // 0011101100101000
+
+// Default and largest sync word bit error tolerance. The 16 bit windows
+// straddling preamble and sync word are at least 4 bits from either.
+#define MPT1327_SYNC_TOLERANCE     1
+#define MPT1327_SYNC_TOLERANCE_MAX 3
+
+// Sync word a codeword followed
+typedef enum
+{
+  MPT1327_SYNC_NONE = 0,
+  MPT1327_SYNC_CONTROL, // SYNC: control channel
+  MPT1327_SYNC_TRAFFIC, // SYNT: traffic channel
+} MPT1327SyncType;
+
+// Details of a received codeword
+typedef struct MPT1327RxInfo_s
+{
+  int path;      // Demodulator path (timing phase for multiphase demodulator)
+  int corrected; // A single bit error was corrected
+  MPT1327SyncType sync; // Sync word that started the frame
+  int sync_errors;      // Bit errors in that sync word
+  int offset;    // Bits from the end of the sync word to the codeword end
+  MSKModemRxQuality quality; // Signal quality over the codeword's 64 bits
+} MPT1327RxInfo;
+
+// Streaming codeword framer for one bit stream.
+//
+// The FCS syndrome of the last 64 bits is kept up to date in O(1) per bit
+// (a rolling CRC over the 48 data bits), and codewords are only looked for
+// where a frame says one ends: 64 bits after a sync word, then every 64
+// bits for as long as codewords keep checking. Anywhere else the framer is
+// hunting for a sync word and nothing is passed up.
+typedef struct MPT1327Framer_s
+{
+  guint64 sr;       // Last 64 bits received
+  guint16 crc;      // CRC register over the data part (top 48 bits) of sr
+  int parity;       // Parity of the data part of sr
+  guint8 sync_hist[64]; // Sync words ending on each of the last 64 bits:
+                        // type | bit errors << 2, 0 for none
+  guint32 bits;     // Bit count, indexes sync_hist
+  int frame_count;  // Bits to a codeword end after a codeword, 0 if none
+  MPT1327SyncType frame_type;  // Sync word of the frame in progress...
+  int frame_errors;            // ...its bit errors
+  int frame_offset;            // ...bits since it ended
+} MPT1327Framer;
+
+void
+mpt1327_framer_reset
+(
+  MPT1327Framer* fr
+);
+
+// Adds a bit. Returns 1 when a codeword ends on this bit, with it (FCS
+// stripped) in *cw and the sync, offset and correction fields of *info
+// filled in. With correct set a single bit error is corrected there.
+int
+mpt1327_framer_bit
+(
+  MPT1327Framer* fr,
+  guint32 bit,
+  int tolerance,
+  int correct,
+  guint64* cw,
+  MPT1327RxInfo* info
+);
+
+#endif /* FRAMER_H */
@@ -23,14 +23,17 @@
 #include <glib.h>
 #include <Python.h>
 
+#include <structmember.h>
+
 #include "channel.h"
+#include "codec.h"
 
 typedef struct {
   PyObject_HEAD
   MPT1327Channel* channel;
   PyObject* p_recvfn;
-  PyObject* p_txcvfn;
   PyObject* p_userdata;
+  PyObject* p_carrierfn;
 } MPT1327PyModemObject;
 
 typedef struct {
@@ -40,42 +43,134 @@ typedef struct {
 
 static
 void
-mpt1327Modem_recv_callback(MPT1327PyModemObject* self, guint64 cw)
+mpt1327Modem_recv_callback(MPT1327PyModemObject* self, guint64 cw,
+                           const MPT1327RxInfo* info)
+{
+  PyGILState_STATE gstate = PyGILState_Ensure();
+  PyObject* ret;
+
+  ret = PyObject_CallFunction(self->p_recvfn,
+        "OL{s:i,s:i,s:i,s:i,s:i,s:f,s:f,s:f,s:i,s:f}",
+        self->p_userdata, cw,
+        "path", info->path, "corrected", info->corrected,
+        "sync", info->sync, "sync_errors", info->sync_errors,
+        "offset", info->offset,
+        "snr", info->quality.snr, "eye", info->quality.eye,
+        "timing", info->quality.timing,
+        "corrections", info->quality.corrections,
+        "imbalance", info->quality.imbalance);
+  Py_XDECREF(ret);
+  PyGILState_Release(gstate);
+}
+
+static
+void
+mpt1327Modem_carrier_callback(MPT1327PyModemObject* self, int on,
+                              guint64 sample)
 {
   PyGILState_STATE gstate = PyGILState_Ensure();
-  PyObject_CallFunction(self->p_recvfn, "OL", self->p_userdata, cw);
+  if (self->p_carrierfn)
+    Py_XDECREF(PyObject_CallFunction(self->p_carrierfn, "OiK",
+                                     self->p_userdata, on, sample));
   PyGILState_Release(gstate);
 }
 
 static
-guint64
-mpt1327Modem_txcv_callback(MPT1327PyModemObject* self)
+void
+mpt1327Modem_compl_callback(MPT1327PyCompletionContext* ctx)
 {
-  guint64 cw = 1;
+  PyGILState_STATE gstate;
   PyObject* ret;
 
-  PyGILState_STATE gstate = PyGILState_Ensure();
-  ret = PyObject_CallFunction(self->p_txcvfn, "O", self->p_userdata);
-  if (ret)
-    cw = PyLong_AsLongLong(ret);
+  gstate = PyGILState_Ensure();
+  ret = PyObject_CallFunction(ctx->fcomp, "O", ctx->fcompdata);
+  if (!ret)
+    PyErr_Print();
+  Py_XDECREF(ret);
+  Py_DECREF(ctx->fcomp);
+  Py_DECREF(ctx->fcompdata);
   PyGILState_Release(gstate);
+  g_free(ctx);
+}
 
-  return cw;
+// A codeword sent, or dropped at its deadline
+static
+void
+mpt1327Modem_sent_callback(MPT1327PyCompletionContext* ctx, int expired)
+{
+  PyGILState_STATE gstate;
+  PyObject* ret;
+
+  gstate = PyGILState_Ensure();
+  ret = PyObject_CallFunction(ctx->fcomp, "Oi", ctx->fcompdata, expired);
+  if (!ret)
+    PyErr_Print();
+  Py_XDECREF(ret);
+  Py_DECREF(ctx->fcomp);
+  Py_DECREF(ctx->fcompdata);
+  PyGILState_Release(gstate);
+  g_free(ctx);
 }
 
+// Reply to a codeword sent, or its timeout (with None)
 static
 void
-mpt1327Modem_compl_callback(MPT1327PyCompletionContext* ctx)
+mpt1327Modem_reply_callback(MPT1327PyCompletionContext* ctx, int timeout,
+                            const guint64* cw, int count)
 {
   PyGILState_STATE gstate;
+  PyObject* cws = Py_None;
+  PyObject* ret;
+  int n;
+
   gstate = PyGILState_Ensure();
-  PyObject_CallFunction(ctx->fcomp, "O", ctx->fcompdata);
+  if (!timeout) {
+    cws = PyList_New(count);
+    for (n=0; n<count; n++)
+      PyList_SET_ITEM(cws, n, PyLong_FromUnsignedLongLong(cw[n]));
+  }
+  else
+    Py_INCREF(cws);
+  ret = PyObject_CallFunction(ctx->fcomp, "OiO", ctx->fcompdata,
+                              timeout, cws);
+  if (!ret)
+    PyErr_Print();
+  Py_XDECREF(ret);
+  Py_DECREF(cws);
   Py_DECREF(ctx->fcomp);
   Py_DECREF(ctx->fcompdata);
   PyGILState_Release(gstate);
   g_free(ctx);
 }
 
+// Context for a Python callback, or NULL for None
+static
+MPT1327PyCompletionContext*
+mpt1327Modem_compl_new(PyObject* fcomp, PyObject* fcompdata)
+{
+  MPT1327PyCompletionContext* ctx;
+
+  if (fcomp == Py_None)
+    return NULL;
+  ctx = g_new(MPT1327PyCompletionContext, 1);
+  ctx->fcomp = fcomp;
+  ctx->fcompdata = fcompdata;
+  Py_INCREF(ctx->fcomp);
+  Py_INCREF(ctx->fcompdata);
+  return ctx;
+}
+
+static
+void
+mpt1327Modem_compl_free(MPT1327PyCompletionContext* ctx)
+{
+  if (ctx) {
+    Py_DECREF(ctx->fcomp);
+    Py_DECREF(ctx->fcompdata);
+    g_free(ctx);
+  }
+}
+
 static 
 PyObject*
 mpt1327Modem_start(MPT1327PyModemObject* self, PyObject* args)
@@ -107,7 +202,9 @@ mpt1327Modem_tone(MPT1327PyModemObject* self, PyObject* args)
     return NULL;
   }
 
-  return Py_BuildValue("i", 0);
+  return Py_BuildValue("i", mpt1327_channel_queue_tone(self->channel,
+                                                       freq, duration,
+                                                       NULL, NULL));
 }
 
 static 
@@ -133,11 +230,18 @@ mpt1327Modem_morse(MPT1327PyModemObject* self, PyObject* args)
   Py_INCREF(compl_ctx->fcomp);
   Py_INCREF(compl_ctx->fcompdata);
 
-  mpt1327_channel_queue_morse(self->channel, 
-                              morse, 
-                              (mpt1327_channel_completion_fn)
-                                mpt1327Modem_compl_callback, 
-                              compl_ctx);
+  // Not queued: the callback won't come, so drop its context now
+  if (mpt1327_channel_queue_morse(self->channel, 
+                                  morse, 
+                                  (mpt1327_channel_completion_fn)
+                                    mpt1327Modem_compl_callback, 
+                                  compl_ctx)) {
+    Py_DECREF(compl_ctx->fcomp);
+    Py_DECREF(compl_ctx->fcompdata);
+    g_free(compl_ctx);
+    return Py_BuildValue("i", -1);
+  }
+
   return Py_BuildValue("i", 0);
 }
 
@@ -156,27 +260,476 @@ mpt1327Modem_bridge(MPT1327PyModemObject* self, PyObject* args)
   return Py_BuildValue("i", 0);
 }
 
+static 
+PyObject*
+mpt1327Modem_demod(MPT1327PyModemObject* self, PyObject* args)
+{
+  int demod;
+
+  if (!PyArg_ParseTuple(args, "i", 
+                        &demod)) {
+    return NULL;
+  }
+
+  return Py_BuildValue("i", mpt1327_channel_set_demod(self->channel, demod));
+}
+
+static 
+PyObject*
+mpt1327Modem_modulator(MPT1327PyModemObject* self, PyObject* args)
+{
+  int mode, shape;
+  float level = 1.0f;
+
+  if (!PyArg_ParseTuple(args, "ii|f", 
+                        &mode, &shape, &level)) {
+    return NULL;
+  }
+
+  return Py_BuildValue("i", mpt1327_channel_set_modulator(self->channel,
+                                                         mode, shape, level));
+}
+
+static 
+PyObject*
+mpt1327Modem_correction(MPT1327PyModemObject* self, PyObject* args)
+{
+  int enable;
+
+  if (!PyArg_ParseTuple(args, "i", 
+                        &enable)) {
+    return NULL;
+  }
+
+  mpt1327_channel_set_correction(self->channel, enable);
+  return Py_BuildValue("i", 0);
+}
+
+static 
+PyObject*
+mpt1327Modem_sync_tolerance(MPT1327PyModemObject* self, PyObject* args)
+{
+  int errors;
+
+  if (!PyArg_ParseTuple(args, "i", 
+                        &errors)) {
+    return NULL;
+  }
+
+  return Py_BuildValue("i",
+                       mpt1327_channel_set_sync_tolerance(self->channel, errors));
+}
+
+static 
+PyObject*
+mpt1327Modem_carrier(MPT1327PyModemObject* self, PyObject* args)
+{
+  int mode;
+  PyObject* fn = Py_None;
+
+  if (!PyArg_ParseTuple(args, "i|O", 
+                        &mode, &fn)) {
+    return NULL;
+  }
+
+  Py_CLEAR(self->p_carrierfn);
+  if (fn != Py_None) {
+    Py_INCREF(fn);
+    self->p_carrierfn = fn;
+  }
+
+  return Py_BuildValue("i", mpt1327_channel_set_carrier(self->channel, mode,
+      (mpt1327_channel_carrier_fn)mpt1327Modem_carrier_callback));
+}
+
+static 
+PyObject*
+mpt1327Modem_eq(MPT1327PyModemObject* self, PyObject* args)
+{
+  int mode;
+
+  if (!PyArg_ParseTuple(args, "i", 
+                        &mode)) {
+    return NULL;
+  }
+
+  return Py_BuildValue("i", mpt1327_channel_set_eq(self->channel, mode));
+}
+
+static 
+PyObject*
+mpt1327Modem_eq_state(MPT1327PyModemObject* self, PyObject* args)
+{
+  MSKModemEqState eq;
+  PyObject* taps;
+  PyObject* ret;
+  int n;
+
+  mpt1327_channel_eq_state(self->channel, &eq);
+
+  taps = PyTuple_New(MSKMODEM_EQ_TAPS);
+  if (!taps)
+    return NULL;
+  for (n=0; n<MSKMODEM_EQ_TAPS; n++)
+    PyTuple_SET_ITEM(taps, n, PyFloat_FromDouble(eq.taps[n]));
+
+  ret = Py_BuildValue("{s:i,s:O,s:f,s:f,s:i,s:I,s:f}",
+                      "mode", eq.mode,
+                      "taps", taps,
+                      "gain1200", eq.gain1200,
+                      "gain1800", eq.gain1800,
+                      "training", eq.training,
+                      "trainings", eq.trainings,
+                      "dispersion", eq.dispersion);
+  Py_DECREF(taps);
+  return ret;
+}
+
+static 
+PyObject*
+mpt1327Modem_split(MPT1327PyModemObject* self, PyObject* args)
+{
+  const char* capture;
+  const char* playback;
+
+  if (!PyArg_ParseTuple(args, "zz", 
+                        &capture,
+                        &playback)) {
+    return NULL;
+  }
+
+  return Py_BuildValue("i", mpt1327_channel_set_split(self->channel,
+                                                      capture, playback));
+}
+
+static PyObject* split_stats_dict(const MSKModemSoundSplitStats* s)
+{
+  return Py_BuildValue("{s:i,s:i,s:f,s:f,s:i,s:i,s:I,s:I}",
+                       "active", s->active,
+                       "rate", s->rate,
+                       "ppm", s->ppm,
+                       "fill", s->fill,
+                       "target", s->target,
+                       "latency", s->latency,
+                       "slips", s->slips,
+                       "xruns", s->xruns);
+}
+
+static 
+PyObject*
+mpt1327Modem_split_stats(MPT1327PyModemObject* self, PyObject* args)
+{
+  MSKModemSoundSplitStats capture, playback;
+
+  mpt1327_channel_split_stats(self->channel, &capture, &playback);
+  return Py_BuildValue("{s:N,s:N}",
+                       "capture", split_stats_dict(&capture),
+                       "playback", split_stats_dict(&playback));
+}
+
+static 
+PyObject*
+mpt1327Modem_pipeline(MPT1327PyModemObject* self, PyObject* args)
+{
+  int lookahead;
+
+  if (!PyArg_ParseTuple(args, "i", 
+                        &lookahead)) {
+    return NULL;
+  }
+
+  return Py_BuildValue("i", mpt1327_channel_set_pipeline(self->channel,
+                                                         lookahead));
+}
+
+static 
+PyObject*
+mpt1327Modem_pipeline_stats(MPT1327PyModemObject* self, PyObject* args)
+{
+  MSKModemSoundPipelineStats s;
+
+  mpt1327_channel_pipeline_stats(self->channel, &s);
+  return Py_BuildValue("{s:i,s:i,s:i,s:I,s:I,s:I}",
+                       "lookahead", s.lookahead,
+                       "period", s.period,
+                       "backlog", s.backlog,
+                       "underruns", s.underruns,
+                       "overruns", s.overruns,
+                       "tx_overruns", s.tx_overruns);
+}
+
+static 
+PyObject*
+mpt1327Modem_batch(MPT1327PyModemObject* self, PyObject* args)
+{
+  int enable;
+
+  if (!PyArg_ParseTuple(args, "i", 
+                        &enable)) {
+    return NULL;
+  }
+
+  return Py_BuildValue("i", mpt1327_channel_set_batch(self->channel,
+                                                      enable));
+}
+
+// Codewords from a Python sequence, g_free()d by the caller. NULL with
+// an exception set if it isn't one of integers.
+static
+guint64*
+mpt1327Modem_codewords(PyObject* obj, const char* err, Py_ssize_t* count)
+{
+  PyObject* seq;
+  guint64* cw;
+  Py_ssize_t n;
+
+  seq = PySequence_Fast(obj, err);
+  if (!seq)
+    return NULL;
+  *count = PySequence_Fast_GET_SIZE(seq);
+  cw = g_new(guint64, MAX(*count, 1)); // Not NULL when empty
+  for (n=0; n<*count; n++)
+    cw[n] = PyLong_AsUnsignedLongLongMask(PySequence_Fast_GET_ITEM(seq, n));
+  Py_DECREF(seq);
+  if (PyErr_Occurred()) {
+    g_free(cw);
+    return NULL;
+  }
+
+  return cw;
+}
+
+static 
+PyObject*
+mpt1327Modem_prefill(MPT1327PyModemObject* self, PyObject* args)
+{
+  PyObject* obj;
+  guint64* cw;
+  Py_ssize_t count;
+  int ret;
+
+  if (!PyArg_ParseTuple(args, "O", &obj))
+    return NULL;
+
+  cw = mpt1327Modem_codewords(obj, "prefill() needs a sequence of codewords",
+                              &count);
+  if (!cw)
+    return NULL;
+
+  ret = mpt1327_channel_prefill(self->channel, cw, count);
+  g_free(cw);
+
+  return Py_BuildValue("i", ret);
+}
+
+static 
+PyObject*
+mpt1327Modem_send(MPT1327PyModemObject* self, PyObject* args)
+{
+  MPT1327TxItem item = { 0 };
+  MPT1327PyCompletionContext* sent;
+  MPT1327PyCompletionContext* reply;
+  PyObject *obj, *fsent, *fsentdata, *freply, *freplydata;
+  guint64* cw;
+  Py_ssize_t count;
+  int mode;
+
+  item.prio = MPT1327_PRIO_HOUSEKEEPING;
+  if (!PyArg_ParseTuple(args, "iOiiOOOO|ii",
+                        &mode,
+                        &obj,
+                        &item.mode,
+                        &item.reply,
+                        &fsent, &fsentdata,
+                        &freply, &freplydata,
+                        &item.prio,
+                        &item.deadline)) {
+    return NULL;
+  }
+
+  // A codeword, or a sequence of them sent as one
+  if (PyLong_Check(obj)) {
+    item.cw[0] = PyLong_AsUnsignedLongLongMask(obj);
+    item.count = 1;
+  }
+  else {
+    cw = mpt1327Modem_codewords(obj, "send() needs a codeword or a "
+                                "sequence of them", &count);
+    if (!cw)
+      return NULL;
+    if (count < 1 || count > MPT1327_TX_CODEWORDS) {
+      g_free(cw);
+      PyErr_Format(PyExc_ValueError, "send() needs 1 to %d codewords",
+                   MPT1327_TX_CODEWORDS);
+      return NULL;
+    }
+    memcpy(item.cw, cw, count * sizeof(*cw));
+    item.count = count;
+    g_free(cw);
+  }
+  if (PyErr_Occurred())
+    return NULL;
+
+  sent = mpt1327Modem_compl_new(fsent, fsentdata);
+  if (sent) {
+    item.fsent = (mpt1327_channel_sent_fn)mpt1327Modem_sent_callback;
+    item.sentdata = sent;
+  }
+  reply = mpt1327Modem_compl_new(freply, freplydata);
+  if (reply) {
+    item.freply = (mpt1327_channel_reply_fn)mpt1327Modem_reply_callback;
+    item.replydata = reply;
+  }
+
+  // Not queued: the callbacks won't come, so drop their contexts now
+  if (mpt1327_channel_send(self->channel, mode, &item)) {
+    mpt1327Modem_compl_free(sent);
+    mpt1327Modem_compl_free(reply);
+    return Py_BuildValue("i", -1);
+  }
+
+  return Py_BuildValue("i", 0);
+}
+
+static 
+PyObject*
+mpt1327Modem_control(MPT1327PyModemObject* self, PyObject* args)
+{
+  guint64 ccsc, alh, dummy;
+
+  if (!PyArg_ParseTuple(args, "KKK", &ccsc, &alh, &dummy))
+    return NULL;
+
+  return Py_BuildValue("i", mpt1327_channel_set_control(self->channel,
+                                                         ccsc, alh, dummy));
+}
+
+static 
+PyObject*
+mpt1327Modem_ident(MPT1327PyModemObject* self, PyObject* args)
+{
+  const char* str;
+
+  if (!PyArg_ParseTuple(args, "s", &str))
+    return NULL;
+
+  return Py_BuildValue("i", mpt1327_channel_ident(self->channel, str));
+}
+
+static 
+PyObject*
+mpt1327Modem_stats(MPT1327PyModemObject* self, PyObject* args)
+{
+  MPT1327RxStats rx;
+  MPT1327TxStats tx;
+
+  mpt1327_channel_rx_stats(self->channel, &rx);
+  mpt1327_channel_tx_stats(self->channel, &tx);
+  return Py_BuildValue("{s:I,s:I,s:I,s:I,s:I,s:I,s:I,s:I,s:I}",
+                       "codewords", rx.codewords,
+                       "corrected", rx.corrected,
+                       "carriers", rx.carriers,
+                       "overflows", rx.overflows,
+                       "batch_overruns", rx.batch_overruns,
+                       "tx_cache_hits", tx.cache_hits,
+                       "tx_cache_misses", tx.cache_misses,
+                       "tx_tone_overflows", tx.tone_overflows,
+                       "tx_queue_overflows", tx.queue_overflows);
+}
+
+static PyObject* queue_stats_dict(const MPT1327QueueStats* s)
+{
+  return Py_BuildValue("{s:I,s:I,s:I,s:d,s:I}",
+                       "depth", s->depth,
+                       "sent", s->sent,
+                       "expired", s->expired,
+                       "wait_mean", s->sent ?
+                         (double)s->wait_total / s->sent : 0.0,
+                       "wait_max", s->wait_max);
+}
+
+// Control channel queues by class (a list indexed by PRIO_*) and the
+// traffic channel's. Waits are in codeword times.
+static 
+PyObject*
+mpt1327Modem_queue_stats(MPT1327PyModemObject* self, PyObject* args)
+{
+  MPT1327QueueStats s[MPT1327_TX_QUEUES];
+  PyObject* control;
+  int n;
+
+  mpt1327_channel_queue_stats(self->channel, s);
+  control = PyList_New(MPT1327_PRIO_COUNT);
+  for (n=0; control && n<MPT1327_PRIO_COUNT; n++)
+    PyList_SET_ITEM(control, n, queue_stats_dict(&s[n]));
+  return Py_BuildValue("{s:N,s:N}",
+                       "control", control,
+                       "traffic", queue_stats_dict(&s[MPT1327_TX_TRAFFIC]));
+}
+
+static 
+PyObject*
+mpt1327Modem_aloha(MPT1327PyModemObject* self, PyObject* args)
+{
+  int min, max, variants = 1;
+
+  if (!PyArg_ParseTuple(args, "ii|p", &min, &max, &variants))
+    return NULL;
+
+  return Py_BuildValue("i", mpt1327_channel_set_aloha(self->channel, min, max,
+                                                       variants));
+}
+
+static 
+PyObject*
+mpt1327Modem_aloha_stats(MPT1327PyModemObject* self, PyObject* args)
+{
+  MPT1327AlohaStats s;
+
+  mpt1327_channel_aloha_stats(self->channel, &s);
+  return Py_BuildValue("{s:I,s:I,s:I,s:I,s:I,s:I,s:d,s:d,s:O,"
+                       "s:i,s:i,s:i,s:i,s:i,s:O}",
+                       "frames", s.frames,
+                       "slots", s.slots,
+                       "success", s.success,
+                       "collision", s.collision,
+                       "empty", s.empty,
+                       "registrations", s.registrations,
+                       "backlog", (double)s.backlog,
+                       "reg_share", (double)s.reg_share,
+                       "overload", s.overload ? Py_True : Py_False,
+                       "n", s.n,
+                       "length", s.length,
+                       "func", s.func,
+                       "min", s.min,
+                       "max", s.max,
+                       "variants", s.variants ? Py_True : Py_False);
+}
+
 static int
 mpt1327Modem_traverse(MPT1327PyModemObject *self, visitproc visit, void *arg)
 {
   Py_VISIT(self->p_recvfn);
-  Py_VISIT(self->p_txcvfn);
   Py_VISIT(self->p_userdata);
+  Py_VISIT(self->p_carrierfn);
   return 0;
 }
 
 static int mpt1327Modem_clear(MPT1327PyModemObject* self)
 {
   Py_CLEAR(self->p_recvfn);
-  Py_CLEAR(self->p_txcvfn);
   Py_CLEAR(self->p_userdata);
+  Py_CLEAR(self->p_carrierfn);
   return 0;
 }
 
 static void mpt1327Modem_dealloc(MPT1327PyModemObject* self)
 {
+  // Completions still due are called while freeing, and need the GIL
+  Py_BEGIN_ALLOW_THREADS
   mpt1327_channel_stop(self->channel);
   mpt1327_channel_free(&self->channel);
+  Py_END_ALLOW_THREADS
 
 
   mpt1327Modem_clear(self);
@@ -188,23 +741,22 @@ static int mpt1327Modem_init(MPT1327PyModemObject* self,
 {
 
   char* channelId;
+  int mode;
 
-  if (!PyArg_ParseTuple(args, "sOOO", 
+  if (!PyArg_ParseTuple(args, "siOO", 
                         &channelId,
+                        &mode,
                         &self->p_recvfn,
-                        &self->p_txcvfn,
                         &self->p_userdata))
   {
     return 1;
   }
 
   Py_INCREF(self->p_recvfn);
-  Py_INCREF(self->p_txcvfn);
   Py_INCREF(self->p_userdata);
 
-  return mpt1327_channel_init(&self->channel, channelId,
+  return mpt1327_channel_init(&self->channel, channelId, mode,
       (mpt1327_channel_recv_fn)mpt1327Modem_recv_callback,
-      (mpt1327_channel_txcv_fn)mpt1327Modem_txcv_callback,
                               self);
 }
 
@@ -219,6 +771,55 @@ static PyMethodDef mpt1327ModemMethods[] = {
     METH_VARARGS, "Morse code broadcast"},
   {"bridge", (PyCFunction)mpt1327Modem_bridge,
     METH_VARARGS, "Bridge rx -> tx"},
+  {"demod", (PyCFunction)mpt1327Modem_demod,
+    METH_VARARGS, "Selects the demodulator (DEMOD_*)"},
+  {"modulator", (PyCFunction)mpt1327Modem_modulator,
+    METH_VARARGS, "Sets modulator mode (TX_*), shaping (SHAPE_*) and level"},
+  {"correction", (PyCFunction)mpt1327Modem_correction,
+    METH_VARARGS, "Enables single bit error correction"},
+  {"sync_tolerance", (PyCFunction)mpt1327Modem_sync_tolerance,
+    METH_VARARGS, "Sets the sync word bit errors accepted"},
+  {"carrier", (PyCFunction)mpt1327Modem_carrier,
+    METH_VARARGS, "Sets carrier detection (CARRIER_*) and its callback"},
+  {"eq", (PyCFunction)mpt1327Modem_eq,
+    METH_VARARGS, "Sets the receive equaliser mode (EQ_*)"},
+  {"eq_state", (PyCFunction)mpt1327Modem_eq_state,
+    METH_NOARGS, "Returns the receive equaliser's taps and training state"},
+  {"split", (PyCFunction)mpt1327Modem_split,
+    METH_VARARGS, "Puts capture and playback on their own ALSA devices "
+    "(when stopped)"},
+  {"split_stats", (PyCFunction)mpt1327Modem_split_stats,
+    METH_NOARGS, "Returns the split sound devices' clock tracking figures"},
+  {"pipeline", (PyCFunction)mpt1327Modem_pipeline,
+    METH_VARARGS, "Runs the modem on a worker thread, this many samples of "
+    "transmit audio ahead (0 for off, when stopped)"},
+  {"pipeline_stats", (PyCFunction)mpt1327Modem_pipeline_stats,
+    METH_NOARGS, "Returns the pipeline's delay and under/overrun counts"},
+  {"batch", (PyCFunction)mpt1327Modem_batch,
+    METH_VARARGS, "Demodulates on the batch demodulator shared with other "
+    "channels (when stopped)"},
+  {"prefill", (PyCFunction)mpt1327Modem_prefill,
+    METH_VARARGS, "Renders repeatedly sent codewords ahead (when stopped)"},
+  {"send", (PyCFunction)mpt1327Modem_send,
+    METH_VARARGS, "Queues a codeword to send in a mode (MODE_*), with the "
+    "mode to change to after, reply slots, sent and reply callbacks, and "
+    "its class (PRIO_*) and deadline (codeword times)"},
+  {"control", (PyCFunction)mpt1327Modem_control,
+    METH_VARARGS, "Sets an idle control channel's CCSC, ALH and dummy AHY "
+    "(when stopped)"},
+  {"ident", (PyCFunction)mpt1327Modem_ident,
+    METH_VARARGS, "Sends a morse ident between control channel frames"},
+  {"stats", (PyCFunction)mpt1327Modem_stats,
+    METH_NOARGS, "Receive and transmit counters"},
+  {"queue_stats", (PyCFunction)mpt1327Modem_queue_stats,
+    METH_NOARGS, "Transmit queue depths, waits and codewords dropped at "
+    "their deadline, by class"},
+  {"aloha", (PyCFunction)mpt1327Modem_aloha,
+    METH_VARARGS, "Sets the Aloha frame lengths to pick from as the random "
+    "access load changes, and whether ALHR/ALHX frames may be used"},
+  {"aloha_stats", (PyCFunction)mpt1327Modem_aloha_stats,
+    METH_NOARGS, "Random access counters and the load estimate the Aloha "
+    "frames are chosen from"},
   {NULL}
 };
 
@@ -246,6 +847,309 @@ static PyTypeObject mpt1327ModemType = {
     "MPT1327 Modem",           /* tp_doc */
 };
   
+// Codewords from a buffer of 64 bit integers (e.g. array('Q')), or failing
+// that any sequence of ints, into a new array
+static guint64* cw_array(PyObject* obj, Py_ssize_t* count, const char* fn)
+{
+  PyObject* seq;
+  Py_buffer view;
+  guint64* cw;
+  Py_ssize_t n;
+
+  if (PyObject_CheckBuffer(obj)) {
+    if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+      return NULL;
+    if (view.itemsize != sizeof(guint64) || !view.format ||
+        !strchr("QqLl", view.format[view.format[0]=='@' ? 1 : 0])) {
+      PyBuffer_Release(&view);
+      PyErr_SetString(PyExc_TypeError, "buffer must hold 64 bit integers");
+      return NULL;
+    }
+    *count = view.len / sizeof(guint64);
+    cw = g_new(guint64, *count);
+    memcpy(cw, view.buf, *count*sizeof(guint64));
+    PyBuffer_Release(&view);
+    return cw;
+  }
+
+  seq = PySequence_Fast(obj, fn);
+  if (!seq)
+    return NULL;
+  *count = PySequence_Fast_GET_SIZE(seq);
+  cw = g_new(guint64, *count);
+  for (n=0; n<*count; n++)
+    cw[n] = PyLong_AsUnsignedLongLongMask(PySequence_Fast_GET_ITEM(seq, n));
+  Py_DECREF(seq);
+  if (PyErr_Occurred()) {
+    g_free(cw);
+    return NULL;
+  }
+
+  return cw;
+}
+
+// Codeword messages (GTC, ALH...), a type each, as the classes of the same
+// names in mpt1327.py: constructed from their field values in order, which
+// are then attributes, with cw() encoding them
+typedef struct {
+  PyObject_HEAD
+  MPT1327Msg msg;
+} MPT1327PyMsgObject;
+
+static PyTypeObject mpt1327MsgTypes[MPT1327_MSG_COUNT];
+static PyMemberDef mpt1327MsgMembers[MPT1327_MSG_COUNT][MPT1327_MSG_FIELDS+1];
+
+static PyObject* msg_new_from(const MPT1327Msg* msg)
+{
+  MPT1327PyMsgObject* o;
+
+  o = PyObject_New(MPT1327PyMsgObject, &mpt1327MsgTypes[msg->type]);
+  if (o)
+    o->msg = *msg;
+  return (PyObject*)o;
+}
+
+// Message type of a Python object: -1 if it isn't a native message
+static int msg_type(PyObject* o)
+{
+  PyTypeObject* t = Py_TYPE(o);
+
+  if (t >= mpt1327MsgTypes && t < mpt1327MsgTypes + MPT1327_MSG_COUNT)
+    return t - mpt1327MsgTypes;
+  return -1;
+}
+
+static
+PyObject*
+mpt1327Msg_new(PyTypeObject* type, PyObject* args, PyObject* kwds)
+{
+  MPT1327PyMsgObject* self;
+  const MPT1327MsgDesc* d = &mpt1327_msg_desc[type - mpt1327MsgTypes];
+  Py_ssize_t n;
+
+  if (kwds && PyDict_Size(kwds)) {
+    PyErr_Format(PyExc_TypeError, "%s() takes no keyword arguments",
+                 d->name);
+    return NULL;
+  }
+  if (PyTuple_GET_SIZE(args) != d->nfields) {
+    PyErr_Format(PyExc_TypeError, "%s() takes %d arguments (%zd given)",
+                 d->name, d->nfields, PyTuple_GET_SIZE(args));
+    return NULL;
+  }
+
+  self = (MPT1327PyMsgObject*)type->tp_alloc(type, 0);
+  if (!self)
+    return NULL;
+  self->msg.type = type - mpt1327MsgTypes;
+  for (n=0; n<d->nfields; n++)
+    self->msg.v[n] = PyLong_AsUnsignedLongMask(PyTuple_GET_ITEM(args, n));
+  if (PyErr_Occurred()) {
+    Py_DECREF(self);
+    return NULL;
+  }
+
+  return (PyObject*)self;
+}
+
+static
+PyObject*
+mpt1327Msg_str(MPT1327PyMsgObject* self)
+{
+  char buf[256];
+
+  mpt1327_msg_str(&self->msg, buf, sizeof(buf));
+  return PyUnicode_FromString(buf);
+}
+
+static
+PyObject*
+mpt1327Msg_cw(MPT1327PyMsgObject* self, PyObject* unused)
+{
+  return PyLong_FromUnsignedLongLong(mpt1327_msg_encode(&self->msg));
+}
+
+// The fields of a codeword as this type, as the reference decode()
+static
+PyObject*
+mpt1327Msg_decode(PyTypeObject* type, PyObject* arg)
+{
+  MPT1327Msg msg;
+  guint64 cw = PyLong_AsUnsignedLongLongMask(arg);
+
+  if (PyErr_Occurred())
+    return NULL;
+
+  mpt1327_msg_fields(&msg, type - mpt1327MsgTypes, cw);
+  return msg_new_from(&msg);
+}
+
+static PyMethodDef mpt1327MsgMethods[] = {
+  {"cw", (PyCFunction)mpt1327Msg_cw,
+    METH_NOARGS, "Encodes the codeword (without its FCS)"},
+  {"decode", (PyCFunction)mpt1327Msg_decode,
+    METH_O | METH_CLASS, "Decodes a codeword as this message"},
+  {NULL}
+};
+
+static int mpt1327Msg_type_init(MPT1327MsgType type)
+{
+  const MPT1327MsgDesc* d = &mpt1327_msg_desc[type];
+  PyTypeObject* t = &mpt1327MsgTypes[type];
+  PyMemberDef* m = mpt1327MsgMembers[type];
+  int n;
+
+  for (n=0; n<d->nfields; n++) {
+    m[n].name = (char*)d->field[n].name;
+    m[n].type = T_UINT;
+    m[n].offset = offsetof(MPT1327PyMsgObject, msg.v) + n*sizeof(guint32);
+  }
+
+  *t = (PyTypeObject){ PyVarObject_HEAD_INIT(NULL, 0) };
+  t->tp_name = g_strdup_printf("libmpt1327.%s", d->name);
+  t->tp_basicsize = sizeof(MPT1327PyMsgObject);
+  t->tp_flags = Py_TPFLAGS_DEFAULT;
+  t->tp_doc = d->doc;
+  t->tp_new = mpt1327Msg_new;
+  t->tp_str = (reprfunc)mpt1327Msg_str;
+  t->tp_repr = (reprfunc)mpt1327Msg_str;
+  t->tp_methods = mpt1327MsgMethods;
+  t->tp_members = m;
+
+  return PyType_Ready(t);
+}
+
+// Decodes a codeword sent by an RU to the TSC, as RUtoTSCDecode: a message
+// or None
+static
+PyObject*
+m_decode(PyObject* self, PyObject* arg)
+{
+  MPT1327Msg msg;
+  guint64 cw = PyLong_AsUnsignedLongLongMask(arg);
+
+  if (PyErr_Occurred())
+    return NULL;
+
+  if (mpt1327_msg_decode(&msg, cw) == MPT1327_MSG_NONE)
+    Py_RETURN_NONE;
+  return msg_new_from(&msg);
+}
+
+// Decodes every codeword in a buffer or sequence. Returns a list.
+static
+PyObject*
+m_decode_many(PyObject* self, PyObject* args)
+{
+  PyObject* obj;
+  PyObject* ret;
+  PyObject* o;
+  MPT1327Msg* msg;
+  guint64* cw;
+  Py_ssize_t n, count;
+
+  if (!PyArg_ParseTuple(args, "O", &obj))
+    return NULL;
+
+  cw = cw_array(obj, &count, "decode_many() needs a buffer or sequence");
+  if (!cw)
+    return NULL;
+
+  msg = g_new(MPT1327Msg, count);
+  mpt1327_msg_decode_many(cw, msg, count);
+  g_free(cw);
+
+  ret = PyList_New(count);
+  for (n=0; ret && n<count; n++) {
+    if (msg[n].type == MPT1327_MSG_NONE) {
+      Py_INCREF(Py_None);
+      o = Py_None;
+    }
+    else if (!(o = msg_new_from(&msg[n]))) {
+      Py_CLEAR(ret);
+      break;
+    }
+    PyList_SET_ITEM(ret, n, o);
+  }
+
+  g_free(msg);
+  return ret;
+}
+
+// Encodes a sequence of messages (anything with a cw() method will do) to a
+// list, or into a writable buffer of 64 bit integers, returning the count
+static
+PyObject*
+m_encode_many(PyObject* self, PyObject* args)
+{
+  PyObject* obj;
+  PyObject* out = NULL;
+  PyObject* seq;
+  PyObject* o;
+  PyObject* ret = NULL;
+  Py_buffer view;
+  MPT1327Msg* msg;
+  guint64* cw;
+  Py_ssize_t n, count;
+
+  if (!PyArg_ParseTuple(args, "O|O", &obj, &out))
+    return NULL;
+
+  seq = PySequence_Fast(obj, "encode_many() needs a sequence");
+  if (!seq)
+    return NULL;
+  count = PySequence_Fast_GET_SIZE(seq);
+
+  // Natives encoded all together, others one at a time
+  msg = g_new(MPT1327Msg, count);
+  cw = g_new0(guint64, count);
+  for (n=0; n<count; n++) {
+    o = PySequence_Fast_GET_ITEM(seq, n);
+    if (msg_type(o) >= 0) {
+      msg[n] = ((MPT1327PyMsgObject*)o)->msg;
+      continue;
+    }
+    msg[n].type = MPT1327_MSG_NONE;
+    o = PyObject_CallMethod(o, "cw", NULL);
+    if (!o)
+      goto done;
+    cw[n] = PyLong_AsUnsignedLongLongMask(o);
+    Py_DECREF(o);
+    if (PyErr_Occurred())
+      goto done;
+  }
+  for (n=0; n<count; n++)
+    if (msg[n].type != MPT1327_MSG_NONE)
+      cw[n] = mpt1327_msg_encode(&msg[n]);
+
+  if (!out || out == Py_None) {
+    ret = PyList_New(count);
+    for (n=0; ret && n<count; n++)
+      PyList_SET_ITEM(ret, n, PyLong_FromUnsignedLongLong(cw[n]));
+    goto done;
+  }
+
+  if (PyObject_GetBuffer(out, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT |
+                                     PyBUF_WRITABLE) < 0)
+    goto done;
+  if (view.itemsize != sizeof(guint64) || !view.format ||
+      !strchr("QqLl", view.format[view.format[0]=='@' ? 1 : 0]))
+    PyErr_SetString(PyExc_TypeError, "buffer must hold 64 bit integers");
+  else if (view.len / (Py_ssize_t)sizeof(guint64) < count)
+    PyErr_SetString(PyExc_ValueError, "buffer is too small");
+  else {
+    memcpy(view.buf, cw, count*sizeof(guint64));
+    ret = PyLong_FromSsize_t(count);
+  }
+  PyBuffer_Release(&view);
+
+done:
+  Py_DECREF(seq);
+  g_free(msg);
+  g_free(cw);
+  return ret;
+}
+
 static 
 PyObject*
 m_fcs(PyObject* self, PyObject* args)
@@ -258,8 +1162,46 @@ m_fcs(PyObject* self, PyObject* args)
   return Py_BuildValue("i", fcs);
 }
 
+// FCS of every codeword in a buffer or sequence. Returns a list.
+static 
+PyObject*
+m_fcs_many(PyObject* self, PyObject* args)
+{
+  PyObject* obj;
+  PyObject* ret = NULL;
+  guint64* cw;
+  guint16* fcs;
+  Py_ssize_t n, count;
+
+  if (!PyArg_ParseTuple(args, "O", &obj))
+    return NULL;
+
+  cw = cw_array(obj, &count, "fcs_many() needs a buffer or sequence");
+  if (!cw)
+    return NULL;
+
+  fcs = g_new(guint16, count);
+  mpt1327_channel_fcs_many(cw, fcs, count);
+
+  ret = PyList_New(count);
+  for (n=0; ret && n<count; n++)
+    PyList_SET_ITEM(ret, n, PyLong_FromLong(fcs[n]));
+
+  g_free(cw);
+  g_free(fcs);
+  return ret;
+}
+
 static PyMethodDef MPT1327Methods[] = {
   {"fcs",   m_fcs, METH_VARARGS, "Calculate MPT1327 frame check sequence"},
+  {"fcs_many", m_fcs_many, METH_VARARGS,
+    "Calculate MPT1327 frame check sequences of many codewords"},
+  {"decode", m_decode, METH_O,
+    "Decodes a codeword from an RU to the TSC (None if it isn't one)"},
+  {"decode_many", m_decode_many, METH_VARARGS,
+    "Decodes many codewords from RUs to the TSC"},
+  {"encode_many", m_encode_many, METH_VARARGS,
+    "Encodes many messages, to a list or a buffer"},
   {NULL}
 };
 
@@ -276,6 +1218,7 @@ PyMODINIT_FUNC
 PyInit_libmpt1327modem(void)
 {
   PyObject* m;
+  int n;
 
   PyEval_InitThreads();
 
@@ -289,12 +1232,48 @@ PyInit_libmpt1327modem(void)
   if  (PyType_Ready(&mpt1327ModemType) < 0)
     return NULL;
 
+  for (n=0; n<MPT1327_MSG_COUNT; n++)
+    if (mpt1327Msg_type_init(n) < 0)
+      return NULL;
+
   m = PyModule_Create(&MPT1327Module);
   if (!m)
     return NULL;
 
   Py_INCREF(&mpt1327ModemType);
   PyModule_AddObject(m, "MPT1327Modem", (PyObject*)&mpt1327ModemType);
+
+  for (n=0; n<MPT1327_MSG_COUNT; n++) {
+    Py_INCREF(&mpt1327MsgTypes[n]);
+    PyModule_AddObject(m, mpt1327_msg_desc[n].name,
+                       (PyObject*)&mpt1327MsgTypes[n]);
+  }
+
+  PyModule_AddIntConstant(m, "DEMOD_INCOHERENT", MSKMODEM_DEMOD_INCOHERENT);
+  PyModule_AddIntConstant(m, "DEMOD_DECIMATING", MSKMODEM_DEMOD_DECIMATING);
+  PyModule_AddIntConstant(m, "DEMOD_COHERENT", MSKMODEM_DEMOD_COHERENT);
+  PyModule_AddIntConstant(m, "DEMOD_DIVERSITY", MSKMODEM_DEMOD_DIVERSITY);
+  PyModule_AddIntConstant(m, "DEMOD_MULTIPHASE", MSKMODEM_DEMOD_MULTIPHASE);
+  PyModule_AddIntConstant(m, "CARRIER_OFF", MSKMODEM_CARRIER_OFF);
+  PyModule_AddIntConstant(m, "CARRIER_DETECT", MSKMODEM_CARRIER_DETECT);
+  PyModule_AddIntConstant(m, "CARRIER_GATE", MSKMODEM_CARRIER_GATE);
+  PyModule_AddIntConstant(m, "EQ_OFF", MSKMODEM_EQ_OFF);
+  PyModule_AddIntConstant(m, "EQ_BURST", MSKMODEM_EQ_BURST);
+  PyModule_AddIntConstant(m, "EQ_CONTINUOUS", MSKMODEM_EQ_CONTINUOUS);
+  PyModule_AddIntConstant(m, "TX_TABLE", MSKMODEM_TX_TABLE);
+  PyModule_AddIntConstant(m, "TX_NCO", MSKMODEM_TX_NCO);
+  PyModule_AddIntConstant(m, "SHAPE_NONE", MSKMODEM_SHAPE_NONE);
+  PyModule_AddIntConstant(m, "SHAPE_COSINE", MSKMODEM_SHAPE_COSINE);
+  PyModule_AddIntConstant(m, "SYNC_NONE", MPT1327_SYNC_NONE);
+  PyModule_AddIntConstant(m, "SYNC_CONTROL", MPT1327_SYNC_CONTROL);
+  PyModule_AddIntConstant(m, "SYNC_TRAFFIC", MPT1327_SYNC_TRAFFIC);
+  PyModule_AddIntConstant(m, "MODE_CONTROL", MPT1327_MODE_CONTROL);
+  PyModule_AddIntConstant(m, "MODE_TRAFFIC", MPT1327_MODE_TRAFFIC);
+  PyModule_AddIntConstant(m, "PRIO_EMERGENCY", MPT1327_PRIO_EMERGENCY);
+  PyModule_AddIntConstant(m, "PRIO_CALL", MPT1327_PRIO_CALL);
+  PyModule_AddIntConstant(m, "PRIO_ACK", MPT1327_PRIO_ACK);
+  PyModule_AddIntConstant(m, "PRIO_HOUSEKEEPING", MPT1327_PRIO_HOUSEKEEPING);
+  PyModule_AddIntConstant(m, "TX_CODEWORDS", MPT1327_TX_CODEWORDS);
   return m;
 
 }
@@ -69,14 +69,20 @@ def mpt1327_fcs_py(cw):
 
   return ck | parity;
 
+def mpt1327_fcs_many_py(cws):
+  """Calculates MPT1327 Frame Check Sequences of a sequence of codewords"""
+  return [mpt1327_fcs_py(cw) for cw in cws]
+
 # Use the C implementation of fcs if available because it's much faster
 try:
   from libmpt1327modem import fcs as mpt1327_fcs
+  from libmpt1327modem import fcs_many as mpt1327_fcs_many
 except ImportError:
   import warnings
   warnings.warn("Using slower implementation of fcs... native unavailable.",
                 ImportWarning)
   mpt1327_fcs = mpt1327_fcs_py
+  mpt1327_fcs_many = mpt1327_fcs_many_py
 
 def identstr(i):
   idents = {
@@ -286,7 +292,7 @@ class ACK_Base:
 
   def __str__(self):
     return "%s[pfix=0x%02x ident1=%s ident2=%s qual=%d n=%d]" %\
-      (ACK.ackstr[self.func], self.pfix, identstr(self.ident1), \
+      (self.ackstr[self.func], self.pfix, identstr(self.ident1), \
        identstr(self.ident2), self.qual, self.n)
 
 class ACK(ACK_Base):
@@ -427,9 +433,9 @@ class MAINT:
   def __init__(self, *v):
     self.pfix, self.ident1, self.chan, self.oper, self.rsvd = v
 
-  @staticmethod
-  def decode(cw):
-    o = MAINT(
+  @classmethod
+  def decode(cls, cw):
+    o = cls(
       (cw>>40) & 0x7F,
       (cw>>27) & 0x1FFF,
       (cw>>8) & 0x3FF,
@@ -460,7 +466,7 @@ class MAINT:
   def __str__(self):
     return "MAINT[pfix=0x%02x ident1=%s chan=%d oper=%d (%s) rsvd=%d]" %\
       (self.pfix, identstr(self.ident1), self.chan, self.oper, \
-       MAINT.operstr[self.oper], self.rsvd)
+       self.operstr[self.oper], self.rsvd)
 
 class CLEAR:
   """Clear down traffic channel"""
@@ -562,9 +568,9 @@ class RQS:
     self.pfix, self.ident1, self.ident2, self.dt, self.level, self.ext, \
       self.flag1, self.flag2 = v
 
-  @staticmethod
-  def decode(cw):
-    o = RQS(
+  @classmethod
+  def decode(cls, cw):
+    o = cls(
       (cw>>40) & 0x7F,
       (cw>>27) & 0x1FFF,
       (cw>>5) & 0x1FFF,
@@ -587,9 +593,9 @@ class RQX:
   def __init__(self, *v):
     self.pfix, self.ident1, self.ident2, self.rsvd = v
 
-  @staticmethod
-  def decode(cw):
-    o = RQX(
+  @classmethod
+  def decode(cls, cw):
+    o = cls(
       (cw>>40) & 0x7F,
       (cw>>27) & 0x1FFF,
       (cw>>5) & 0x1FFF,
@@ -606,9 +612,9 @@ class RQT:
   def __init__(self, *v):
     self.pfix, self.ident1 = v
 
-  @staticmethod
-  def decode(cw):
-    o = RQT(
+  @classmethod
+  def decode(cls, cw):
+    o = cls(
       (cw>>40) & 0x7F,
       (cw>>27) & 0x1FFF)
     return o
@@ -620,9 +626,9 @@ class RQE:
     self.pfix, self.ident1, self.ident2, self.d, self.rsvd, self.ext, \
       self.flag1, self.flag2 = v
 
-  @staticmethod
-  def decode(cw):
-    o = RQE(
+  @classmethod
+  def decode(cls, cw):
+    o = cls(
       (cw>>40) & 0x7F,
       (cw>>27) & 0x1FFF,
       (cw>>5) & 0x1FFF,
@@ -644,9 +650,9 @@ class RQR:
   def __init__(self, *v):
     self.pfix, self.ident1, self.info, self.rsvd = v
 
-  @staticmethod
-  def decode(cw):
-    o = RQR(
+  @classmethod
+  def decode(cls, cw):
+    o = cls(
       (cw>>40) & 0x7F,
       (cw>>27) & 0x1FFF,
       (cw>>3) & 0x7FFF,
@@ -663,9 +669,9 @@ class RQQ:
   def __init__(self, *v):
     self.pfix, self.ident1, self.ident2, self.status = v
 
-  @staticmethod
-  def decode(cw):
-    o = RQQ(
+  @classmethod
+  def decode(cls, cw):
+    o = cls(
       (cw>>40) & 0x7F,
       (cw>>27) & 0x1FFF,
       (cw>>5) & 0x1FFF,
@@ -683,9 +689,9 @@ class RQC:
     self.pfix, self.ident1, self.ident2, self.slots, self.ext, \
       self.flag1, self.flag2 = v
 
-  @staticmethod
-  def decode(cw):
-    o = RQC(
+  @classmethod
+  def decode(cls, cw):
+    o = cls(
       (cw>>40) & 0x7F,
       (cw>>27) & 0x1FFF,
       (cw>>5) & 0x1FFF,
@@ -707,11 +713,11 @@ class SAMIS:
     self.desc, self.parameters1, self.parameters2, self.mfgcode, self.model, \
       self.chkbits, self.serial = v
 
-  @staticmethod
-  def decode(cw):
+  @classmethod
+  def decode(cls, cw):
     parameters1 = (cw>>27) & 0xFFFFF
     parameters2 = cw & 0x3FFFF
-    o = SAMIS(
+    o = cls(
       (cw >> 18) & 0x7,
       parameters1,
       parameters2,
@@ -756,6 +762,10 @@ CAT000Classes = {
   }
 }
 
+CAT001Classes = {
+  0: SAMIS # (TODO: This is a little more nuanced in reality)
+}
+
 def RUtoTSCDecode(cw):
   """Decodes cw's sent from Radio Units (RU) to the TSC"""
   if cw & 0x800000000000 and cw & 0x4000000: # Address CW & not GTC (S2.0)
@@ -764,15 +774,61 @@ def RUtoTSCDecode(cw):
     if cat==0: # Cat 000
       type = (cw >> 21) & 0x3
       func = (cw >> 18) & 0x7
-      return CAT000Classes[type][func].decode(cw)
+      cls = CAT000Classes.get(type, {}).get(func)
+      if cls:
+        return cls.decode(cw)
         
     elif cat==1: # Cat 001
       desc = (cw >> 18) & 0x7
-      if desc==0: # SAMIS (TODO: This is a little more nuanced in reality)
-        return SAMIS.decode(cw)
+      if desc in CAT001Classes:
+        return CAT001Classes[desc].decode(cw)
 
   return None
 
+def RUtoTSCDecodeMany(cws):
+  """Decodes many cw's sent from Radio Units (RU) to the TSC"""
+  return [RUtoTSCDecode(cw) for cw in cws]
+
+def encode_many(msgs, out=None):
+  """Encodes many codeword objects to a list, or into out (e.g. an
+  array('Q')) returning how many"""
+  cws = [o.cw() for o in msgs]
+  if out is None:
+    return cws
+  for n, cw in enumerate(cws):
+    out[n] = cw
+  return len(cws)
+
+##############################################################################
+## Native codec
+##############################################################################
+
+# The classes and decoder above are the reference implementation. Use the C
+# ones (same names, fields and codewords) if available because they're much
+# faster. MARK isn't implemented by either.
+MessagesPy = {c.__name__: c for c in (
+  CCSC, DCSC, GTC, ALH, ALHS, ALHD, ALHE, ALHR, ALHX, ALHF, AHY, AHYX, AHYP,
+  AHYQ, AHYC, CLEAR, MOVE, BCAST_ADDCONTROL, BCAST_DELCONTROL, BCAST_MAINT,
+  BCAST_REG, ACK, ACKI, ACKQ, ACKX, ACKV, ACKE, ACKT, ACKB, MAINT, RQS, RQX,
+  RQT, RQE, RQR, RQQ, RQC, SAMIS)}
+RUtoTSCDecode_py = RUtoTSCDecode
+RUtoTSCDecodeMany_py = RUtoTSCDecodeMany
+encode_many_py = encode_many
+
+try:
+  from libmpt1327modem import (
+    CCSC, DCSC, GTC, ALH, ALHS, ALHD, ALHE, ALHR, ALHX, ALHF, AHY, AHYX, AHYP,
+    AHYQ, AHYC, CLEAR, MOVE, BCAST_ADDCONTROL, BCAST_DELCONTROL, BCAST_MAINT,
+    BCAST_REG, ACK, ACKI, ACKQ, ACKX, ACKV, ACKE, ACKT, ACKB, MAINT, RQS, RQX,
+    RQT, RQE, RQR, RQQ, RQC, SAMIS)
+  from libmpt1327modem import decode as RUtoTSCDecode
+  from libmpt1327modem import decode_many as RUtoTSCDecodeMany
+  from libmpt1327modem import encode_many
+except ImportError:
+  import warnings
+  warnings.warn("Using slower implementation of codec... native unavailable.",
+                ImportWarning)
+
 ##############################################################################
 ## Unit test functions
 ##############################################################################
@@ -785,11 +841,53 @@ def MPT1327_test():
   assert(mpt1327_fcs(0x80000401B800)==0xF531)
   assert(mpt1327_fcs(0x8E544C701000)==0xE4C9)
 
+  # Test the (native) FCS against the reference one, singly and in bulk
+  import random
+  import array
+  cws = [random.getrandbits(48) for n in range(4096)]
+  fcss = mpt1327_fcs_many_py(cws)
+  assert([mpt1327_fcs(cw) for cw in cws]==fcss)
+  assert(mpt1327_fcs_many(cws)==fcss)
+  assert(mpt1327_fcs_many(array.array('Q', cws))==fcss)
+
   # Test CCSC/DCSC generators
   for n in range(0x7FFF):
     assert(mpt1327_fcs(CCSC(n).cw())==SYNC)
     assert(mpt1327_fcs(DCSC(n).cw())==SYNT)
 
+  # Test the (native) codec against the reference one: encoding each
+  # message from random field values...
+  def fields_ok(cls, n):
+    try:
+      cls(*[0]*n)
+      return True
+    except ValueError:
+      return False
+  for name, cls in MessagesPy.items():
+    if not hasattr(cls, "cw"): # Reference has decoder only
+      continue
+    nfields = next(n for n in range(1, 9) if fields_ok(cls, n))
+    bits = 15 if name in ("CCSC", "DCSC") else 20
+    for n in range(256):
+      v = [random.getrandbits(bits) for i in range(nfields)]
+      assert(globals()[name](*v).cw()==cls(*v).cw())
+    msgs = [globals()[name](*v)]*4
+    out = array.array('Q', [0]*4)
+    assert(encode_many(msgs, out)==4)
+    assert(encode_many(msgs)==list(out)==encode_many_py([cls(*v)]*4))
+
+  # ...and decoding random (mostly address) codewords
+  cws = [random.getrandbits(48) | 1<<47 | 1<<26 for n in range(8192)]
+  cws += [random.getrandbits(48) for n in range(1024)]
+  for cw, o in zip(cws, RUtoTSCDecodeMany(cws)):
+    r = RUtoTSCDecode_py(cw)
+    assert(type(RUtoTSCDecode(cw)).__name__==type(o).__name__==
+           type(r).__name__)
+    if r:
+      assert({k: getattr(o, k) for k in vars(r)}==vars(r))
+      if type(r).__str__ is not object.__str__:
+        assert(str(o)==str(r))
+
 if __name__=="__main__":
   MPT1327_test()
 
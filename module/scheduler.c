@@ -0,0 +1,521 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+
+#include "scheduler.h"
+#include "codec.h"
+
+enum
+{
+  SCHED_CCSC = 0,   // Control channel, frame start
+  SCHED_ADDRESS,    // ...address codeword
+  SCHED_TRAFFIC,    // Traffic channel, quiet
+  SCHED_TRAFFIC_CW, // ...codeword after its SYNT
+  SCHED_IDENT       // Morse ident, between control channel frames
+};
+
+enum
+{
+  REPLY_NONE = 0,
+  REPLY_DUE,        // Item sending: the wait starts with the next codeword
+  REPLY_WAIT
+};
+
+enum
+{
+  RA_NONE = 0,      // No carrier (or no carrier detection)
+  RA_BURST,         // Random access burst...
+  RA_HEARD,         // ...a codeword heard in it
+  RA_IGNORE         // Burst in slots reserved for a reply
+};
+
+// Aloha number table (s7.3.3): frame length for each ALH N
+static const int alhtolength4bit[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                         12, 15, 19, 25, 32 };
+
+// ALH function code, in the codeword (C000)
+#define ALH_FUNC(func) ((guint64)(func) << 18)
+
+// RUs behind each collision, at best throughput (Schoute), and the weight
+// of a frame in the smoothed estimates
+#define ALOHA_COLLISION_RUS 2.39f
+#define ALOHA_DECAY         0.25f
+
+// Share of random access that is registrations, in overload, for frames
+// to alternate between registrations and everything else
+#define ALOHA_STORM 0.5f
+
+void
+mpt1327_sched_init
+(
+  MPT1327Scheduler* s,
+  MPT1327Mode mode
+)
+{
+  g_mutex_init(&s->put_lock);
+  s->state = mode == MPT1327_MODE_TRAFFIC ? SCHED_TRAFFIC : SCHED_CCSC;
+  s->aloha_min = MPT1327_ALOHA_MIN;
+  s->aloha_max = MPT1327_ALOHA_MAX;
+  s->aloha_variants = 1;
+}
+
+void
+mpt1327_sched_clear
+(
+  MPT1327Scheduler* s
+)
+{
+  MPT1327TxItem* item;
+  int n, rd, wr;
+
+  // Everything still to report is: the last sent as sent and its reply
+  // as timed out, then the item part sent and those queued as dropped
+  if (s->sent_due) {
+    s->sent_due = FALSE;
+    s->on_sent(s->userdata, &s->sent);
+  }
+  if (s->reply_state != REPLY_NONE) {
+    s->reply_state = REPLY_NONE;
+    s->on_reply(s->userdata, &s->reply, 1, s->reply_cw, s->reply_count);
+  }
+  if (s->tx_active) {
+    s->tx_active = FALSE;
+    s->tx.expired = 1;
+    s->on_sent(s->userdata, &s->tx);
+  }
+  for (n=0; n<MPT1327_TX_QUEUES; n++) {
+    wr = g_atomic_int_get(&s->queue_wr[n]);
+    for (rd=s->queue_rd[n]; rd!=wr; rd=(rd + 1) % MPT1327_TX_QUEUE) {
+      item = &s->queue[n][rd];
+      if (item->expired)
+        continue;
+      item->expired = 1;
+      s->on_sent(s->userdata, item);
+    }
+    g_atomic_int_set(&s->queue_rd[n], wr);
+    g_atomic_int_set(&s->queue_depth[n], 0);
+  }
+
+  g_mutex_clear(&s->put_lock);
+}
+
+int
+mpt1327_sched_put
+(
+  MPT1327Scheduler* s,
+  MPT1327Mode mode,
+  const MPT1327TxItem* item
+)
+{
+  MPT1327TxItem* q;
+  int wr, n;
+
+  if (item->count < 1 || item->count > MPT1327_TX_CODEWORDS ||
+      item->reply < 0 || item->reply > MPT1327_REPLY_MAX ||
+      item->deadline < 0)
+    return -1;
+  if (mode == MPT1327_MODE_TRAFFIC)
+    n = MPT1327_TX_TRAFFIC;
+  else if (mode == MPT1327_MODE_CONTROL && item->prio >= 0 &&
+           item->prio < MPT1327_PRIO_COUNT)
+    n = item->prio;
+  else
+    return -1;
+
+  g_mutex_lock(&s->put_lock);
+  wr = s->queue_wr[n];
+  if ((wr + 1) % MPT1327_TX_QUEUE == g_atomic_int_get(&s->queue_rd[n])) {
+    g_mutex_unlock(&s->put_lock);
+    return -1;
+  }
+  q = &s->queue[n][wr];
+  *q = *item;
+  q->queued = g_atomic_int_get(&s->now);
+  q->expired = 0;
+  g_atomic_int_inc(&s->queue_depth[n]);
+  g_atomic_int_set(&s->queue_wr[n], (wr + 1) % MPT1327_TX_QUEUE);
+  g_mutex_unlock(&s->put_lock);
+
+  return 0;
+}
+
+// Items dropped at their deadline are left in the queue, marked, until
+// they reach its head
+static int sched_waiting(MPT1327Scheduler* s, int n)
+{
+  int rd = s->queue_rd[n];
+  int wr = g_atomic_int_get(&s->queue_wr[n]);
+
+  while (rd != wr && s->queue[n][rd].expired)
+    rd = (rd + 1) % MPT1327_TX_QUEUE;
+  g_atomic_int_set(&s->queue_rd[n], rd);
+
+  return rd != wr;
+}
+
+// Drops items past their deadline, from anywhere in the queues
+static void sched_expire(MPT1327Scheduler* s)
+{
+  MPT1327TxItem* item;
+  int n, rd, wr;
+
+  for (n=0; n<MPT1327_TX_QUEUES; n++) {
+    wr = g_atomic_int_get(&s->queue_wr[n]);
+    for (rd=s->queue_rd[n]; rd!=wr; rd=(rd + 1) % MPT1327_TX_QUEUE) {
+      item = &s->queue[n][rd];
+      if (item->expired || !item->deadline ||
+          (gint32)(s->now - item->queued) <= item->deadline)
+        continue;
+      item->expired = 1;
+      s->stats[n].expired++;
+      g_atomic_int_add(&s->queue_depth[n], -1);
+      s->on_sent(s->userdata, item);
+    }
+  }
+}
+
+// Takes the next item from a queue to start sending now. It is past
+// dropping from here on.
+static void sched_take(MPT1327Scheduler* s, int n)
+{
+  int rd = s->queue_rd[n];
+  guint32 wait;
+
+  s->tx = s->queue[n][rd];
+  s->tx_pos = 0;
+  s->tx_active = TRUE;
+  g_atomic_int_add(&s->queue_depth[n], -1);
+  g_atomic_int_set(&s->queue_rd[n], (rd + 1) % MPT1327_TX_QUEUE);
+
+  wait = s->now - s->tx.queued;
+  s->stats[n].sent++;
+  s->stats[n].wait_total += wait;
+  s->stats[n].wait_max = MAX(s->stats[n].wait_max, wait);
+}
+
+// The item's next codeword
+static guint64 sched_tx_next(MPT1327Scheduler* s)
+{
+  guint64 cw = s->tx.cw[s->tx_pos++];
+
+  if (s->tx_pos < s->tx.count)
+    return cw;
+
+  s->tx_active = FALSE;
+  s->sent = s->tx;
+  s->sent_due = TRUE;
+
+  // Slots reserved for a reply. A reply still awaited when another
+  // is asked for has missed its slots. One wanted in no slots just times
+  // out, as the controller was promised a callback.
+  s->reserved = s->sent.reply;
+  if (s->sent.reply || s->sent.freply) {
+    if (s->reply_state == REPLY_WAIT)
+      s->on_reply(s->userdata, &s->reply, 1, s->reply_cw, s->reply_count);
+    s->reply = s->sent;
+    s->reply_state = REPLY_DUE;
+  }
+
+  return cw;
+}
+
+static void sched_mode(MPT1327Scheduler* s, MPT1327Mode mode)
+{
+  if (mode == MPT1327_MODE_TRAFFIC && s->state != SCHED_TRAFFIC &&
+      s->state != SCHED_TRAFFIC_CW) {
+    s->state = SCHED_TRAFFIC;
+    s->aloha = 0;
+    s->reserved = 0;
+  }
+  else if (mode == MPT1327_MODE_CONTROL &&
+           (s->state == SCHED_TRAFFIC || s->state == SCHED_TRAFFIC_CW))
+    s->state = SCHED_CCSC;
+}
+
+// Closes the Aloha frame just ended, then picks the next one's length
+// and ALH variant (s7.3)
+static void sched_aloha(MPT1327Scheduler* s)
+{
+  MPT1327AlohaStats* a = &s->aloha_stats;
+  int min = g_atomic_int_get(&s->aloha_min);
+  int max = g_atomic_int_get(&s->aloha_max);
+  float load;
+  int n;
+
+  if (s->ra_slots) {
+    a->frames++;
+    a->slots += s->ra_slots;
+    a->success += s->ra_success;
+    a->collision += s->ra_collision;
+    a->empty += MAX(0, s->ra_slots - s->ra_success - s->ra_collision);
+    a->registrations += s->ra_reg;
+
+    // RUs that tried. A storm is followed at once, its end more slowly.
+    load = s->ra_success + ALOHA_COLLISION_RUS * s->ra_collision;
+    if (load > a->backlog)
+      a->backlog = load;
+    else
+      a->backlog += (load - a->backlog) * ALOHA_DECAY;
+
+    // Only an ALH frame invites everything
+    if (a->func == 0 && s->ra_success)
+      a->reg_share += ((float)s->ra_reg / s->ra_success - a->reg_share) *
+                      ALOHA_DECAY;
+  }
+  s->ra_slots = s->ra_success = s->ra_collision = s->ra_reg = 0;
+
+  // Throughput is best with a slot for each RU contending...
+  for (n=1; n<15 && (alhtolength4bit[n] < a->backlog ||
+                     alhtolength4bit[n] < min); n++)
+    ;
+  while (n > 1 && alhtolength4bit[n] > max)
+    n--;
+  a->n = n;
+  a->length = alhtolength4bit[n];
+
+  // ...and if there are more than that, registrations (which can wait)
+  // are kept from crowding out calls: in a registration storm frames
+  // alternate between ALHR and ALHX, else they are ALHX
+  a->overload = a->backlog > a->length;
+  if (!g_atomic_int_get(&s->aloha_variants) || !a->overload)
+    a->func = 0;
+  else if (a->reg_share >= ALOHA_STORM && a->func != 4)
+    a->func = 4;
+  else
+    a->func = 5;
+}
+
+guint64
+mpt1327_sched_next
+(
+  MPT1327Scheduler* s
+)
+{
+  guint64 cw = 0;
+  int n = 0, p;
+
+  g_atomic_int_inc(&s->now);
+  sched_expire(s);
+
+  // Each codeword is a tick of a reply's timeout
+  if (s->reply_state == REPLY_WAIT && --s->reply_timeout <= 0) {
+    s->reply_state = REPLY_NONE;
+    s->on_reply(s->userdata, &s->reply, 1, s->reply_cw, s->reply_count);
+  }
+
+  // The last codeword from a queue has gone...
+  if (s->sent_due) {
+    s->sent_due = FALSE;
+    if (s->sent.mode >= 0)
+      sched_mode(s, s->sent.mode);
+    s->on_sent(s->userdata, &s->sent);
+  }
+
+  // ...and its reply may come now
+  if (s->reply_state == REPLY_DUE) {
+    s->reply_state = REPLY_WAIT;
+    s->reply_timeout = MPT1327_REPLY_TIMEOUT;
+    s->reply_count = 0;
+  }
+
+  switch (s->state) {
+
+  case SCHED_CCSC:
+    // Morse ident only between Aloha frames (and items)
+    if (s->aloha == 0 && !s->tx_active && g_atomic_int_get(&s->ident)) {
+      g_atomic_int_set(&s->ident, 0);
+      s->state = SCHED_IDENT;
+      s->on_ident(s->userdata);
+      break;
+    }
+    cw = s->ccsc;
+    s->state = SCHED_ADDRESS;
+    break;
+
+  case SCHED_ADDRESS:
+    s->state = SCHED_CCSC;
+
+    // Slots withdrawn for a reply (7.2.5)
+    if (s->reserved)
+      s->reserved--;
+    for (p=0; !s->reserved && !s->tx_active && p<MPT1327_PRIO_COUNT; p++)
+      if (sched_waiting(s, p))
+        sched_take(s, p);
+
+    // A frame starts with the ALH giving its length. Until one can be
+    // sent the slots are in no frame, and aren't counted.
+    if (s->aloha == 0 && !s->reserved && !s->tx_active) {
+      sched_aloha(s);
+      n = s->aloha_stats.n;
+      s->aloha = s->aloha_stats.length;
+    }
+    if (s->aloha) {
+      s->aloha--;
+      if (!s->reserved)
+        s->ra_slots++;
+    }
+
+    if (s->reserved)
+      cw = s->dummy;
+    else if (s->tx_active)
+      cw = sched_tx_next(s);
+    else
+      cw = (s->alh & ~ALH_FUNC(7)) | ALH_FUNC(s->aloha_stats.func) | n;
+    break;
+
+  case SCHED_TRAFFIC:
+    if (!s->tx_active && sched_waiting(s, MPT1327_TX_TRAFFIC))
+      sched_take(s, MPT1327_TX_TRAFFIC);
+    if (s->tx_active) {
+      cw = 1;  // SYNT alone
+      s->state = SCHED_TRAFFIC_CW;
+    }
+    break;
+
+  case SCHED_TRAFFIC_CW:
+    s->state = SCHED_TRAFFIC;
+    cw = sched_tx_next(s);
+    break;
+
+  case SCHED_IDENT:
+    break;
+
+  }
+
+  return cw;
+}
+
+int
+mpt1327_sched_rx
+(
+  MPT1327Scheduler* s,
+  guint64 cw
+)
+{
+  MPT1327Msg msg;
+
+  // Random access, once a burst: carrier detection may be off
+  if (s->reply_state != REPLY_WAIT || !s->reply.reply) {
+    if ((s->state == SCHED_CCSC || s->state == SCHED_ADDRESS) &&
+        (s->ra_burst == RA_NONE || s->ra_burst == RA_BURST)) {
+      s->ra_success++;
+      if (mpt1327_msg_decode(&msg, cw) == MPT1327_MSG_RQR)
+        s->ra_reg++;
+      if (s->ra_burst == RA_BURST)
+        s->ra_burst = RA_HEARD;
+    }
+    return 0;
+  }
+  if (s->ra_burst != RA_NONE)
+    s->ra_burst = RA_IGNORE;
+
+  s->reply_cw[s->reply_count++] = cw;
+  s->reply_timeout = MPT1327_REPLY_TIMEOUT;
+  if (s->reply_count >= s->reply.reply) {
+    s->reply_state = REPLY_NONE;
+    s->on_reply(s->userdata, &s->reply, 0, s->reply_cw, s->reply_count);
+  }
+
+  return 1;
+}
+
+void
+mpt1327_sched_carrier
+(
+  MPT1327Scheduler* s,
+  int on
+)
+{
+  if (on)
+    s->ra_burst = s->reply_state == REPLY_WAIT && s->reply.reply ?
+                  RA_IGNORE : RA_BURST;
+  else {
+    if (s->ra_burst == RA_BURST &&
+        (s->state == SCHED_CCSC || s->state == SCHED_ADDRESS))
+      s->ra_collision++;
+    s->ra_burst = RA_NONE;
+  }
+}
+
+void
+mpt1327_sched_ident
+(
+  MPT1327Scheduler* s
+)
+{
+  g_atomic_int_set(&s->ident, 1);
+}
+
+void
+mpt1327_sched_ident_done
+(
+  MPT1327Scheduler* s
+)
+{
+  if (s->state == SCHED_IDENT)
+    s->state = SCHED_CCSC;
+}
+
+void
+mpt1327_sched_stats
+(
+  MPT1327Scheduler* s,
+  MPT1327QueueStats stats[MPT1327_TX_QUEUES]
+)
+{
+  int n;
+
+  for (n=0; n<MPT1327_TX_QUEUES; n++) {
+    stats[n] = s->stats[n];
+    stats[n].depth = g_atomic_int_get(&s->queue_depth[n]);
+  }
+}
+
+int
+mpt1327_sched_aloha
+(
+  MPT1327Scheduler* s,
+  int min,
+  int max,
+  int variants
+)
+{
+  if (min < 1 || min > max || max > 32)
+    return -1;
+
+  g_atomic_int_set(&s->aloha_min, min);
+  g_atomic_int_set(&s->aloha_max, max);
+  g_atomic_int_set(&s->aloha_variants, variants ? 1 : 0);
+
+  return 0;
+}
+
+void
+mpt1327_sched_aloha_stats
+(
+  MPT1327Scheduler* s,
+  MPT1327AlohaStats* stats
+)
+{
+  *stats = s->aloha_stats;
+  stats->min = g_atomic_int_get(&s->aloha_min);
+  stats->max = g_atomic_int_get(&s->aloha_max);
+  stats->variants = g_atomic_int_get(&s->aloha_variants);
+}
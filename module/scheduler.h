@@ -0,0 +1,276 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <glib.h>
+
+// Aloha frame lengths (slots) the random access controller picks from by
+// default. Lengths are those the ALH N field can give (s7.3.3).
+#define MPT1327_ALOHA_MIN 1
+#define MPT1327_ALOHA_MAX 32
+
+// Most codewords a solicited reply can take, and codeword times without
+// one before it times out
+#define MPT1327_REPLY_MAX     8
+#define MPT1327_REPLY_TIMEOUT 4
+
+// Items each transmit queue holds, and most codewords in an item
+#define MPT1327_TX_QUEUE     64
+#define MPT1327_TX_CODEWORDS 8
+
+typedef guint64 (*mpt1327_channel_completion_fn)(void* userdata);
+typedef void (*mpt1327_channel_sent_fn)(void* userdata, int expired);
+typedef void (*mpt1327_channel_reply_fn)(void* userdata, int timeout,
+                                         const guint64* cw, int count);
+
+// What the channel sends when it has nothing queued
+typedef enum
+{
+  MPT1327_MODE_CONTROL = 0, // CCSC and address codeword frames, Aloha
+  MPT1327_MODE_TRAFFIC,     // Silence
+  MPT1327_MODE_COUNT
+} MPT1327Mode;
+
+// Control channel transmit classes, highest priority first. A class is
+// only sent from when those above it are empty.
+typedef enum
+{
+  MPT1327_PRIO_EMERGENCY = 0,
+  MPT1327_PRIO_CALL,         // Call set up (AHY, GTC)
+  MPT1327_PRIO_ACK,          // Acknowledgements
+  MPT1327_PRIO_HOUSEKEEPING,
+  MPT1327_PRIO_COUNT
+} MPT1327Priority;
+
+// A queue for each control channel class, then the traffic channel's
+#define MPT1327_TX_QUEUES   (MPT1327_PRIO_COUNT + 1)
+#define MPT1327_TX_TRAFFIC  MPT1327_PRIO_COUNT
+
+// Codewords to send, from the queue for the mode they are sent in. They
+// go in consecutive slots (after a SYNT each on a traffic channel), with
+// nothing else between them, and are dropped or sent as one.
+typedef struct MPT1327TxItem_s
+{
+  guint64 cw[MPT1327_TX_CODEWORDS]; // Without their FCS
+  int count;
+  int mode;       // Mode the channel changes to once they are sent, or -1
+  int reply;      // Slots reserved after them for a reply, up to
+                  // MPT1327_REPLY_MAX codewords
+  int prio;       // Control channel class
+  int deadline;   // Codeword times it may wait to be sent before it is
+                  // dropped, 0 for as long as it takes
+  mpt1327_channel_sent_fn fsent;   // Called once sent (or dropped)...
+  void* sentdata;
+  mpt1327_channel_reply_fn freply; // ...and with its reply (a timeout if
+  void* replydata;                 // dropped)
+
+  // The scheduler's
+  guint32 queued;  // Time it was queued, codeword times
+  int expired;
+} MPT1327TxItem;
+
+typedef struct MPT1327QueueStats_s
+{
+  guint32 depth;       // Waiting now
+  guint32 sent;
+  guint32 expired;     // Dropped at their deadline
+  guint64 wait_total;  // Codeword times those sent waited
+  guint32 wait_max;
+} MPT1327QueueStats;
+
+// Random access on a control channel: what the Aloha frames brought in,
+// and the estimate the next frame's length and ALH variant come from
+typedef struct MPT1327AlohaStats_s
+{
+  guint32 frames;
+  guint32 slots;      // Slots in them open to random access
+  guint32 success;    // Random access bursts with a codeword...
+  guint32 collision;  // ...and without (carrier, but no codeword checked)
+  guint32 empty;      // Slots without either
+  guint32 registrations; // Successes that were RQRs
+
+  float backlog;      // RUs estimated to be contending
+  float reg_share;    // Smoothed share of successes that are RQRs
+  int overload;       // More RUs contending than a frame has slots
+
+  int n;              // ALH N of the frame in progress...
+  int length;         // ...the slots it stands for
+  int func;           // ...and the ALH function (0 ALH, 4 ALHR, 5 ALHX)
+  int min, max;       // Lengths allowed
+  int variants;       // ALH variants used, not just ALH
+} MPT1327AlohaStats;
+
+// Control and traffic channel transmit scheduler: decides each codeword
+// as the modulator needs it, from the transmit queues (the control
+// channel's by class) and the codewords an idle channel sends (CCSC and
+// ALH, in Aloha frames), and matches replies in slots reserved for them.
+// Items still queued at their deadline are dropped. Each Aloha frame's
+// length and ALH variant are chosen from the random access heard in the
+// frames before it.
+//
+// Codewords are put in the queues from any thread, the queues being
+// single consumer rings with put_lock keeping producers from writing at
+// once. Everything else happens on the sound thread.
+typedef struct MPT1327Scheduler_s
+{
+  MPT1327TxItem queue[MPT1327_TX_QUEUES][MPT1327_TX_QUEUE];
+  gint queue_wr[MPT1327_TX_QUEUES];
+  gint queue_rd[MPT1327_TX_QUEUES];
+  gint queue_depth[MPT1327_TX_QUEUES];
+  GMutex put_lock;
+
+  gint now;           // Codeword times sent
+  MPT1327QueueStats stats[MPT1327_TX_QUEUES];
+
+  // Idle control channel codewords: CCSC, ALH (N 0) and the dummy AHY
+  // that withdraws a slot
+  guint64 ccsc;
+  guint64 alh;
+  guint64 dummy;
+
+  int state;
+  int aloha;          // Slots left in the Aloha frame, 0 until an ALH
+                      // starts the next
+  int reserved;       // Address slots to withdraw for a reply
+
+  // Random access in the Aloha frame so far, and the estimate
+  gint aloha_min, aloha_max, aloha_variants;
+  int ra_burst;       // State of the burst the carrier is on for
+  int ra_slots, ra_success, ra_collision, ra_reg;
+  MPT1327AlohaStats aloha_stats;
+
+  MPT1327TxItem tx;   // Item being sent...
+  int tx_pos;         // ...its next codeword
+  gboolean tx_active;
+
+  MPT1327TxItem sent; // Last sent from a queue...
+  gboolean sent_due;  // ...and not yet reported
+
+  MPT1327TxItem reply;   // Sent and waiting for a reply
+  int reply_state;
+  int reply_timeout;     // Codeword times left
+  guint64 reply_cw[MPT1327_REPLY_MAX];
+  int reply_count;
+
+  gint ident;         // Ident wanted at the next frame boundary
+
+  // Called on the sound thread: an item was sent (or dropped, expired
+  // set), its reply came (or timed out), and an ident is to start (the
+  // scheduler then sends silence until mpt1327_sched_ident_done)
+  void (*on_sent)(void* userdata, const MPT1327TxItem* item);
+  void (*on_reply)(void* userdata, const MPT1327TxItem* item, int timeout,
+                   const guint64* cw, int count);
+  void (*on_ident)(void* userdata);
+  void* userdata;
+
+} MPT1327Scheduler;
+
+void
+mpt1327_sched_init
+(
+  MPT1327Scheduler* s,
+  MPT1327Mode mode
+);
+
+// Reports everything queued or in flight (items as dropped, a reply
+// awaited as timed out), with nothing sending any more
+void
+mpt1327_sched_clear
+(
+  MPT1327Scheduler* s
+);
+
+// Queues an item to send in a mode (in its class, on a control channel).
+// Returns -1 if the queue is full.
+int
+mpt1327_sched_put
+(
+  MPT1327Scheduler* s,
+  MPT1327Mode mode,
+  const MPT1327TxItem* item
+);
+
+// Sound thread: the next codeword to send (callback form: 0 is silence)
+guint64
+mpt1327_sched_next
+(
+  MPT1327Scheduler* s
+);
+
+// Sound thread: a codeword was received. Returns 1 if it was a reply the
+// scheduler was waiting for, 0 if it is for the controller.
+int
+mpt1327_sched_rx
+(
+  MPT1327Scheduler* s,
+  guint64 cw
+);
+
+// Sound thread: the carrier came on or went off. A burst of it without a
+// codeword is a random access collision.
+void
+mpt1327_sched_carrier
+(
+  MPT1327Scheduler* s,
+  int on
+);
+
+void
+mpt1327_sched_ident
+(
+  MPT1327Scheduler* s
+);
+
+void
+mpt1327_sched_ident_done
+(
+  MPT1327Scheduler* s
+);
+
+// Any thread: stats of each queue, by class then the traffic queue
+void
+mpt1327_sched_stats
+(
+  MPT1327Scheduler* s,
+  MPT1327QueueStats stats[MPT1327_TX_QUEUES]
+);
+
+// Any thread: the Aloha frame lengths to choose from (equal for a fixed
+// length), and whether ALHR and ALHX frames may be used in overload.
+// Returns -1 if the lengths aren't from 1 to 32, min first.
+int
+mpt1327_sched_aloha
+(
+  MPT1327Scheduler* s,
+  int min,
+  int max,
+  int variants
+);
+
+// Any thread
+void
+mpt1327_sched_aloha_stats
+(
+  MPT1327Scheduler* s,
+  MPT1327AlohaStats* stats
+);
+
+#endif /* SCHEDULER_H */
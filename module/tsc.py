@@ -24,7 +24,8 @@ import sys
 import logging
 from time import sleep
 import mpt1327 as mpt
-from channel import Channel
+from channel import Channel, MODE_CONTROL, MODE_TRAFFIC, PRIO_EMERGENCY, \
+  PRIO_CALL, PRIO_ACK
 
 call = None
 
@@ -40,24 +41,25 @@ class Call:
                   self.ci.ident1, 
                   self.ci.ident2, 0, 0, 1, 0, 0), 
                   None, None,
-                  1, Call.AHYUpdate, self)
+                  1, Call.AHYUpdate, self, prio=PRIO_CALL)
 
   def AHYUpdate(self, timeout, ch, cws):
     if timeout:
       print("Called unit unavailable")
-      ch.Tx(mpt.ACKV(self.ci.pfix, self.ci.ident1, self.ci.ident2, 0, 0))
+      ch.Tx(mpt.ACKV(self.ci.pfix, self.ci.ident1, self.ci.ident2, 0, 0),
+            prio=PRIO_CALL)
     else:
       cw = mpt.RUtoTSCDecode(cws[0])
       if isinstance(cw, mpt.ACKI):
         print("Got reply, progressing call...")
-        ch.Tx(mpt.GTC(self.ci.pfix, self.ci.ident1, 0, 1, self.ci.ident2, 0))
-        ch.Tx(mpt.GTC(self.ci.pfix, self.ci.ident1, 0, 1, self.ci.ident2, 0),
-              self.ChannelReady, None)
+        gtc = mpt.GTC(self.ci.pfix, self.ci.ident1, 0, 1, self.ci.ident2, 0)
+        ch.Tx([gtc, gtc], self.ChannelReady, None, mode=MODE_TRAFFIC,
+              prio=PRIO_CALL)
       else:
         print("Call::AHYUpdate: Unexpected message:", cw)
 
   def ChannelReady(self, data, ch):
-    ch.txstate = 2
+    print("Traffic channel ready")
 
 
 def CreateCall(ch, o):
@@ -65,7 +67,7 @@ def CreateCall(ch, o):
 
   # You can't call yourself, we don't do data and we don't do simultaneous
   if o.ident1==o.ident2 or o.dt or call:
-    ch.Tx(mpt.ACKX(o.pfix, o.ident1, o.ident2, 0, 0))
+    ch.Tx(mpt.ACKX(o.pfix, o.ident1, o.ident2, 0, 0), prio=PRIO_ACK)
     return 0;
 
   # Create call
@@ -73,7 +75,6 @@ def CreateCall(ch, o):
 
 def RestartChannel(data, ch):
   print("Restart CC")
-  ch.txstate = 0
 
 def rxfunc(data, ch, o):
   global call
@@ -81,13 +82,15 @@ def rxfunc(data, ch, o):
   if isinstance(o, mpt.RQS): # Simple call
     CreateCall(ch, o)
   elif isinstance(o, mpt.RQE): # Emergency call request
-    ch.Tx(mpt.ACKX(o.pfix, o.ident1, o.ident2, 0, 0))
+    ch.Tx(mpt.ACKX(o.pfix, o.ident1, o.ident2, 0, 0), prio=PRIO_EMERGENCY)
   elif isinstance(o, mpt.RQR): # Request to register
     print("Registration:", o)
-    ch.Tx(mpt.ACK(o.pfix, mpt.TSCI, o.ident2, 0, 0))
+    # The unit asks again if this is late, so it isn't worth sending then
+    ch.Tx(mpt.ACK(o.pfix, mpt.TSCI, o.ident2, 0, 0), prio=PRIO_ACK,
+          deadline=2)
   elif isinstance(o, mpt.RQC): # Short message
     print("Short message:", o)
-    ch.Tx(mpt.ACKX(o.pfix, o.ident1, o.ident2, 0, 0))
+    ch.Tx(mpt.ACKX(o.pfix, o.ident1, o.ident2, 0, 0), prio=PRIO_ACK)
   elif isinstance(o, mpt.MAINT): # Maintenance message
     if call:
       if o.oper==0: # Presel ON
@@ -97,9 +100,8 @@ def rxfunc(data, ch, o):
       if o.oper==3: # Disconnect
         print("DISCONNECT")
         call = None
-        ch.TxTraf(mpt.CLEAR(ch.channelnumber, 0, 0, 0))
-        ch.TxTraf(mpt.CLEAR(ch.channelnumber, 0, 0, 0))
-        ch.TxTraf(mpt.CLEAR(ch.channelnumber, 0, 0, 0), RestartChannel, None)
+        ch.TxTraf([mpt.CLEAR(ch.channelnumber, 0, 0, 0)] * 3, RestartChannel,
+                  None, mode=MODE_CONTROL)
 
   else:
     print("Unimplemented request", o)
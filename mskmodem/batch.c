@@ -0,0 +1,525 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <glib.h>
+
+#include "batch.h"
+#include "filters.h"
+#include "ring.h"
+#include "q15.h"
+
+// Channels advanced per vector operation. The state of each group of
+// BATCH_LANES channels is kept as structure of arrays so every operation
+// of the incoherent demodulator works on all lanes at once. Each lane gives
+// exactly the same bits as the single channel demodulator.
+//
+// The batch always runs in floating point: it is meant for hosts with wide
+// vector units. In the fixed point build samples are converted as they are
+// deposited, so lanes may differ slightly from the Q15 single channel path.
+//
+// Channels deposit their periods from their own sound threads into rings
+// of their own, and the batch runs on a thread of its own. Its bits go
+// back through a ring to each channel, which gets them on its own thread
+// as it deposits its next period.
+#define BATCH_LANES 8
+
+#define BATCH_BLOCK 256   // Most samples per processing block
+#define BATCH_STAGE 8192  // Longest period that can be batched, and the
+                          // backlog at which a lane that has stopped
+                          // delivering is no longer waited for
+#define BATCH_RING  (4*BATCH_STAGE) // Samples queued for each lane
+#define BATCH_MARKS 64    // ...and periods
+#define BATCH_BITS  4096  // Bits queued back to each lane
+
+#define BPF_HIST (FIR900TO2100_TAPS-1)
+#define LPF_HIST (FIR600_TAPS-1)
+
+// glib allocations are at least 16 byte aligned, so don't ask for more
+typedef float bv_f
+  __attribute__((vector_size(BATCH_LANES*sizeof(float)), aligned(16)));
+typedef gint32 bv_i
+  __attribute__((vector_size(BATCH_LANES*sizeof(gint32)), aligned(16)));
+
+// Use the wider vector unit where there is one
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define BATCH_TARGETS __attribute__((target_clones("avx2","default")))
+#else
+#define BATCH_TARGETS
+#endif
+
+typedef struct {
+
+  // Filter histories, one vector (all lanes) per sample
+  bv_f bpf[BPF_HIST+BATCH_BLOCK];
+  bv_f lpf[LPF_HIST+BATCH_BLOCK];
+  bv_f out[BATCH_BLOCK]; // Filter output
+
+  // Incoherent demodulator state
+  bv_f last;
+  bv_i mst;
+  bv_i discqueue[15];
+  int discpos;
+  bv_i slast;
+  bv_i pll;
+  bv_i pll_count;
+  bv_i pll_early; // Early/late flags are cleared at the start of each of
+  bv_i pll_late;  // a lane's periods, as in the single channel demodulator
+
+  float in[BATCH_LANES][BATCH_BLOCK]; // Block taken from each lane's ring
+
+  // Lanes
+  struct {
+    MSKModemRxFn rx_f;
+    void* userdata;
+    gint used;
+    gint active;
+
+    // Lane's sound thread to the batch thread: samples, and the length of
+    // each period in them
+    MSKModemRing* ring;
+    int marks[BATCH_MARKS];
+    gint marks_wr;
+    gint marks_rd;
+    int left;       // Samples left of the period being demodulated
+
+    // ...and back: the bits
+    guint8 bits[BATCH_BITS];
+    gint bits_wr;
+    gint bits_rd;
+  } lane[BATCH_LANES];
+
+} BatchGroup;
+
+struct MSKModemBatch_s {
+  int ngroups;
+  BatchGroup* groups;
+
+  GThread* thread;
+  GMutex lock;     // Held by the batch thread while it runs
+  GCond cond;
+  int quit;
+
+  gint overruns;   // Periods and bits dropped, the batch too far behind
+};
+
+static const bv_i batch_none;
+
+// Folded symmetric FIR across lanes, same operation order as fir.c. Four
+// outputs are accumulated side by side to hide the add latency. Always
+// inlined so it is built for whichever target clone calls it.
+static inline __attribute__((always_inline))
+void batch_fir(bv_f* y, const bv_f* w, const float* c, int half, int n)
+{
+  int i = 0, k;
+
+  for (; i+4<=n; i+=4) {
+    const bv_f* x = w + i;
+    bv_f s0 = c[half] * x[half];
+    bv_f s1 = c[half] * x[half+1];
+    bv_f s2 = c[half] * x[half+2];
+    bv_f s3 = c[half] * x[half+3];
+    for (k=0; k<half; k++) {
+      s0 += c[k] * (x[k] + x[2*half-k]);
+      s1 += c[k] * (x[k+1] + x[2*half-k+1]);
+      s2 += c[k] * (x[k+2] + x[2*half-k+2]);
+      s3 += c[k] * (x[k+3] + x[2*half-k+3]);
+    }
+    y[i] = s0;
+    y[i+1] = s1;
+    y[i+2] = s2;
+    y[i+3] = s3;
+  }
+
+  for (; i<n; i++) {
+    const bv_f* x = w + i;
+    bv_f s0 = c[half] * x[half];
+    for (k=0; k<half; k++)
+      s0 += c[k] * (x[k] + x[2*half-k]);
+    y[i] = s0;
+  }
+}
+
+// Batch thread: queues a bit back to a lane
+static void batch_bit(MSKModemBatch* b, BatchGroup* g, int l, guint8 bit)
+{
+  int wr = g->lane[l].bits_wr;
+  int next = (wr + 1) % BATCH_BITS;
+
+  if (next == g_atomic_int_get(&g->lane[l].bits_rd)) {
+    g_atomic_int_inc(&b->overruns);
+    return;
+  }
+  g->lane[l].bits[wr] = bit;
+  g_atomic_int_set(&g->lane[l].bits_wr, next);
+}
+
+BATCH_TARGETS
+static void batch_group_block(MSKModemBatch* bt, BatchGroup* g, int n,
+                              const bv_i* enabled)
+{
+  int i, l, t;
+  bv_f v, lp;
+  bv_i b, x, pll_reset;
+
+  // Interleave the lanes. Lanes without samples get silence.
+  for (i=0; i<n; i++) {
+    for (l=0; l<BATCH_LANES; l++)
+      g->bpf[BPF_HIST+i][l] = (*enabled)[l] ? g->in[l][i] : 0.0f;
+  }
+
+  // Initial filter
+  batch_fir(g->out, g->bpf, fir900to2100, FIR900TO2100_TAPS/2, n);
+
+  for (i=0; i<n; i++) {
+    v = g->out[i];
+
+    // Zero crossing detector
+    x = ((g->last < 0) & (v >= 0)) | ((g->last >= 0) & (v < 0));
+    g->mst = (x & (40/3)) | (~x & g->mst);
+    g->last = v;
+
+    // Monostable
+    x = g->mst > 0;
+    g->mst += x;
+    b = x & 1;
+
+    // Discriminator
+    g->discqueue[g->discpos] = b;
+    if ((t = g->discpos - (40/3)) < 0)
+      t += 15;
+    b &= g->discqueue[t];
+    if ((t = g->discpos - (40/6)) < 0)
+      t += 15;
+    b &= g->discqueue[t];
+    b = 1 - b;
+    if (++g->discpos >= 15)
+      g->discpos = 0;
+
+    g->lpf[LPF_HIST+i] = __builtin_convertvector(b, bv_f);
+  }
+
+  // Low pass output of discriminator
+  batch_fir(g->out, g->lpf, fir600, FIR600_TAPS/2, n);
+
+  for (i=0; i<n; i++) {
+    lp = g->out[i];
+
+    // Bit detector
+    b = (lp > 0.5f) & 1;
+
+    // PLL sync
+    x = b != g->slast;
+    g->slast = b;
+
+    // PLL early/late gate
+    g->pll_early |= (g->pll_count < 40/2-1) & x;
+    g->pll_late |= (g->pll_count > 40/2+1) & x;
+
+    // PLL reference adjust
+    pll_reset = ((g->pll_count == 40-1-2) & g->pll_early & ~g->pll_late)
+              | ((g->pll_count == 40-1) & ~g->pll_early & ~g->pll_late)
+              | ((g->pll_count == 40-1) & g->pll_early & g->pll_late)
+              | (g->pll_count == 40+1+2);
+
+    // PLL reference generator, bits go back to each lane
+    x = (g->pll_count <= 40/2) & (g->pll == 0) & *enabled;
+    if (memcmp(&x, &batch_none, sizeof(x)))
+      for (l=0; l<BATCH_LANES; l++)
+        if (x[l])
+          batch_bit(bt, g, l, b[l]);
+    g->pll = (g->pll_count <= 40/2) & 1;
+
+    // PLL reference adjust
+    g->pll_count = (~pll_reset & (g->pll_count + 1));
+    g->pll_early &= ~pll_reset;
+    g->pll_late &= ~pll_reset;
+
+  }
+
+  memmove(g->bpf, g->bpf+n, BPF_HIST*sizeof(*g->bpf));
+  memmove(g->lpf, g->lpf+n, LPF_HIST*sizeof(*g->lpf));
+}
+
+// Start a lane from the same state as a new single channel demodulator
+static void batch_lane_reset(BatchGroup* g, int l)
+{
+  int i;
+
+  for (i=0; i<BPF_HIST; i++)
+    g->bpf[i][l] = 0;
+  for (i=0; i<LPF_HIST; i++)
+    g->lpf[i][l] = 0;
+  for (i=0; i<15; i++)
+    g->discqueue[i][l] = 0;
+  g->last[l] = 0;
+  g->mst[l] = 0;
+  g->slast[l] = 0;
+  g->pll[l] = 40;
+  g->pll_count[l] = 0;
+  g->pll_early[l] = 0;
+  g->pll_late[l] = 0;
+
+  mskmodem_ring_reset(g->lane[l].ring, 0);
+  g->lane[l].marks_wr = g->lane[l].marks_rd = 0;
+  g->lane[l].left = 0;
+  g->lane[l].bits_wr = g->lane[l].bits_rd = 0;
+}
+
+// Batch thread: demodulates a block of each lane in a group, as long as
+// every running lane has samples (or one has stopped delivering and the
+// others have built up a backlog). Blocks end at period boundaries so the
+// lanes' periods are kept. Returns 0 if there wasn't a block.
+static int batch_group_step(MSKModemBatch* b, BatchGroup* g)
+{
+  bv_i enabled = batch_none;
+  int l, rd, n = BATCH_BLOCK;
+  int ready = 0, waiting = 0, backlog = 0;
+
+  for (l=0; l<BATCH_LANES; l++) {
+    if (!g_atomic_int_get(&g->lane[l].used) ||
+        !g_atomic_int_get(&g->lane[l].active))
+      continue;
+
+    // Next period
+    rd = g->lane[l].marks_rd;
+    if (!g->lane[l].left && rd != g_atomic_int_get(&g->lane[l].marks_wr)) {
+      g->lane[l].left = g->lane[l].marks[rd];
+      g_atomic_int_set(&g->lane[l].marks_rd, (rd + 1) % BATCH_MARKS);
+      g->pll_early[l] = g->pll_late[l] = 0;
+    }
+
+    if (g->lane[l].left) {
+      enabled[l] = -1;
+      n = MIN(n, g->lane[l].left);
+      ready++;
+    }
+    else
+      waiting++;
+    if (mskmodem_ring_fill(g->lane[l].ring) >= BATCH_STAGE)
+      backlog = 1;
+  }
+
+  if (!ready || (waiting && !backlog))
+    return 0;
+
+  for (l=0; l<BATCH_LANES; l++) {
+    if (enabled[l]) {
+      mskmodem_ring_get(g->lane[l].ring, g->in[l], n);
+      g->lane[l].left -= n;
+    }
+  }
+  batch_group_block(b, g, n, &enabled);
+
+  return 1;
+}
+
+static gpointer batch_thread(gpointer data)
+{
+  MSKModemBatch* b = data;
+  int gi, more;
+
+  g_mutex_lock(&b->lock);
+  while (!b->quit) {
+    do {
+      more = 0;
+      for (gi=0; gi<b->ngroups; gi++)
+        more |= batch_group_step(b, &b->groups[gi]);
+    } while (more);
+    g_cond_wait_until(&b->cond, &b->lock,
+                      g_get_monotonic_time() + 10*G_TIME_SPAN_MILLISECOND);
+  }
+  g_mutex_unlock(&b->lock);
+
+  return NULL;
+}
+
+MSKModemBatch*
+mskmodem_batch_new
+(
+  int channels
+)
+{
+  MSKModemBatch* b = g_new0(MSKModemBatch, 1);
+  int gi, l;
+
+  b->ngroups = (MAX(channels, 1) + BATCH_LANES - 1) / BATCH_LANES;
+  b->groups = g_new0(BatchGroup, b->ngroups);
+
+  for (gi=0; gi<b->ngroups; gi++)
+    for (l=0; l<BATCH_LANES; l++)
+      b->groups[gi].lane[l].ring = mskmodem_ring_new(BATCH_RING);
+
+  g_mutex_init(&b->lock);
+  g_cond_init(&b->cond);
+  b->thread = g_thread_new("mskmodem-batch", batch_thread, b);
+
+  return b;
+}
+
+void
+mskmodem_batch_free
+(
+  MSKModemBatch** ppBatch
+)
+{
+  if (ppBatch && *ppBatch)
+  {
+    MSKModemBatch* b = *ppBatch;
+    int gi, l;
+
+    g_mutex_lock(&b->lock);
+    b->quit = 1;
+    g_cond_signal(&b->cond);
+    g_mutex_unlock(&b->lock);
+    g_thread_join(b->thread);
+    g_mutex_clear(&b->lock);
+    g_cond_clear(&b->cond);
+
+    for (gi=0; gi<b->ngroups; gi++)
+      for (l=0; l<BATCH_LANES; l++)
+        mskmodem_ring_free(&b->groups[gi].lane[l].ring);
+    g_free(b->groups);
+    g_free(b);
+    *ppBatch = NULL;
+  }
+}
+
+guint32
+mskmodem_batch_overruns
+(
+  MSKModemBatch* b
+)
+{
+  return g_atomic_int_get(&b->overruns);
+}
+
+int
+mskmodem_batch_add_lane
+(
+  MSKModemBatch* b,
+  MSKModemRxFn rx_f,
+  void* userdata
+)
+{
+  int gi, l, lane = -1;
+
+  g_mutex_lock(&b->lock);
+  for (gi=0; lane<0 && gi<b->ngroups; gi++) {
+    BatchGroup* g = &b->groups[gi];
+    for (l=0; lane<0 && l<BATCH_LANES; l++) {
+      if (!g->lane[l].used) {
+        batch_lane_reset(g, l);
+        g->lane[l].rx_f = rx_f;
+        g->lane[l].userdata = userdata;
+        g->lane[l].active = 0;
+        g_atomic_int_set(&g->lane[l].used, 1);
+        lane = gi*BATCH_LANES + l;
+      }
+    }
+  }
+  g_mutex_unlock(&b->lock);
+
+  return lane;
+}
+
+void
+mskmodem_batch_remove_lane
+(
+  MSKModemBatch* b,
+  int lane
+)
+{
+  BatchGroup* g = &b->groups[lane/BATCH_LANES];
+
+  g_mutex_lock(&b->lock);
+  g_atomic_int_set(&g->lane[lane%BATCH_LANES].active, 0);
+  g_atomic_int_set(&g->lane[lane%BATCH_LANES].used, 0);
+  g_mutex_unlock(&b->lock);
+}
+
+void
+mskmodem_batch_set_active
+(
+  MSKModemBatch* b,
+  int lane,
+  gboolean active
+)
+{
+  BatchGroup* g = &b->groups[lane/BATCH_LANES];
+
+  g_atomic_int_set(&g->lane[lane%BATCH_LANES].active, active ? 1 : 0);
+}
+
+int
+mskmodem_batch_deposit
+(
+  MSKModemBatch* b,
+  int lane,
+  const mskmodem_sound_t* s,
+  int samples
+)
+{
+  BatchGroup* g = &b->groups[lane/BATCH_LANES];
+  int l = lane%BATCH_LANES;
+  int rd, wr, next;
+#ifdef MSKMODEM_FIXED_POINT
+  float buf[BATCH_BLOCK];
+  int i, k, n;
+#endif
+
+  // Bits the batch has demodulated since the last period
+  rd = g->lane[l].bits_rd;
+  wr = g_atomic_int_get(&g->lane[l].bits_wr);
+  for (; rd!=wr; rd=(rd + 1) % BATCH_BITS)
+    g->lane[l].rx_f(g->lane[l].bits[rd], 0, g->lane[l].userdata);
+  g_atomic_int_set(&g->lane[l].bits_rd, rd);
+
+  if (samples > BATCH_STAGE)
+    return 1;
+
+  // A period goes in whole or not at all
+  wr = g->lane[l].marks_wr;
+  next = (wr + 1) % BATCH_MARKS;
+  if (next == g_atomic_int_get(&g->lane[l].marks_rd) ||
+      mskmodem_ring_fill(g->lane[l].ring) + samples > BATCH_RING) {
+    g_atomic_int_inc(&b->overruns);
+    return 0;
+  }
+
+#ifdef MSKMODEM_FIXED_POINT
+  for (i=0; i<samples; i+=n) {
+    n = MIN(samples-i, BATCH_BLOCK);
+    for (k=0; k<n; k++)
+      buf[k] = q15_to_float(s[i+k]);
+    mskmodem_ring_put(g->lane[l].ring, buf, n);
+  }
+#else
+  mskmodem_ring_put(g->lane[l].ring, s, samples);
+#endif
+  g->lane[l].marks[wr] = samples;
+  g_atomic_int_set(&g->lane[l].marks_wr, next);
+
+  if (g_mutex_trylock(&b->lock)) {
+    g_cond_signal(&b->cond);
+    g_mutex_unlock(&b->lock);
+  }
+
+  return 0;
+}
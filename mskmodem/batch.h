@@ -0,0 +1,68 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MSKMODEM_BATCH_H
+#define MSKMODEM_BATCH_H
+
+#include "mskmodem.h"
+
+// Internal interface between the modem contexts and the batch demodulator
+// (public part is in mskmodem.h).
+
+// Returns the lane index or -1 if the batch is full
+int
+mskmodem_batch_add_lane
+(
+  MSKModemBatch* b,
+  MSKModemRxFn rx_f,
+  void* userdata
+);
+
+void
+mskmodem_batch_remove_lane
+(
+  MSKModemBatch* b,
+  int lane
+);
+
+// Lanes only hold up the batch while their channel is running. Any
+// thread.
+void
+mskmodem_batch_set_active
+(
+  MSKModemBatch* b,
+  int lane,
+  gboolean active
+);
+
+// Lane's sound thread: hands one period of samples for a lane to the
+// batch thread, which demodulates the lanes together once each running
+// lane has delivered, then passes the lane the bits demodulated since its
+// last period (to its rx_f). Returns non-zero if the period couldn't be
+// taken (too long), in which case the caller must demodulate it.
+int
+mskmodem_batch_deposit
+(
+  MSKModemBatch* b,
+  int lane,
+  const mskmodem_sound_t* s,
+  int samples
+);
+
+#endif /* MSKMODEM_BATCH_H */
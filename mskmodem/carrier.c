@@ -0,0 +1,283 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "carrier.h"
+
+// Goertzel segments are the fewest samples holding whole cycles of both
+// tones (80 at 48kHz: 2 cycles of 1200Hz, 3 of 1800Hz), or failing that
+// about two cycles of 1200Hz. A decision is on whole segments, near 5ms.
+#define CD_SEGMENT_MAX 0.004 // Longest segment, seconds
+#define CD_BLOCK_TIME  0.005
+#define CD_ATTACK  2    // Net blocks with carrier before it is reported on
+#define CD_HANG    4    // ...and without before it is reported off
+#define CD_BACK    80   // Bits kept from before a block
+
+// Detection thresholds: share of the block energy in the two tones, on
+// its own or (less of it) with tone power over the noise floor, and the
+// least mean square level (of full scale). Band limited noise puts about
+// a third of its energy in the tones.
+#define CD_RATIO_ON   0.55f
+#define CD_RATIO_WEAK 0.3f
+#define CD_RATIO_OFF  0.45f
+#define CD_SNR_ON     4.0f
+#define CD_SNR_OFF    2.0f
+#define CD_LEVEL_MIN  1e-6f
+
+// Noise floor smoothing, falling and rising
+#define CD_FLOOR_DOWN 0.25f
+#define CD_FLOOR_UP   0.03f
+
+// Goertzel state and powers. The fixed point coefficients are Q14.
+#ifdef MSKMODEM_FIXED_POINT
+typedef gint32 cd_state_t;
+typedef gint64 cd_power_t;
+#define CD_COEF(x) ((gint32)lrint((x)*16384))
+#define CD_MUL(c, v) ((cd_state_t)(((gint64)(c)*(v)) >> 14))
+#else
+typedef float cd_state_t;
+typedef float cd_power_t;
+#define CD_COEF(x) ((float)(x))
+#define CD_MUL(c, v) ((c)*(v))
+#endif
+
+struct MSKModemCarrier_s {
+
+  int segment;     // Samples per Goertzel segment
+  int block;       // ...and per decision
+
+  // Measurement of the block in progress
+  cd_state_t coef0, coef1;   // 2cos(w) for 1800Hz and 1200Hz
+  cd_state_t s0[2], s1[2];   // Goertzel states, last two samples
+  cd_power_t energy;         // Sum of squares
+  float tone;                // Tone energy of the finished segments
+  int pos;                   // Sample within the block
+
+  // Decision
+  float floor;     // Noise floor of tone energy per block, <0 until known
+  int on;          // Carrier reported on
+  int count;       // Hysteresis count
+  guint64 sample;  // Samples seen
+  guint64 edge;    // Where count last left its resting value
+  guint64 onset;   // ...when it last came on
+
+  // Samples skipped with the gate closed, kept twice over so the last
+  // back_len are always contiguous
+  mskmodem_sound_t* back;
+  int back_len;
+  int back_pos;
+  int skipped;     // Samples not demodulated since the gate closed
+
+};
+
+MSKModemCarrier*
+mskmodem_carrier_new
+(
+  int rate
+)
+{
+  MSKModemCarrier* c = g_new0(MSKModemCarrier, 1);
+  int a = rate, b = 600, t;
+
+  while (b) {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+  c->segment = rate / a;
+  if (c->segment > CD_SEGMENT_MAX * rate)
+    c->segment = lrint(rate / 600.0);
+  c->block = c->segment * MAX(lrint(CD_BLOCK_TIME * rate / c->segment), 1);
+
+  c->back_len = CD_BACK * rate / 1200;
+  c->back = g_new0(mskmodem_sound_t, 2*c->back_len);
+
+  c->coef0 = CD_COEF(2.0*cos(2.0*G_PI*1800/rate));
+  c->coef1 = CD_COEF(2.0*cos(2.0*G_PI*1200/rate));
+  mskmodem_carrier_reset(c);
+
+  return c;
+}
+
+void
+mskmodem_carrier_free
+(
+  MSKModemCarrier** ppCarrier
+)
+{
+  if (ppCarrier && *ppCarrier) {
+    g_free((*ppCarrier)->back);
+    g_free(*ppCarrier);
+    *ppCarrier = NULL;
+  }
+}
+
+void
+mskmodem_carrier_reset
+(
+  MSKModemCarrier* c
+)
+{
+  memset(c->s0, 0, sizeof(c->s0));
+  memset(c->s1, 0, sizeof(c->s1));
+  c->energy = 0;
+  c->tone = 0;
+  c->pos = 0;
+  c->floor = -1.0f;
+  c->on = 0;
+  c->count = 0;
+  c->skipped = 0;
+}
+
+// Goertzel power of a finished segment, as the energy of a tone giving it
+static float goertzel_energy(cd_state_t coef, const cd_state_t* s,
+                             int segment)
+{
+  cd_power_t p = (cd_power_t)s[0]*s[0] + (cd_power_t)s[1]*s[1] -
+                 (cd_power_t)CD_MUL(coef, s[0])*s[1];
+  return (float)p * (2.0f / segment);
+}
+
+// Decides on a finished block. Returns 1 if the reported state changes.
+static int carrier_decide(MSKModemCarrier* c)
+{
+  const float fs2 = (float)MSKMODEM_SOUND_FULLSCALE*MSKMODEM_SOUND_FULLSCALE;
+  float energy = c->energy;
+  int carrier = 0;
+
+  if (energy > CD_LEVEL_MIN * c->block * fs2) {
+    if (c->on)
+      carrier = c->tone >= CD_RATIO_OFF * energy ||
+                (c->floor >= 0 && c->tone >= CD_SNR_OFF * c->floor);
+    else
+      carrier = c->tone >= CD_RATIO_ON * energy ||
+                (c->tone >= CD_RATIO_WEAK * energy && c->floor >= 0 &&
+                 c->tone >= CD_SNR_ON * c->floor);
+  }
+
+  // Noise floor from the blocks without carrier
+  if (!c->on && !carrier) {
+    if (c->floor < 0)
+      c->floor = c->tone;
+    else
+      c->floor += (c->tone - c->floor) *
+                  (c->tone < c->floor ? CD_FLOOR_DOWN : CD_FLOOR_UP);
+  }
+
+  // Hysteresis: a count of blocks with carrier less those without, held
+  // between 0 and CD_HANG. It goes on at CD_ATTACK and off at 0.
+  if (c->count == (c->on ? CD_HANG : 0))
+    c->edge = c->sample - c->block;
+  c->count = CLAMP(c->count + (carrier ? 1 : -1), 0, CD_HANG);
+
+  if (!c->on && c->count >= CD_ATTACK) {
+    c->on = 1;
+    c->count = CD_HANG;
+    c->onset = c->edge;
+    return 1;
+  }
+  if (c->on && c->count == 0) {
+    c->on = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+int
+mskmodem_carrier_process
+(
+  MSKModemCarrier* c,
+  const mskmodem_sound_t* s,
+  int samples,
+  const mskmodem_sound_t** back,
+  int* nback,
+  MSKModemCarrierFn f,
+  void* userdata
+)
+{
+  int was = c->on, open = c->on;
+  cd_state_t v, y;
+  int i, n;
+
+  for (i=0; i<samples; i++) {
+
+    v = s[i];
+    c->energy += (cd_power_t)v*v;
+    y = v + CD_MUL(c->coef0, c->s0[0]) - c->s0[1];
+    c->s0[1] = c->s0[0];
+    c->s0[0] = y;
+    y = v + CD_MUL(c->coef1, c->s1[0]) - c->s1[1];
+    c->s1[1] = c->s1[0];
+    c->s1[0] = y;
+    c->sample++;
+
+    if (++c->pos % c->segment)
+      continue;
+
+    c->tone += goertzel_energy(c->coef0, c->s0, c->segment) +
+               goertzel_energy(c->coef1, c->s1, c->segment);
+    memset(c->s0, 0, sizeof(c->s0));
+    memset(c->s1, 0, sizeof(c->s1));
+
+    if (c->pos < c->block)
+      continue;
+
+    if (carrier_decide(c) && f)
+      f(c->on, c->edge, userdata);
+    open |= c->on;
+    c->energy = 0;
+    c->tone = 0;
+    c->pos = 0;
+  }
+
+  // Samples before this block that were skipped, if the gate has opened
+  *nback = 0;
+  if (open) {
+    if (!was) {
+      *nback = MIN(c->skipped, c->back_len);
+      *back = c->back + c->back_pos + c->back_len - *nback;
+    }
+    c->skipped = 0;
+    return 1;
+  }
+
+  // Skipped: keep its last back_len samples
+  for (i=MAX(samples-c->back_len, 0); i<samples; i+=n) {
+    n = MIN(samples-i, c->back_len-c->back_pos);
+    memcpy(c->back+c->back_pos, s+i, n*sizeof(*s));
+    memcpy(c->back+c->back_pos+c->back_len, s+i, n*sizeof(*s));
+    c->back_pos = (c->back_pos + n) % c->back_len;
+  }
+  c->skipped += samples;
+
+  return 0;
+}
+
+int
+mskmodem_carrier_onset
+(
+  MSKModemCarrier* c
+)
+{
+  return c->on ? MIN(c->sample - c->onset, G_MAXINT) : 0;
+}
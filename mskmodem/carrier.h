@@ -0,0 +1,82 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef MSKMODEM_CARRIER_H
+#define MSKMODEM_CARRIER_H
+
+#include "mskmodem.h"
+
+// Carrier detector.
+//
+// The input is measured over blocks of about 5ms: total energy, and
+// Goertzel power at 1200Hz and 1800Hz over segments holding whole cycles of
+// both tones (80 samples at 48kHz).
+// A block has carrier when most of its energy is in the two tones and the
+// tone power is well above the noise floor, tracked from the blocks that
+// don't. Carrier comes on once blocks with it outnumber those without by
+// two, and goes off once those without catch up by four.
+//
+// The samples leading up to a block are kept so that, when carrier comes
+// on, demodulation can start from before the point it was detected.
+
+struct MSKModemCarrier_s;
+typedef struct MSKModemCarrier_s MSKModemCarrier;
+
+MSKModemCarrier*
+mskmodem_carrier_new
+(
+  int rate
+);
+
+void
+mskmodem_carrier_free
+(
+  MSKModemCarrier** ppCarrier
+);
+
+void
+mskmodem_carrier_reset
+(
+  MSKModemCarrier* c
+);
+
+// Runs the detector over a block, calling f (if set) as carrier comes on or
+// goes off. Returns 1 if the block should be demodulated, and if so and the
+// samples before it haven't been, *back and *nback give them: they should
+// be demodulated first.
+int
+mskmodem_carrier_process
+(
+  MSKModemCarrier* c,
+  const mskmodem_sound_t* s,
+  int samples,
+  const mskmodem_sound_t** back,
+  int* nback,
+  MSKModemCarrierFn f,
+  void* userdata
+);
+
+// Samples since carrier came on, as far back as the detector puts its
+// start. 0 while it is off.
+int
+mskmodem_carrier_onset
+(
+  MSKModemCarrier* c
+);
+
+#endif /* MSKMODEM_CARRIER_H */
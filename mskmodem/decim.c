@@ -0,0 +1,283 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "decim.h"
+#include "filters.h"
+#include "fir.h"
+#include "q15.h"
+
+#define DECIM_RATE   12000 // Decimate to at least this rate...
+#define DECIM_BITMAX 20    // ...so a bit is at most this many samples
+#define DECIM_BLOCK  256   // Input samples per block
+
+// Discriminator low pass at 12kHz (13 taps, 800Hz, Hamming). Removes the
+// 2f products of the discriminator. Designed to suit at other rates.
+#define FIR800D_TAPS 13
+static const float fir800d[FIR800D_TAPS] = {
+  0.0033843,0.0105932,0.0332838,0.0739256,0.1235522,0.1648179,0.1808860,
+  0.1648179,0.1235522,0.0739256,0.0332838,0.0105932,0.0033843
+};
+
+// Timing loop gains (PI), in samples per unit timing error at 10 samples
+// per bit; scaled with the bit length
+#define GARDNER_KP 0.8f
+#define GARDNER_KI 0.001f
+#define GARDNER_IMAX 0.01f // Clock offset limit, 0.1%
+
+// Bit energy for the quality figures, by decimated sample. A bit is decided
+// about DECIM_QDELAY samples (at 12kHz) after it is received.
+#define DECIM_EHIST  16
+#define DECIM_QDELAY 6
+
+struct MSKModemDecim_s {
+
+  MSKModemFir* bpf;
+  MSKModemFir* lpf;
+
+  // Rates
+  int factor;     // Decimation factor
+  float spb;      // Samples per bit after decimation
+  int bitlen;     // ...as a whole number
+  int qdelay;     // DECIM_QDELAY at the decimated rate
+  float kp, ki, imax; // Timing loop gains, scaled to the bit length
+
+  // Discriminator
+  int delay;      // Delay, near a quarter cycle at 1500Hz
+  mskmodem_sound_t xd[4]; // Previous band passed samples, newest first
+#ifdef MSKMODEM_FIXED_POINT
+  gint32 power;   // Smoothed signal power (Q30)
+  gint32 bias;    // Output midway between the tones (Q15)
+#else
+  float power;    // Smoothed signal power, normalises discriminator output
+  float bias;     // Output midway between the tones
+#endif
+
+  // Timing recovery
+  float y[4];     // Last 4 discriminator samples, y[3] newest
+  float t;        // Samples until next interpolant
+  int half;       // Next interpolant is the mid-bit one
+  float ymid;     // Interpolant between the last two bits
+  float ylast;    // Previous bit interpolant
+  float integ;    // Loop filter integrator
+
+  mskmodem_sound_t buf[DECIM_BLOCK+1];
+
+  // Bit energy: mean square and mean fourth power over a bit
+  float sq[DECIM_BLOCK+1];  // Squares of the block's samples
+  float esq[DECIM_BITMAX];  // ...of the last bit's
+  int epos;
+  float esum, esum4;
+  float ehist[DECIM_EHIST], ehist4[DECIM_EHIST]; // By sample, the last few
+  int ehist_pos;
+
+};
+
+// Cubic (Catmull-Rom) interpolation between y[1] and y[2], mu in [0,1]
+static float interp(const float* y, float mu)
+{
+  float a = -0.5f*y[0] + 1.5f*y[1] - 1.5f*y[2] + 0.5f*y[3];
+  float b = y[0] - 2.5f*y[1] + 2.0f*y[2] - 0.5f*y[3];
+  float c = -0.5f*y[0] + 0.5f*y[2];
+  return ((a*mu + b)*mu + c)*mu + y[1];
+}
+
+MSKModemDecim*
+mskmodem_decim_new
+(
+  int rate,
+  const float* bpf,
+  int taps
+)
+{
+  MSKModemDecim* d = g_new0(MSKModemDecim, 1);
+  float lpf[FILTER_TAPS_MAX];
+  double dr, tau;
+  int n;
+
+  d->factor = MAX(rate/DECIM_RATE, 1);
+  dr = (double)rate / d->factor;
+  d->spb = dr / 1200;
+  d->bitlen = lrint(d->spb);
+  d->qdelay = lrint(DECIM_QDELAY * dr / DECIM_RATE);
+  d->kp = GARDNER_KP * d->spb / 10;
+  d->ki = GARDNER_KI * d->spb / 10;
+  d->imax = GARDNER_IMAX * d->spb / 10;
+
+  // A tone f gives cos(2 pi f tau) out of the discriminator: zero at
+  // 1500Hz for a quarter cycle delay, otherwise take the midpoint
+  d->delay = MAX(lrint(dr / 6000), 1);
+  tau = d->delay / dr;
+  // off (rounded to Q15, so exactly none at 12kHz)
+  n = lrint(cos(2.0*G_PI*1500*tau) * cos(2.0*G_PI*300*tau) * Q15_ONE);
+#ifdef MSKMODEM_FIXED_POINT
+  d->bias = n;
+#else
+  d->bias = (float)n / Q15_ONE;
+#endif
+
+  d->bpf = mskmodem_fir_new_decimating(bpf, taps, d->factor);
+  if (lrint(dr) == DECIM_RATE)
+    d->lpf = mskmodem_fir_new(fir800d, FIR800D_TAPS);
+  else {
+    n = mskmodem_filter_taps(FIR800D_TAPS, lrint(dr), DECIM_RATE);
+    mskmodem_filter_lowpass(lpf, n, 800, lrint(dr));
+    d->lpf = mskmodem_fir_new(lpf, n);
+  }
+  mskmodem_decim_reset(d);
+  return d;
+}
+
+void
+mskmodem_decim_free
+(
+  MSKModemDecim** ppDecim
+)
+{
+  if (ppDecim && *ppDecim)
+  {
+    MSKModemDecim* d = *ppDecim;
+    mskmodem_fir_free(&d->bpf);
+    mskmodem_fir_free(&d->lpf);
+    g_free(d);
+    *ppDecim = NULL;
+  }
+}
+
+void
+mskmodem_decim_reset
+(
+  MSKModemDecim* d
+)
+{
+  mskmodem_fir_reset(d->bpf);
+  mskmodem_fir_reset(d->lpf);
+  memset(d->xd, 0, sizeof(d->xd));
+  d->power = 0;
+  memset(d->y, 0, sizeof(d->y));
+  d->t = d->spb/2;
+  d->half = 0;
+  d->ymid = d->ylast = 0;
+  d->integ = 0;
+  memset(d->esq, 0, sizeof(d->esq));
+  memset(d->ehist, 0, sizeof(d->ehist));
+  memset(d->ehist4, 0, sizeof(d->ehist4));
+  d->esum = d->esum4 = 0;
+}
+
+void
+mskmodem_decim_process
+(
+  MSKModemDecim* d,
+  const mskmodem_sound_t* s,
+  int samples,
+  MSKModemQuality* q,
+  MSKModemRxFn rx_f,
+  void* userdata
+)
+{
+  int p, n, m, i, k;
+  float v, e, adj;
+#ifdef MSKMODEM_FIXED_POINT
+  gint32 x;
+#else
+  float x;
+#endif
+
+  for (p=0; p<samples; p+=n) {
+    n = MIN(samples-p, DECIM_BLOCK);
+
+    // Band limit and decimate
+    m = mskmodem_fir_decimate(d->bpf, s+p, d->buf, n);
+
+    // Delay and multiply discriminator. 2 samples at 12kHz is a quarter
+    // cycle at 1500Hz so 1200Hz gives +cos(72deg), 1800Hz -cos(72deg).
+    for (i=0; i<m; i++) {
+      x = d->buf[i];
+      d->sq[i] = (float)x * x;
+#ifdef MSKMODEM_FIXED_POINT
+      d->power += (x*x - d->power) >> 6;
+      d->buf[i] = q15_sat(((gint64)x * d->xd[d->delay-1] << 15) /
+                          (d->power + 1) - d->bias);
+#else
+      d->power += (x*x - d->power) * (1.0f/64);
+      d->buf[i] = CLAMP(x * d->xd[d->delay-1] / (d->power + 1e-12f) - d->bias,
+                        -MSKMODEM_SOUND_FULLSCALE, MSKMODEM_SOUND_FULLSCALE);
+#endif
+      memmove(d->xd+1, d->xd, (G_N_ELEMENTS(d->xd)-1)*sizeof(*d->xd));
+      d->xd[0] = x;
+    }
+
+    mskmodem_fir_process(d->lpf, d->buf, d->buf, m);
+
+    // Interpolating timing recovery at two interpolants per bit
+    for (i=0; i<m; i++) {
+      memmove(d->y, d->y+1, 3*sizeof(*d->y));
+      d->y[3] = d->buf[i] * (1.0f/MSKMODEM_SOUND_FULLSCALE);
+
+      d->esum += d->sq[i] - d->esq[d->epos];
+      d->esum4 += d->sq[i]*d->sq[i] - d->esq[d->epos]*d->esq[d->epos];
+      d->esq[d->epos] = d->sq[i];
+      if (++d->epos >= d->bitlen) {
+        d->epos = 0;
+        d->esum = d->esum4 = 0;
+        for (k=0; k<d->bitlen; k++) {
+          d->esum += d->esq[k];
+          d->esum4 += d->esq[k]*d->esq[k];
+        }
+      }
+      d->ehist_pos = (d->ehist_pos + 1) % DECIM_EHIST;
+      d->ehist[d->ehist_pos] = d->esum / d->bitlen;
+      d->ehist4[d->ehist_pos] = d->esum4 / d->bitlen;
+
+      d->t -= 1.0f;
+      while (d->t <= 0.0f) {
+
+        // Interpolant lies between y[1] and y[2] (one sample of delay)
+        v = interp(d->y, d->t + 1.0f);
+
+        if (d->half) {
+          d->ymid = v;
+          d->t += d->spb/2;
+        } else {
+          // Gardner: mid-bit sample is zero when the bit sample is centred
+          e = d->ymid * (d->ylast - v);
+          if ((d->ylast > 0.0f) != (v > 0.0f))
+            mskmodem_quality_timing(q, d->kp * e * d->factor);
+          d->ylast = v;
+          d->integ = CLAMP(d->integ + d->ki * e, -d->imax, d->imax);
+          adj = d->kp * e + d->integ;
+          d->t += d->spb/2 + adj;
+
+          // Quality: timing in input samples, a correction is a whole one
+          if (adj * d->factor >= 1.0f || adj * d->factor <= -1.0f)
+            mskmodem_quality_correction(q);
+          k = (d->ehist_pos - d->qdelay + DECIM_EHIST) % DECIM_EHIST;
+          mskmodem_quality_bit(q, v > 0.0f, v, d->ehist[k], d->ehist4[k]);
+          rx_f(v > 0.0f, 0, userdata);
+        }
+        d->half = !d->half;
+
+      }
+    }
+  }
+}
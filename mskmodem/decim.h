@@ -0,0 +1,70 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MSKMODEM_DECIM_H
+#define MSKMODEM_DECIM_H
+
+#include "mskmodem.h"
+#include "quality.h"
+
+// Decimating demodulator.
+//
+// The input is band limited and decimated to between 12 and 24kHz in one
+// step (by 4 from 48kHz; not at all below 12kHz), then demodulated with a
+// delay-and-multiply discriminator. Bit timing is recovered by a Gardner
+// timing error detector driving a cubic interpolator, so the sampling
+// instant isn't tied to the sample grid.
+
+struct MSKModemDecim_s;
+typedef struct MSKModemDecim_s MSKModemDecim;
+
+// bpf is the receive band pass filter at rate, used as the decimation
+// filter
+MSKModemDecim*
+mskmodem_decim_new
+(
+  int rate,
+  const float* bpf,
+  int taps
+);
+
+void
+mskmodem_decim_free
+(
+  MSKModemDecim** ppDecim
+);
+
+void
+mskmodem_decim_reset
+(
+  MSKModemDecim* d
+);
+
+void
+mskmodem_decim_process
+(
+  MSKModemDecim* d,
+  const mskmodem_sound_t* s,
+  int samples,
+  MSKModemQuality* q,
+  MSKModemRxFn rx_f,
+  void* userdata
+);
+
+#endif /* MSKMODEM_DECIM_H */
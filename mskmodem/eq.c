@@ -0,0 +1,357 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "eq.h"
+#include "filters.h"
+#include "q15.h"
+
+#define EQ_TAP_RATE 12000 // Taps about this far apart: every fourth sample
+                          // at 48kHz
+#define EQ_SPACING_MAX (MSKMODEM_RATE_MAX/EQ_TAP_RATE)
+#define EQ_SPAN_MAX ((MSKMODEM_EQ_TAPS-1)*EQ_SPACING_MAX + 1)
+#define EQ_CENTRE  (MSKMODEM_EQ_TAPS/2)
+#define EQ_BLOCK   256  // Samples filtered at a time
+#define EQ_HIST    (FILTER_TAPS_MAX-1) // Input kept from before a block,
+                                       // for the band pass
+
+// Training: bits trained on per burst (preamble and sync are 32), starting
+// a little after the detected start of it
+#define EQ_TRAIN   40
+#define EQ_SETTLE  2
+
+// LMS step, for a burst's training and (less noisy) for continuous
+// training; leak back towards a delay, which keeps noise from spreading
+// the taps out; smoothing of the envelope target (the input's envelope, so
+// the level is kept) per sample at 48kHz; the least target (of full scale
+// squared) trained on; and the largest sum of tap magnitudes before the
+// taps are taken to have diverged
+#define EQ_MU        0.01f
+#define EQ_MU_SLOW   0.0005f
+#define EQ_LEAK      1e-4f
+#define EQ_TARGET    (1.0f/160)
+#define EQ_LEVEL_MIN 1e-6f
+#define EQ_GAIN_MAX  4.0f
+
+// The fixed point FIR runs Q12 taps with 32 bit accumulators, which
+// EQ_GAIN_MAX keeps from overflowing
+#ifdef MSKMODEM_FIXED_POINT
+typedef gint32 eq_acc_t;
+#define EQ_WBITS 12
+#define EQ_OUT(a) q15_sat(((a) + (1 << (EQ_WBITS-1))) >> EQ_WBITS)
+#else
+typedef float eq_acc_t;
+#define EQ_OUT(a) (a)
+#endif
+
+struct MSKModemEq_s {
+
+  MSKModemEqMode mode;
+
+  // Rate
+  int rate;
+  int spacing;     // Samples between taps
+  int span;        // ...and over all of them
+  int train_len;   // EQ_TRAIN in samples
+  int settle;      // EQ_SETTLE in samples
+  float smooth;    // EQ_TARGET per sample
+
+  // Filter
+  float w[MSKMODEM_EQ_TAPS];   // Taps, newest sample first
+#ifdef MSKMODEM_FIXED_POINT
+  gint16 wq[MSKMODEM_EQ_TAPS]; // ...in Q12
+#endif
+  mskmodem_sound_t hist[EQ_HIST+EQ_BLOCK]; // Input: history, then block
+  eq_acc_t acc[EQ_BLOCK];
+
+  // Training
+  float band_i[FILTER_TAPS_MAX], band_q[FILTER_TAPS_MAX]; // Analytic band
+  int band_taps;                                          // pass
+  float zi[2*EQ_SPAN_MAX], zq[2*EQ_SPAN_MAX]; // Its output, kept twice over
+  int zpos;                             // so the last span are contiguous
+  float target;    // Envelope (squared) to train to, <0 until started
+  int skip;        // Samples before training starts
+  int train;       // Samples left to train
+  double err_sum;  // Envelope error (squared, over the target) so far
+  int err_count;
+
+  // Results
+  float dispersion;
+  guint32 trainings;
+
+};
+
+// Taps back to a delay of half the span
+static void eq_delay(MSKModemEq* eq)
+{
+  memset(eq->w, 0, sizeof(eq->w));
+  eq->w[EQ_CENTRE] = 1.0f;
+}
+
+// Divergence check, and the taps the FIR runs
+static void eq_taps(MSKModemEq* eq)
+{
+  float sum = 0;
+  int k;
+
+  for (k=0; k<MSKMODEM_EQ_TAPS; k++)
+    sum += fabsf(eq->w[k]);
+  if (!(sum <= EQ_GAIN_MAX))
+    eq_delay(eq);
+
+#ifdef MSKMODEM_FIXED_POINT
+  for (k=0; k<MSKMODEM_EQ_TAPS; k++)
+    eq->wq[k] = lrintf(eq->w[k] * (1 << EQ_WBITS));
+#endif
+}
+
+MSKModemEq*
+mskmodem_eq_new
+(
+  int rate
+)
+{
+  MSKModemEq* eq = g_new0(MSKModemEq, 1);
+  double w = 2.0*G_PI*1500/rate;
+  float lpf[FILTER_TAPS_MAX];
+  int j, taps;
+
+  eq->rate = rate;
+  eq->spacing = MAX(lrint((double)rate/EQ_TAP_RATE), 1);
+  eq->span = (MSKMODEM_EQ_TAPS-1)*eq->spacing + 1;
+  eq->train_len = EQ_TRAIN*rate/1200;
+  eq->settle = EQ_SETTLE*rate/1200;
+  eq->smooth = EQ_TARGET / (rate/48000.0f);
+
+  // 600Hz low pass moved up to 1500Hz: real and imaginary parts
+  taps = mskmodem_filter_rx_lowpass(rate, lpf);
+  for (j=0; j<taps; j++) {
+    eq->band_i[j] = 2.0*lpf[j]*cos(w*(j-taps/2));
+    eq->band_q[j] = 2.0*lpf[j]*sin(w*(j-taps/2));
+  }
+  eq->band_taps = taps;
+  mskmodem_eq_reset(eq, MSKMODEM_EQ_OFF);
+
+  return eq;
+}
+
+void
+mskmodem_eq_free
+(
+  MSKModemEq** ppEq
+)
+{
+  if (ppEq && *ppEq) {
+    g_free(*ppEq);
+    *ppEq = NULL;
+  }
+}
+
+void
+mskmodem_eq_reset
+(
+  MSKModemEq* eq,
+  MSKModemEqMode mode
+)
+{
+  eq->mode = mode;
+  eq_delay(eq);
+  eq_taps(eq);
+  memset(eq->hist, 0, sizeof(eq->hist));
+  memset(eq->zi, 0, sizeof(eq->zi));
+  memset(eq->zq, 0, sizeof(eq->zq));
+  eq->target = -1.0f;
+  eq->err_sum = 0;
+  eq->err_count = 0;
+
+  // Continuous training runs from the start
+  eq->skip = eq->span;
+  eq->train = mode == MSKMODEM_EQ_CONTINUOUS ? eq->train_len : 0;
+}
+
+void
+mskmodem_eq_carrier
+(
+  MSKModemEq* eq,
+  int on,
+  int skip
+)
+{
+  if (eq->mode == MSKMODEM_EQ_OFF)
+    return;
+
+  // Nothing to train on without carrier
+  if (!on) {
+    eq->skip = 0;
+    eq->train = 0;
+    return;
+  }
+
+  // Each burst may be from a different radio: start from scratch
+  if (eq->mode == MSKMODEM_EQ_BURST)
+    eq_delay(eq);
+  eq->target = -1.0f;
+  eq->err_sum = 0;
+  eq->err_count = 0;
+  eq->skip = skip + eq->settle;
+  eq->train = eq->train_len;
+}
+
+// Band passes the sample at x into the analytic signal history, and if
+// adapt is set takes an LMS step on the envelope error
+static void eq_train(MSKModemEq* eq, const mskmodem_sound_t* x, int adapt)
+{
+  float si = 0, sq = 0, yi = 0, yq = 0, p = 0, m, e, g;
+  const float* zi, *zq;
+  int j, k, d = eq->spacing;
+
+  for (j=0; j<eq->band_taps; j++) {
+    si += eq->band_i[j] * x[-j];
+    sq += eq->band_q[j] * x[-j];
+  }
+  eq->zpos = (eq->zpos + 1) % eq->span;
+  eq->zi[eq->zpos] = eq->zi[eq->zpos+eq->span] = si;
+  eq->zq[eq->zpos] = eq->zq[eq->zpos+eq->span] = sq;
+  if (!adapt)
+    return;
+
+  // Newest first, as the taps are
+  zi = eq->zi + eq->zpos + eq->span;
+  zq = eq->zq + eq->zpos + eq->span;
+  for (k=0; k<MSKMODEM_EQ_TAPS; k++) {
+    yi += eq->w[k] * zi[-k*d];
+    yq += eq->w[k] * zq[-k*d];
+    p += zi[-k*d]*zi[-k*d] + zq[-k*d]*zq[-k*d];
+  }
+
+  // The target is the input's envelope, smoothed over a few bits
+  m = zi[-EQ_CENTRE*d]*zi[-EQ_CENTRE*d] + zq[-EQ_CENTRE*d]*zq[-EQ_CENTRE*d];
+  if (eq->target < 0)
+    eq->target = m;
+  else
+    eq->target += (m - eq->target) * eq->smooth;
+  if (eq->target < EQ_LEVEL_MIN * MSKMODEM_SOUND_FULLSCALE *
+                    MSKMODEM_SOUND_FULLSCALE || p <= 0)
+    return;
+
+  // Normalised step down the gradient of (|y|^2 - target)^2
+  e = yi*yi + yq*yq - eq->target;
+  g = (eq->mode == MSKMODEM_EQ_CONTINUOUS ? EQ_MU_SLOW : EQ_MU) * e /
+      (eq->target * p);
+  for (k=0; k<MSKMODEM_EQ_TAPS; k++)
+    eq->w[k] -= g * (yi*zi[-k*d] + yq*zq[-k*d]) +
+                EQ_LEAK * (eq->w[k] - (k == EQ_CENTRE));
+
+  eq->err_sum += (e / eq->target) * (e / eq->target);
+  eq->err_count++;
+}
+
+void
+mskmodem_eq_process
+(
+  MSKModemEq* eq,
+  const mskmodem_sound_t* in,
+  mskmodem_sound_t* out,
+  int samples
+)
+{
+  const mskmodem_sound_t* x;
+  int p, n, i, k;
+
+  for (p=0; p<samples; p+=n) {
+
+    n = MIN(samples-p, EQ_BLOCK);
+    memcpy(eq->hist+EQ_HIST, in+p, n*sizeof(*in));
+
+    // Training, over the block before it is filtered. The analytic signal
+    // history is filled in for a span first.
+    for (i=0; i<n && (eq->skip || eq->train); i++) {
+      if (eq->skip) {
+        if (eq->skip-- <= eq->span)
+          eq_train(eq, eq->hist+EQ_HIST+i, 0);
+        continue;
+      }
+      eq_train(eq, eq->hist+EQ_HIST+i, 1);
+      if (--eq->train == 0) {
+        if (eq->err_count)
+          eq->dispersion = sqrt(eq->err_sum / eq->err_count);
+        eq->err_sum = 0;
+        eq->err_count = 0;
+        eq->trainings++;
+        if (eq->mode == MSKMODEM_EQ_CONTINUOUS)
+          eq->train = eq->train_len;
+      }
+    }
+    if (i)
+      eq_taps(eq);
+
+    // FIR, vectorised across the block's outputs
+    x = eq->hist + EQ_HIST - (eq->span-1);
+    for (i=0; i<n; i++)
+      eq->acc[i] = 0;
+    for (k=0; k<MSKMODEM_EQ_TAPS; k++) {
+#ifdef MSKMODEM_FIXED_POINT
+      const eq_acc_t w = eq->wq[k];
+#else
+      const eq_acc_t w = eq->w[k];
+#endif
+      const mskmodem_sound_t* xk = x + eq->span-1 - k*eq->spacing;
+      for (i=0; i<n; i++)
+        eq->acc[i] += w * xk[i];
+    }
+    for (i=0; i<n; i++)
+      out[p+i] = EQ_OUT(eq->acc[i]);
+
+    memmove(eq->hist, eq->hist+n, EQ_HIST*sizeof(*eq->hist));
+  }
+}
+
+// Gain of the taps at a frequency, dB
+static float eq_gain(MSKModemEq* eq, const float* w, double f)
+{
+  double re = 0, im = 0, a;
+  int k;
+
+  for (k=0; k<MSKMODEM_EQ_TAPS; k++) {
+    a = 2.0*G_PI*f*k*eq->spacing/eq->rate;
+    re += w[k]*cos(a);
+    im -= w[k]*sin(a);
+  }
+  return 10.0*log10(re*re + im*im + 1e-12);
+}
+
+void
+mskmodem_eq_state
+(
+  MSKModemEq* eq,
+  MSKModemEqState* state
+)
+{
+  memset(state, 0, sizeof(*state));
+  state->mode = eq->mode;
+  memcpy(state->taps, eq->w, sizeof(state->taps));
+  state->gain1200 = eq_gain(eq, state->taps, 1200);
+  state->gain1800 = eq_gain(eq, state->taps, 1800);
+  state->training = eq->train > 0;
+  state->trainings = eq->trainings;
+  state->dispersion = eq->dispersion;
+}
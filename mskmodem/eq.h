@@ -0,0 +1,91 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MSKMODEM_EQ_H
+#define MSKMODEM_EQ_H
+
+#include "mskmodem.h"
+
+// Adaptive receive equaliser: a MSKMODEM_EQ_TAPS tap FIR with taps about
+// 1/12000s apart (every fourth sample at 48kHz), starting as a pure delay
+// of half its span.
+//
+// It is trained blind, by the constant modulus algorithm: MSK has a
+// constant envelope, and twist or group delay ripple across the two tones
+// is what gives the received one its ripple. While training, the input is
+// also run through an analytic (complex) 900-2100Hz band pass so the
+// envelope of the equaliser's output can be had without demodulating, and
+// the taps take a normalised LMS step against the envelope error each
+// sample. Otherwise the taps are frozen and only the FIR runs.
+
+struct MSKModemEq_s;
+typedef struct MSKModemEq_s MSKModemEq;
+
+MSKModemEq*
+mskmodem_eq_new
+(
+  int rate
+);
+
+void
+mskmodem_eq_free
+(
+  MSKModemEq** ppEq
+);
+
+// Back to a pure delay, and trains as mode says
+void
+mskmodem_eq_reset
+(
+  MSKModemEq* eq,
+  MSKModemEqMode mode
+);
+
+// Carrier has come on, the burst starting skip samples from now, or gone
+// off. Training stops without carrier, and starts again skip samples on.
+// In MSKMODEM_EQ_BURST mode the taps are reset and trained on the first
+// samples of the burst; in MSKMODEM_EQ_CONTINUOUS, on all of it.
+void
+mskmodem_eq_carrier
+(
+  MSKModemEq* eq,
+  int on,
+  int skip
+);
+
+// Equalises samples from in to out. in and out may be the same buffer.
+void
+mskmodem_eq_process
+(
+  MSKModemEq* eq,
+  const mskmodem_sound_t* in,
+  mskmodem_sound_t* out,
+  int samples
+);
+
+// Copy of the state, read without locking: taps may be from two steps of
+// training.
+void
+mskmodem_eq_state
+(
+  MSKModemEq* eq,
+  MSKModemEqState* state
+);
+
+#endif /* MSKMODEM_EQ_H */
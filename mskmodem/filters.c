@@ -0,0 +1,145 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+* 
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "filters.h"
+
+// Receive band pass, 900-2100Hz at 48kHz
+const float fir900to2100[FIR900TO2100_TAPS] = {
+  0.0003829,0.0000483,-0.0003554,-0.0009058,
+  -0.0016643,-0.0026639,-0.0038995,-0.0053223,-0.0068404,-0.0083243,-0.0096175,
+  -0.0105523,-0.0109671,-0.0107252,-0.0097326,-0.0079517,-0.0054107,-0.0022065,
+  0.0014986,0.0054883,0.0095081,0.0132861,0.0165563,0.0190822,0.0206773,
+  0.0212227,0.0206773,0.0190822,0.0165563,0.0132861,0.0095081,0.0054883,
+  0.0014986,-0.0022065,-0.0054107,-0.0079517,-0.0097326,-0.0107252,-0.0109671,
+  -0.0105523,-0.0096175,-0.0083243,-0.0068404,-0.0053223,-0.0038995,-0.0026639,
+  -0.0016643,-0.0009058,-0.0003554,0.0000483,0.0003829
+};
+
+// Discriminator low pass, 600Hz at 48kHz
+const float fir600[FIR600_TAPS] = {
+  0.0015393,0.0017254,0.0020791,0.0026251,
+  0.0033837,0.0043697,0.0055914,0.0070505,0.0087412,0.0106507,0.0127585,
+  0.0150375,0.017454,0.0199689,0.022538,0.0251141,0.0276471,0.0300864,
+  0.0323815,0.0344841,0.0363486,0.0379345,0.0392064,0.040136,0.0407023,
+  0.0408925,0.0407023,0.040136,0.0392064,0.0379345,0.0363486,0.0344841,
+  0.0323815,0.0300864,0.0276471,0.0251141,0.022538,0.0199689,0.017454,
+  0.0150375,0.0127585,0.0106507,0.0087412,0.0070505,0.0055914,0.0043697,
+  0.0033837,0.0026251,0.0020791,0.0017254,0.0015393
+};
+
+int
+mskmodem_filter_taps
+(
+  int taps,
+  int rate,
+  int rate_ref
+)
+{
+  return 2*(int)lrint((double)(taps/2) * rate / rate_ref) + 1;
+}
+
+void
+mskmodem_filter_lowpass
+(
+  float* coeff,
+  int taps,
+  double fc,
+  int rate
+)
+{
+  double h[FILTER_TAPS_MAX], sum = 0, x;
+  int n;
+
+  // Made symmetric exactly, as the FIR needs
+  for (n=0; n<=taps/2; n++) {
+    x = 2.0*G_PI*fc/rate*(n - taps/2);
+    h[n] = (x == 0 ? 1.0 : sin(x)/x) *
+           (0.54 - 0.46*cos(2.0*G_PI*n/(taps-1)));
+    h[taps-1-n] = h[n];
+  }
+  for (n=0; n<taps; n++)
+    sum += h[n];
+  for (n=0; n<taps; n++)
+    coeff[n] = h[n] / sum;
+}
+
+void
+mskmodem_filter_bandpass
+(
+  float* coeff,
+  int taps,
+  double f1,
+  double f2,
+  int rate
+)
+{
+  double h[FILTER_TAPS_MAX], gain = 0, w = G_PI*(f1+f2)/rate;
+  int n;
+
+  // Low pass of half the width, moved up to the centre
+  mskmodem_filter_lowpass(coeff, taps, (f2-f1)/2, rate);
+  for (n=0; n<=taps/2; n++) {
+    h[n] = h[taps-1-n] = 2.0*coeff[n]*cos(w*(n - taps/2));
+    gain += (n == taps/2 ? 1 : 2) * h[n]*cos(w*(n - taps/2));
+  }
+  for (n=0; n<taps; n++)
+    coeff[n] = h[n] / gain;
+}
+
+int
+mskmodem_filter_rx_bandpass
+(
+  int rate,
+  float* coeff
+)
+{
+  int taps;
+
+  if (rate == 48000) {
+    memcpy(coeff, fir900to2100, sizeof(fir900to2100));
+    return FIR900TO2100_TAPS;
+  }
+
+  taps = mskmodem_filter_taps(FIR900TO2100_TAPS, rate, 48000);
+  mskmodem_filter_bandpass(coeff, taps, 900, 2100, rate);
+  return taps;
+}
+
+int
+mskmodem_filter_rx_lowpass
+(
+  int rate,
+  float* coeff
+)
+{
+  int taps;
+
+  if (rate == 48000) {
+    memcpy(coeff, fir600, sizeof(fir600));
+    return FIR600_TAPS;
+  }
+
+  taps = mskmodem_filter_taps(FIR600_TAPS, rate, 48000);
+  mskmodem_filter_lowpass(coeff, taps, 600, rate);
+  return taps;
+}
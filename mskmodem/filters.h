@@ -0,0 +1,84 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+* 
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MSKMODEM_FILTERS_H
+#define MSKMODEM_FILTERS_H
+
+#include "mskmodem.h"
+
+// Filter coefficients shared by the demodulators, at 48kHz
+
+#define FIR900TO2100_TAPS 51
+extern const float fir900to2100[FIR900TO2100_TAPS];
+
+#define FIR600_TAPS 51
+extern const float fir600[FIR600_TAPS];
+
+// Most taps of the receive filters at any rate
+#define FILTER_TAPS_MAX (FIR600_TAPS*MSKMODEM_RATE_MAX/48000 + 1)
+
+// Odd number of taps at rate for a filter of taps taps at rate_ref: the
+// same length in time
+int
+mskmodem_filter_taps
+(
+  int taps,
+  int rate,
+  int rate_ref
+);
+
+// Hamming windowed sinc designs. The low pass has unity gain at DC, the
+// band pass at its centre.
+void
+mskmodem_filter_lowpass
+(
+  float* coeff,
+  int taps,
+  double fc,
+  int rate
+);
+
+void
+mskmodem_filter_bandpass
+(
+  float* coeff,
+  int taps,
+  double f1,
+  double f2,
+  int rate
+);
+
+// The receive band pass (900-2100Hz) and discriminator low pass (600Hz)
+// for a rate, written to coeff. At 48kHz these are the tables; elsewhere
+// they're designed, the same length in time. Returns the number of taps.
+int
+mskmodem_filter_rx_bandpass
+(
+  int rate,
+  float* coeff
+);
+
+int
+mskmodem_filter_rx_lowpass
+(
+  int rate,
+  float* coeff
+);
+
+#endif /* MSKMODEM_FILTERS_H */
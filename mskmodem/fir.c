@@ -0,0 +1,385 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "fir.h"
+
+#ifdef MSKMODEM_FIXED_POINT
+
+#include "q15.h"
+
+// Q15 coefficients, accumulated in 32 bits then rounded and saturated
+typedef gint16 fir_coeff_t;
+typedef gint32 fir_acc_t;
+#define FIR_COEFF(c) q15_from_float(c)
+#define FIR_OUT(s)   q15_sat(((s) + (1<<14)) >> 15)
+
+#else
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FIR_X86 1
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FIR_NEON 1
+#endif
+
+typedef float fir_coeff_t;
+typedef float fir_acc_t;
+#define FIR_COEFF(c) (c)
+#define FIR_OUT(s)   (s)
+
+#endif /* MSKMODEM_FIXED_POINT */
+
+// Samples filtered per kernel call. Larger inputs are split into blocks of
+// this size so the history buffer never needs to grow on the audio thread.
+#define FIR_BLOCK 256
+
+// Kernel: y[j] = c[half]*x[j+half] + sum(k<half) c[k]*(x[j+k]+x[j+2*half-k])
+//
+// The per-output operation order above is shared by all kernels. This file
+// must be built without floating point contraction (see CMakeLists.txt) so
+// the compiler doesn't fuse the scalar multiply-adds differently.
+typedef void (*fir_kernel_fn)(const mskmodem_sound_t* x,
+                              const fir_coeff_t* c, int half,
+                              mskmodem_sound_t* y, int n);
+
+struct MSKModemFir_s {
+  int taps;
+  int half;
+  fir_coeff_t* coeff;     // Folded coefficients, half+1 entries
+  mskmodem_sound_t* hist; // taps-1 samples of history then FIR_BLOCK samples
+  int decim;    // Decimation factor
+  int dphase;   // Input samples to skip before the next decimated output
+};
+
+static void fir_scalar(const mskmodem_sound_t* x, const fir_coeff_t* c,
+                       int half, mskmodem_sound_t* y, int n)
+{
+  int j, k;
+  for (j=0; j<n; j++) {
+    const mskmodem_sound_t* w = x + j;
+    fir_acc_t s = (fir_acc_t)c[half] * w[half];
+    for (k=0; k<half; k++)
+      s += (fir_acc_t)c[k] * ((fir_acc_t)w[k] + w[2*half-k]);
+    y[j] = FIR_OUT(s);
+  }
+}
+
+#ifdef MSKMODEM_FIXED_POINT
+
+// Eight outputs at a time with GCC vector extensions, so the same code maps
+// onto NEON on ARM boards and SSE/AVX2 on x86.
+typedef gint16 fir_v16 __attribute__((vector_size(16)));
+typedef gint32 fir_v32 __attribute__((vector_size(32), aligned(16)));
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define FIR_TARGETS __attribute__((target_clones("avx2","default")))
+#else
+#define FIR_TARGETS
+#endif
+
+// Widens 8 samples to 32 bits
+static inline __attribute__((always_inline))
+void fir_load(fir_v32* v, const gint16* p)
+{
+  fir_v16 t;
+  memcpy(&t, p, sizeof(t));
+  *v = __builtin_convertvector(t, fir_v32);
+}
+
+FIR_TARGETS
+static void fir_vector(const gint16* x, const gint16* c, int half,
+                       gint16* y, int n)
+{
+  int j = 0, k;
+  fir_v32 s, a, b;
+  for (; j+8<=n; j+=8) {
+    const gint16* w = x + j;
+    fir_load(&a, w+half);
+    s = c[half] * a;
+    for (k=0; k<half; k++) {
+      fir_load(&a, w+k);
+      fir_load(&b, w+2*half-k);
+      s += c[k] * (a + b);
+    }
+    for (k=0; k<8; k++)
+      y[j+k] = FIR_OUT(s[k]);
+  }
+  fir_scalar(x+j, c, half, y+j, n-j);
+}
+
+#endif /* MSKMODEM_FIXED_POINT */
+
+#ifdef FIR_X86
+
+__attribute__((target("sse2")))
+static void fir_sse2(const float* x, const float* c, int half,
+                     float* y, int n)
+{
+  int j = 0, k;
+  for (; j+4<=n; j+=4) {
+    const float* w = x + j;
+    __m128 s = _mm_mul_ps(_mm_set1_ps(c[half]), _mm_loadu_ps(w+half));
+    for (k=0; k<half; k++) {
+      __m128 p = _mm_add_ps(_mm_loadu_ps(w+k), _mm_loadu_ps(w+2*half-k));
+      s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(c[k]), p));
+    }
+    _mm_storeu_ps(y+j, s);
+  }
+  fir_scalar(x+j, c, half, y+j, n-j);
+}
+
+__attribute__((target("avx2")))
+static void fir_avx2(const float* x, const float* c, int half,
+                     float* y, int n)
+{
+  int j = 0, k;
+  for (; j+8<=n; j+=8) {
+    const float* w = x + j;
+    __m256 s = _mm256_mul_ps(_mm256_set1_ps(c[half]),
+                             _mm256_loadu_ps(w+half));
+    for (k=0; k<half; k++) {
+      __m256 p = _mm256_add_ps(_mm256_loadu_ps(w+k),
+                               _mm256_loadu_ps(w+2*half-k));
+      s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_set1_ps(c[k]), p));
+    }
+    _mm256_storeu_ps(y+j, s);
+  }
+  fir_sse2(x+j, c, half, y+j, n-j);
+}
+
+#endif /* FIR_X86 */
+
+#ifdef FIR_NEON
+
+static void fir_neon(const float* x, const float* c, int half,
+                     float* y, int n)
+{
+  int j = 0, k;
+  for (; j+4<=n; j+=4) {
+    const float* w = x + j;
+    // Separate multiply and add: vmlaq/vfmaq would change the rounding
+    float32x4_t s = vmulq_f32(vdupq_n_f32(c[half]), vld1q_f32(w+half));
+    for (k=0; k<half; k++) {
+      float32x4_t p = vaddq_f32(vld1q_f32(w+k), vld1q_f32(w+2*half-k));
+      s = vaddq_f32(s, vmulq_f32(vdupq_n_f32(c[k]), p));
+    }
+    vst1q_f32(y+j, s);
+  }
+  fir_scalar(x+j, c, half, y+j, n-j);
+}
+
+#endif /* FIR_NEON */
+
+typedef struct {
+  const char* name;
+  fir_kernel_fn fn;
+} FirKernel;
+
+static const FirKernel fir_kernels[] = {
+#ifdef MSKMODEM_FIXED_POINT
+  { "vector", fir_vector },
+#endif
+#ifdef FIR_X86
+  { "avx2", fir_avx2 },
+  { "sse2", fir_sse2 },
+#endif
+#ifdef FIR_NEON
+  { "neon", fir_neon },
+#endif
+  { "scalar", fir_scalar },
+  { NULL, NULL }
+};
+
+static int fir_kernel_supported(const char* name)
+{
+#ifdef FIR_X86
+  if (!strcmp(name, "avx2"))
+    return __builtin_cpu_supports("avx2");
+  if (!strcmp(name, "sse2"))
+    return __builtin_cpu_supports("sse2");
+#endif
+  return 1;
+}
+
+// Picks the best kernel for this CPU once. MSKMODEM_FIR_KERNEL can force a
+// particular (supported) kernel, e.g. "scalar" for comparisons.
+static gpointer fir_select(gpointer data)
+{
+  const char* force = getenv("MSKMODEM_FIR_KERNEL");
+  int n;
+
+#ifdef FIR_X86
+  __builtin_cpu_init();
+#endif
+
+  for (n=0; fir_kernels[n].name; n++) {
+    if (force && strcmp(force, fir_kernels[n].name))
+      continue;
+    if (fir_kernel_supported(fir_kernels[n].name))
+      return (gpointer)&fir_kernels[n];
+  }
+
+  // Forced kernel unavailable: fall back to the scalar one
+  return (gpointer)&fir_kernels[n-1];
+}
+
+static const FirKernel* fir_selected(void)
+{
+  static GOnce once = G_ONCE_INIT;
+  return g_once(&once, fir_select, NULL);
+}
+
+MSKModemFir*
+mskmodem_fir_new
+(
+  const float* coeff,
+  int taps
+)
+{
+  MSKModemFir* fir;
+  int n;
+
+  // Only odd length, symmetric filters can be folded
+  for (n=0; n<taps/2; n++)
+    if (coeff[n] != coeff[taps-1-n])
+      return NULL;
+  if (!(taps & 1))
+    return NULL;
+
+  fir = g_new0(MSKModemFir, 1);
+  fir->taps = taps;
+  fir->half = taps/2;
+  fir->coeff = g_new(fir_coeff_t, fir->half+1);
+  for (n=0; n<=fir->half; n++)
+    fir->coeff[n] = FIR_COEFF(coeff[n]);
+  fir->hist = g_new0(mskmodem_sound_t, taps-1+FIR_BLOCK);
+  fir->decim = 1;
+
+  fir_selected();
+
+  return fir;
+}
+
+MSKModemFir*
+mskmodem_fir_new_decimating
+(
+  const float* coeff,
+  int taps,
+  int factor
+)
+{
+  MSKModemFir* fir = mskmodem_fir_new(coeff, taps);
+  if (fir)
+    fir->decim = MAX(factor, 1);
+  return fir;
+}
+
+void
+mskmodem_fir_free
+(
+  MSKModemFir** ppFir
+)
+{
+  if (ppFir && *ppFir)
+  {
+    MSKModemFir* fir = *ppFir;
+    g_free(fir->coeff);
+    g_free(fir->hist);
+    g_free(fir);
+    *ppFir = NULL;
+  }
+}
+
+void
+mskmodem_fir_reset
+(
+  MSKModemFir* fir
+)
+{
+  memset(fir->hist, 0, (fir->taps-1)*sizeof(*fir->hist));
+  fir->dphase = 0;
+}
+
+void
+mskmodem_fir_process
+(
+  MSKModemFir* fir,
+  const mskmodem_sound_t* in,
+  mskmodem_sound_t* out,
+  int samples
+)
+{
+  fir_kernel_fn kernel = fir_selected()->fn;
+  int hlen = fir->taps-1;
+  int p, n;
+
+  for (p=0; p<samples; p+=n) {
+    n = MIN(samples-p, FIR_BLOCK);
+
+    // New samples go straight after the history so the kernel never wraps
+    memcpy(fir->hist+hlen, in+p, n*sizeof(*in));
+    kernel(fir->hist, fir->coeff, fir->half, out+p, n);
+    memmove(fir->hist, fir->hist+n, hlen*sizeof(*in));
+  }
+}
+
+int
+mskmodem_fir_decimate
+(
+  MSKModemFir* fir,
+  const mskmodem_sound_t* in,
+  mskmodem_sound_t* out,
+  int samples
+)
+{
+  int hlen = fir->taps-1;
+  int p, n, j, o = 0;
+
+  for (p=0; p<samples; p+=n) {
+    n = MIN(samples-p, FIR_BLOCK);
+
+    memcpy(fir->hist+hlen, in+p, n*sizeof(*in));
+
+    // Outputs are sparse so there is nothing to vectorise across; the
+    // scalar kernel keeps the results identical to the full rate filter.
+    for (j=fir->dphase; j<n; j+=fir->decim)
+      fir_scalar(fir->hist+j, fir->coeff, fir->half, out+o++, 1);
+    fir->dphase = j - n;
+
+    memmove(fir->hist, fir->hist+n, hlen*sizeof(*in));
+  }
+
+  return o;
+}
+
+const char*
+mskmodem_fir_kernel
+(
+  void
+)
+{
+  return fir_selected()->name;
+}
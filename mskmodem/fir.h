@@ -0,0 +1,96 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MSKMODEM_FIR_H
+#define MSKMODEM_FIR_H
+
+#include "mskmodem.h"
+
+// Block FIR filter for symmetric (linear phase), odd length coefficient sets.
+//
+// History is kept contiguous in front of each block so the kernels never
+// wrap, and mirrored taps are folded so each output costs (taps+1)/2
+// multiplies. Kernels vectorise across output samples so every output is
+// accumulated in the same order whichever kernel runs: the SIMD and scalar
+// paths give bit-identical results.
+//
+// Samples are mskmodem_sound_t: in the fixed point build the coefficients
+// are rounded to Q15 and outputs are accumulated in 32 bits and saturated.
+
+struct MSKModemFir_s;
+typedef struct MSKModemFir_s MSKModemFir;
+
+MSKModemFir*
+mskmodem_fir_new
+(
+  const float* coeff,
+  int taps
+);
+
+// Decimating form: only every factor'th output is computed (the polyphase
+// decomposition of the same filter), keeping the symmetric fold.
+MSKModemFir*
+mskmodem_fir_new_decimating
+(
+  const float* coeff,
+  int taps,
+  int factor
+);
+
+void
+mskmodem_fir_free
+(
+  MSKModemFir** ppFir
+);
+
+void
+mskmodem_fir_reset
+(
+  MSKModemFir* fir
+);
+
+// Filter samples from in to out. in and out may be the same buffer.
+void
+mskmodem_fir_process
+(
+  MSKModemFir* fir,
+  const mskmodem_sound_t* in,
+  mskmodem_sound_t* out,
+  int samples
+);
+
+// Filter and decimate. Returns the number of samples written to out, at
+// most samples/factor+1. in and out may be the same buffer.
+int
+mskmodem_fir_decimate
+(
+  MSKModemFir* fir,
+  const mskmodem_sound_t* in,
+  mskmodem_sound_t* out,
+  int samples
+);
+
+// Name of the kernel selected for this CPU
+const char*
+mskmodem_fir_kernel
+(
+  void
+);
+
+#endif /* MSKMODEM_FIR_H */
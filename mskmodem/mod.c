@@ -0,0 +1,502 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "mod.h"
+#include "q15.h"
+
+#define MOD_RAMP 0.25 // Half width of a shaped frequency change (bits)
+
+// Clocked mode: the phase through a bit, by key, at MOD_GRID points
+#define MOD_GRID_BITS 6
+#define MOD_GRID (1 << MOD_GRID_BITS)
+
+// Bit key: previous, this and next bit
+#define MOD_KEY(p, c, n) ((p)<<2 | (c)<<1 | (n))
+
+// Bit n of a codeword, sent first to last from the top
+#define MOD_CW_BIT(cw, n) ((int)((cw) >> (63-(n))) & 1)
+
+// Waveform cache. Bits 1-62 of a codeword only depend on the codeword and
+// the start phase (the first and last bits also depend on their
+// neighbours when shaped), so that span is cached and replayed.
+#define MOD_CACHE_SLOTS 16
+
+typedef struct {
+  guint64 cw;
+  int start;     // Start phase of bit 1
+  int end;       // Start phase of bit 63
+  int valid;
+  int pinned;    // Prefilled, never replaced
+  int ref;       // Used since the clock hand last passed
+  mskmodem_sound_t* wave; // 62 bits
+} ModCacheSlot;
+
+struct MSKModemMod_s {
+  MSKModemTxMode mode;
+  int bitlen;       // Samples per bit...
+  int clocked;      // ...or not a whole number: run on the bit clock
+
+  // Codeword state
+  guint64 current;
+  guint64 next;     // Following codeword when fetched early for shaping
+  int have_next;
+  int bit;          // Next bit of current to send, 64 for a new codeword
+  int last;         // Last bit sent
+  int silent;       // Last codeword was silence
+  gboolean lookahead; // Next bit is needed (shaping)
+
+  // Piece (bit, or cached span) being sent
+  const mskmodem_sound_t* play; // Cached span, NULL for a bit
+  int len;          // Samples in it
+  int pos;          // Samples of it sent
+  int start;        // Its start phase, in half cycles
+  int end;          // Start phase after it
+  int key;          // MOD_KEY of a bit
+
+  // Table mode: waveform by start phase and bit key, bitlen samples each
+  mskmodem_sound_t* seg;
+
+  // NCO mode: 2^32 is a cycle
+  guint32 pacc;
+  guint32* step;            // Phase step per sample by bit key
+  guint32 anchor[4];        // Start phase offset by previous and this bit
+  mskmodem_sound_t level;
+
+  // Clocked mode: 2^32 is a bit
+  guint64 clk;              // Position in the bit of the last sample
+  guint32 clk_step;         // ...and its step per sample
+  guint32 grid[8][MOD_GRID+1]; // Phase from the start phase by bit key
+
+  // Waveform cache
+  ModCacheSlot cache[MOD_CACHE_SLOTS];
+  int hand;         // Clock hand for replacement
+  guint32 hits;
+  guint32 misses;
+};
+
+// Area under the raised cosine ramp (1+sin(pi*x/2))/2 from -1 to x
+static double mod_ramp_area(double x)
+{
+  x = CLAMP(x, -1.0, 1.0);
+  return (x+1.0)/2 - cos(G_PI*x/2)/G_PI;
+}
+
+// Cycles from an unshaped bit's start phase to t samples into a bit of
+// len samples. Frequencies are in cycles per bit. Shaped, the frequency
+// eases from fp over the first MOD_RAMP of the bit and towards fn over the
+// last MOD_RAMP; the edge phase moves by the same amount either side so
+// bits still start at 0 or half a cycle apart from that offset.
+static double mod_phase(double fp, double fc, double fn, double t,
+                        double len, MSKModemShape shape)
+{
+  double w = len*MOD_RAMP;
+  double m = MIN(t, w);
+  double ph = fc * (t/len);
+
+  if (shape == MSKMODEM_SHAPE_COSINE) {
+    ph += ((fc-fp) * w * mod_ramp_area(0) +
+           (fp-fc) * (m - w * (mod_ramp_area(m/w) - mod_ramp_area(0))) +
+           (fn-fc) * w * mod_ramp_area((t-len)/w)) / len;
+  }
+
+  return ph;
+}
+
+static guint32 mod_cycles(double c)
+{
+  return (guint32)(gint64)llround(ldexp(c - floor(c), 32));
+}
+
+static void mod_tables(MSKModemMod* m, int rate, MSKModemShape shape,
+                       float level)
+{
+  static const double f[2] = { 1.5, 1.0 }; // Bit 0 is 1800Hz, 1 is 1200Hz
+  double fp, fc, fn, v, len = rate/1200.0;
+  int s, k, t;
+
+  for (k=0; k<8; k++) {
+    fp = f[k>>2 & 1];
+    fc = f[k>>1 & 1];
+    fn = f[k & 1];
+
+    // Sample t is the phase at t+1 samples into the bit
+    for (t=0; t<m->bitlen; t++) {
+      for (s=0; s<2; s++) {
+        v = level * MSKMODEM_SOUND_FULLSCALE *
+            sin(2.0*G_PI*(mod_phase(fp, fc, fn, t+1, len, shape) + s*0.5));
+#ifdef MSKMODEM_FIXED_POINT
+        m->seg[((s*8)+k)*m->bitlen + t] = lrint(v);
+#else
+        m->seg[((s*8)+k)*m->bitlen + t] = v;
+#endif
+      }
+      m->step[k*m->bitlen + t] =
+        mod_cycles(mod_phase(fp, fc, fn, t+1, len, shape) -
+                   mod_phase(fp, fc, fn, t, len, shape));
+    }
+
+    for (t=0; t<=MOD_GRID; t++)
+      m->grid[k][t] = mod_cycles(mod_phase(fp, fc, fn, t*len/MOD_GRID, len,
+                                           shape));
+
+    if (!(k & 1))
+      m->anchor[k>>1] = mod_cycles(mod_phase(fp, fc, fn, 0, len, shape));
+  }
+
+  m->level = level * MSKMODEM_SOUND_FULLSCALE;
+  m->lookahead = shape != MSKMODEM_SHAPE_NONE;
+}
+
+// Renders n samples of a bit from sample pos on. pacc is the NCO phase,
+// anchored at the bit start.
+static void mod_render(MSKModemMod* m, int start, int key, int pos,
+                       guint32* pacc, mskmodem_sound_t* out, int n)
+{
+  const guint32* step;
+  int j;
+
+  if (m->mode == MSKMODEM_TX_NCO) {
+    step = m->step + key*m->bitlen + pos;
+    for (j=0; j<n; j++) {
+      *pacc += step[j];
+#ifdef MSKMODEM_FIXED_POINT
+      out[j] = (mskmodem_q15_sin(*pacc) * m->level + (1<<14)) >> 15;
+#else
+      out[j] = mskmodem_q15_sin(*pacc) * (m->level * (1.0f/32767));
+#endif
+    }
+  }
+  else
+    memcpy(out, m->seg + ((start*8)+key)*m->bitlen + pos, n*sizeof(*out));
+}
+
+// Start phase of the NCO for a bit
+static guint32 mod_anchor(MSKModemMod* m, int start, int key)
+{
+  return ((guint32)start << 31) + m->anchor[key >> 1];
+}
+
+// Renders bits 1-62 of a codeword into a cache slot
+static void mod_cache_fill(MSKModemMod* m, ModCacheSlot* slot, guint64 cw,
+                           int start)
+{
+  guint32 pacc;
+  int s = start, k, n;
+
+  for (n=1; n<63; n++) {
+    k = MOD_KEY(MOD_CW_BIT(cw, n-1), MOD_CW_BIT(cw, n), MOD_CW_BIT(cw, n+1));
+    pacc = mod_anchor(m, s, k);
+    mod_render(m, s, k, 0, &pacc, slot->wave + (n-1)*m->bitlen, m->bitlen);
+    s ^= !MOD_CW_BIT(cw, n);
+  }
+
+  slot->cw = cw;
+  slot->start = start;
+  slot->end = s;
+  slot->valid = 1;
+  slot->ref = 1;
+}
+
+static ModCacheSlot* mod_cache_find(MSKModemMod* m, guint64 cw, int start)
+{
+  int n;
+
+  for (n=0; n<MOD_CACHE_SLOTS; n++)
+    if (m->cache[n].valid && m->cache[n].cw == cw &&
+        m->cache[n].start == start)
+      return &m->cache[n];
+
+  return NULL;
+}
+
+// Slot to replace: the first unpinned one not used since the hand last
+// passed. Prefill pins at most half the slots so there always is one.
+static ModCacheSlot* mod_cache_victim(MSKModemMod* m)
+{
+  ModCacheSlot* slot;
+
+  for (;;) {
+    slot = &m->cache[m->hand];
+    m->hand = (m->hand + 1) % MOD_CACHE_SLOTS;
+    if (slot->pinned)
+      continue;
+    if (!slot->valid || !slot->ref)
+      return slot;
+    slot->ref = 0;
+  }
+}
+
+static ModCacheSlot* mod_cache_get(MSKModemMod* m, guint64 cw, int start)
+{
+  ModCacheSlot* slot = mod_cache_find(m, cw, start);
+
+  if (slot) {
+    slot->ref = 1;
+    m->hits++;
+    return slot;
+  }
+
+  m->misses++;
+  slot = mod_cache_victim(m);
+  mod_cache_fill(m, slot, cw, start);
+  return slot;
+}
+
+MSKModemMod*
+mskmodem_mod_new
+(
+  int rate,
+  MSKModemTxMode mode,
+  MSKModemShape shape,
+  float level
+)
+{
+  MSKModemMod* m;
+  int n;
+
+  if (mode < 0 || mode >= MSKMODEM_TX_COUNT ||
+      shape < 0 || shape >= MSKMODEM_SHAPE_COUNT)
+    return NULL;
+
+  m = g_new0(MSKModemMod, 1);
+  m->mode = mode;
+  m->bit = 64;
+  m->silent = 1;
+
+  if (rate % 1200 == 0) {
+    m->bitlen = rate / 1200;
+    m->seg = g_new(mskmodem_sound_t, 2*8*m->bitlen);
+    m->step = g_new(guint32, 8*m->bitlen);
+    for (n=0; n<MOD_CACHE_SLOTS; n++)
+      m->cache[n].wave = g_new(mskmodem_sound_t, 62*m->bitlen);
+  }
+  else {
+    m->clocked = 1;
+    m->clk = G_GUINT64_CONSTANT(1) << 32;
+    m->clk_step = ((G_GUINT64_CONSTANT(1) << 32) * 1200 + rate/2) / rate;
+  }
+  m->len = m->bitlen;
+
+  mod_tables(m, rate, shape, CLAMP(level, 0.0f, 1.0f));
+
+  return m;
+}
+
+void
+mskmodem_mod_free
+(
+  MSKModemMod** ppMod
+)
+{
+  int n;
+
+  if (ppMod && *ppMod)
+  {
+    MSKModemMod* m = *ppMod;
+    g_free(m->seg);
+    g_free(m->step);
+    for (n=0; n<MOD_CACHE_SLOTS; n++)
+      g_free(m->cache[n].wave);
+    g_free(m);
+    *ppMod = NULL;
+  }
+}
+
+int
+mskmodem_mod_prefill
+(
+  MSKModemMod* m,
+  const guint64* cw,
+  int count
+)
+{
+  ModCacheSlot* slot;
+  int pinned = 0, n, start;
+
+  // Nothing to cache on the bit clock
+  if (m->clocked)
+    return 0;
+
+  for (n=0; n<MOD_CACHE_SLOTS; n++)
+    pinned += m->cache[n].pinned;
+
+  for (n=0; n<count; n++) {
+    if (!cw[n])
+      continue;
+    for (start=0; start<2; start++) {
+      slot = mod_cache_find(m, cw[n], start);
+      if (!slot) {
+        if (pinned >= MOD_CACHE_SLOTS/2)
+          return 1;
+        slot = mod_cache_victim(m);
+        mod_cache_fill(m, slot, cw[n], start);
+      }
+      if (!slot->pinned)
+        pinned++;
+      slot->pinned = 1;
+    }
+  }
+
+  return 0;
+}
+
+void
+mskmodem_mod_cache_stats
+(
+  MSKModemMod* m,
+  guint32* hits,
+  guint32* misses
+)
+{
+  *hits = m->hits;
+  *misses = m->misses;
+}
+
+// Sets up the next piece: a bit, or bits 1-62 from the cache
+static void mod_next(MSKModemMod* m, MSKModemTxFn tx_f, void* userdata)
+{
+  ModCacheSlot* slot;
+  int p, c, n;
+
+  m->start = m->end;
+  m->pos = 0;
+  m->play = NULL;
+  m->len = m->bitlen;
+
+  // If first bit get new codeword
+  if (m->bit == 64) {
+    m->silent = !m->current;
+    m->current = 0;
+    if (m->have_next)
+      m->current = m->next;
+    else
+      tx_f(&m->current, userdata);
+    m->have_next = 0;
+    m->bit = 0;
+  }
+
+  if (m->bit == 1 && m->current && !m->clocked) {
+    slot = mod_cache_get(m, m->current, m->start);
+    m->play = slot->wave;
+    m->len = 62*m->bitlen;
+    m->end = slot->end;
+    m->last = MOD_CW_BIT(m->current, 62);
+    m->bit = 63;
+    return;
+  }
+
+  // Get bit, and its neighbours for shaping. The one after the last comes
+  // from the next codeword, fetched a bit early. No transitions to or
+  // from silence.
+  c = MOD_CW_BIT(m->current, m->bit);
+  p = m->bit ? m->last : (m->silent ? c : m->last);
+  if (m->bit < 63)
+    n = MOD_CW_BIT(m->current, m->bit+1);
+  else if (m->lookahead) {
+    m->next = 0;
+    tx_f(&m->next, userdata);
+    m->have_next = 1;
+    n = m->next ? MOD_CW_BIT(m->next, 0) : c;
+  }
+  else
+    n = c;
+  if (!m->current)
+    p = n = c;
+
+  m->key = MOD_KEY(p, c, n);
+  m->pacc = mod_anchor(m, m->start, m->key);
+
+  // 1800Hz is one and a half cycles a bit: the next starts opposite
+  m->end = m->start ^ !c;
+  m->last = c;
+  m->bit++;
+}
+
+// Renders n samples on the bit clock, from the sample after the last. The
+// phase through the bit is interpolated from the grid; a sample past the
+// end of the bit starts the next one.
+static void mod_clocked(MSKModemMod* m, mskmodem_sound_t* out, int n,
+                        MSKModemTxFn tx_f, void* userdata)
+{
+  const guint32* g;
+  guint32 x, d;
+  int j, i;
+
+  for (j=0; j<n; j++) {
+    m->clk += m->clk_step;
+    if (m->clk > G_GUINT64_CONSTANT(1) << 32) {
+      m->clk -= G_GUINT64_CONSTANT(1) << 32;
+      mod_next(m, tx_f, userdata);
+    }
+    if (!m->current)
+      continue;
+
+    // Grid point below, and the fraction of the way to the next
+    i = m->clk >> (32-MOD_GRID_BITS);
+    x = (guint32)(m->clk << MOD_GRID_BITS) >> 16;
+    g = m->grid[m->key] + MIN(i, MOD_GRID-1);
+    if (i >= MOD_GRID)
+      x = 1 << 16;
+    d = g[1] - g[0];
+    x = ((guint32)m->start << 31) + g[0] + (guint32)(((guint64)d * x) >> 16);
+#ifdef MSKMODEM_FIXED_POINT
+    out[j] = (mskmodem_q15_sin(x) * m->level + (1<<14)) >> 15;
+#else
+    out[j] = mskmodem_q15_sin(x) * (m->level * (1.0f/32767));
+#endif
+  }
+}
+
+void
+mskmodem_mod_process
+(
+  MSKModemMod* m,
+  mskmodem_sound_t* buf,
+  int samples,
+  MSKModemTxFn tx_f,
+  void* userdata
+)
+{
+  int i, n;
+
+  if (m->clocked) {
+    mod_clocked(m, buf, samples, tx_f, userdata);
+    return;
+  }
+
+  for (i=0; i<samples; i+=n) {
+
+    if (m->pos == m->len)
+      mod_next(m, tx_f, userdata);
+    n = MIN(samples-i, m->len - m->pos);
+
+    if (m->current != 0) {
+      if (m->play)
+        memcpy(buf+i, m->play + m->pos, n*sizeof(*buf));
+      else
+        mod_render(m, m->start, m->key, m->pos, &m->pacc, buf+i, n);
+    }
+
+    m->pos += n;
+  }
+}
@@ -0,0 +1,91 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MSKMODEM_MOD_H
+#define MSKMODEM_MOD_H
+
+#include "mskmodem.h"
+
+// Modulator.
+//
+// A bit is 1 cycle of 1200Hz or 1.5 cycles of 1800Hz, so every bit starts
+// at phase 0 or half a cycle. Where a bit is a whole number of samples (40
+// at 48kHz), each bit's waveform then only depends on its start phase and
+// value (and, when shaped, on the bits either side), so it is built once
+// into a table and copied out per bit. The NCO mode instead runs a phase
+// accumulator through the Q15 sine table, re-anchored at every bit edge so
+// it never drifts.
+//
+// Either way the middle 62 bits of each codeword are rendered once into a
+// small cache keyed by codeword and start phase, and replayed from there:
+// an idle control channel only sends a handful of different codewords.
+//
+// Where a bit isn't a whole number of samples (44.1kHz, say) neither table
+// nor cache can be used: a bit clock steps through each bit, and the phase
+// from its start is interpolated from a table of it through the bit.
+
+struct MSKModemMod_s;
+typedef struct MSKModemMod_s MSKModemMod;
+
+MSKModemMod*
+mskmodem_mod_new
+(
+  int rate,
+  MSKModemTxMode mode,
+  MSKModemShape shape,
+  float level
+);
+
+void
+mskmodem_mod_free
+(
+  MSKModemMod** ppMod
+);
+
+// Renders codewords (with FCS) into the cache and keeps them there for
+// good. At most half the cache can be pinned; returns 1 if it is full.
+int
+mskmodem_mod_prefill
+(
+  MSKModemMod* m,
+  const guint64* cw,
+  int count
+);
+
+void
+mskmodem_mod_cache_stats
+(
+  MSKModemMod* m,
+  guint32* hits,
+  guint32* misses
+);
+
+// Writes samples of modulator output to buf, getting codewords from tx_f.
+// buf is left alone while there is no codeword to send.
+void
+mskmodem_mod_process
+(
+  MSKModemMod* m,
+  mskmodem_sound_t* buf,
+  int samples,
+  MSKModemTxFn tx_f,
+  void* userdata
+);
+
+#endif /* MSKMODEM_MOD_H */
@@ -24,73 +24,143 @@
 #include <math.h>
 
 #include "mskmodem.h"
-
-static const float fir900to2100[] = {
-  0.0003829,0.0000483,-0.0003554,-0.0009058,
-  -0.0016643,-0.0026639,-0.0038995,-0.0053223,-0.0068404,-0.0083243,-0.0096175,
-  -0.0105523,-0.0109671,-0.0107252,-0.0097326,-0.0079517,-0.0054107,-0.0022065,
-  0.0014986,0.0054883,0.0095081,0.0132861,0.0165563,0.0190822,0.0206773,
-  0.0212227,0.0206773,0.0190822,0.0165563,0.0132861,0.0095081,0.0054883,
-  0.0014986,-0.0022065,-0.0054107,-0.0079517,-0.0097326,-0.0107252,-0.0109671,
-  -0.0105523,-0.0096175,-0.0083243,-0.0068404,-0.0053223,-0.0038995,-0.0026639,
-  -0.0016643,-0.0009058,-0.0003554,0.0000483,0.0003829
-};
-
-static const float fir600[] = {
-  0.0015393,0.0017254,0.0020791,0.0026251,
-  0.0033837,0.0043697,0.0055914,0.0070505,0.0087412,0.0106507,0.0127585,
-  0.0150375,0.017454,0.0199689,0.022538,0.0251141,0.0276471,0.0300864,
-  0.0323815,0.0344841,0.0363486,0.0379345,0.0392064,0.040136,0.0407023,
-  0.0408925,0.0407023,0.040136,0.0392064,0.0379345,0.0363486,0.0344841,
-  0.0323815,0.0300864,0.0276471,0.0251141,0.022538,0.0199689,0.017454,
-  0.0150375,0.0127585,0.0106507,0.0087412,0.0070505,0.0055914,0.0043697,
-  0.0033837,0.0026251,0.0020791,0.0017254,0.0015393
-};
-
-static float convolvesum(const float* sig, const float* coeff,
-                         int len, int sigstart)
-{
-
-  int n, p = sigstart;
-  float s = 0;
-  for (n=0; n<len; n++) {
-    s += sig[p] * coeff[n];
-    p = (p==0) ? len-1 : p-1;
-  }
-
-  return s;
-
-}
+#include "filters.h"
+#include "fir.h"
+#include "decim.h"
+#include "batch.h"
+#include "mod.h"
+#include "carrier.h"
+#include "eq.h"
+#include "quality.h"
+#include "q15.h"
+
+// Receive chain is run over blocks of at most this many samples
+#define MSKMODEM_RX_BLOCK 256
+
+// Coherent demodulator: correlator products and running sums, and the
+// tone energies made from them
+#ifdef MSKMODEM_FIXED_POINT
+typedef gint32 coh_acc_t;
+typedef gint64 coh_energy_t;
+#define COH_PRODUCT(x, lo) (((gint32)(x)*(lo)) >> 15)
+#else
+typedef float coh_acc_t;
+typedef float coh_energy_t;
+#define COH_PRODUCT(x, lo) ((x)*(lo))
+#endif
+
+// Bit clocks count Q16 samples, so a bit needn't be a whole number of them
+#define CLK_ONE 65536
+
+// Longest bit in samples, rounded, and the discriminator's delay line
+#define BIT_MAX   (40*MSKMODEM_RATE_MAX/48000)
+#define DISC_MAX  (BIT_MAX/3+3)
+
+// Bit energy for the quality figures: sums of the squares, and of the
+// fourth powers, of the last bit's filtered samples, kept for RXPOW_HIST
+// samples back. The discriminator decides a bit about QUALITY_DELAY_DISC
+// samples (at 48kHz) after it is received.
+#ifdef MSKMODEM_FIXED_POINT
+typedef gint32 rxpow_t;
+typedef gint64 rxpow4_t;
+#define RXPOW_SQUARE(x) (((gint32)(x)*(x)) >> 8)
+#else
+typedef float rxpow_t;
+typedef float rxpow4_t;
+#define RXPOW_SQUARE(x) ((x)*(x))
+#endif
+#define RXPOW_HIST 64
+#define QUALITY_DELAY_DISC 24
+
+#define COH_SLEW 8    // Largest bit timing correction per bit (samples)
+#define COH_FRAC 8    // Bit timing resolution, fractions of a sample
 
 struct MSKModemContext_s {
 
   MSKModemSoundContext* sctx;
 
-  // Modulator variables
-  guint64 current;
-  guint64 bitmask;
-  int phase;
-  float padj;
-  float fs;
+  // Sample rate, and the bit timing it gives
+  int rate;
+  gint32 bitlen;     // Samples per bit, Q16
+  int bitwin;        // ...rounded: correlator and bit energy windows
+  int disc_mst;      // Discriminator monostable, a third of a bit
+  int disc_half;     // ...and a sixth
+  mskmodem_sound_t disc_slice; // Its output midway between the tones
+  int quality_delay; // Samples from a bit to its discriminator decision
+
+  // Modulator
+  MSKModemMod* mod;
+
+  // Demodulator selection
+  MSKModemDemod demod;        // Requested
+  MSKModemDemod demod_active; // Running on the audio thread
 
   // Coh Demodulator variables
-  int curr_sample;
-  float* corr_i0, *corr_q0, *corr_i1, *corr_q1;
-  float sum_i0, sum_q0, sum_i1, sum_q1;
-  int corr;
+  int curr_sample;  // Local oscillator index
+  coh_acc_t* corr_i0, *corr_q0, *corr_i1, *corr_q1; // Products, last bit
+  coh_acc_t sum_i0, sum_q0, sum_i1, sum_q1;
+  int corr;         // Product ring index
   int pll;
-  int nuf_ones;
+  int lo_len;       // Samples for whole cycles of both tones
+  mskmodem_sound_t* lo_i0, *lo_q0; // 1800Hz
+  mskmodem_sound_t* lo_i1, *lo_q1; // 1200Hz
+  int coh_len;      // Bit length in 1/COH_FRAC samples
+  int coh_clk;      // Bit clock, 1/COH_FRAC samples into the bit
+  int coh_last;     // Last tone decision
+  int coh_phase;    // Bit timing estimate, on the bit clock
+  int coh_slot;     // Bit clock the last bit was taken at
+  int coh_count;    // 1/COH_FRAC samples since the last bit
+  int coh_next;     // ...to the next bit
 
   // Incoh Demodulator variables
-  int filterpos;
-  float* initfilter;
-  float last;
+  MSKModemFir* initfilter;
+  mskmodem_sound_t last;
   int discpos;
-  int* discqueue;
-  float* discfilter;
+  int discqueue[DISC_MAX];
+  MSKModemFir* discfilter;
+  mskmodem_sound_t rxfilt[MSKMODEM_RX_BLOCK]; // Initial filter output
+  mskmodem_sound_t rxdisc[MSKMODEM_RX_BLOCK]; // Discriminator output
   int mst;
   int slast;
-  int pll_count;
+  gint32 pll_count; // Bit clock, Q16
+  int pll_early;
+  int pll_late;
+
+  // Multiphase slicer
+  gint32 mp_clk; // Bit clock, Q16
+  int mp_path;   // Next phase to slice
+
+  // Receive quality, per path
+  MSKModemQuality quality[MSKMODEM_PHASES];
+  rxpow_t rxsq[BIT_MAX];  // Squares of the last bit's filtered samples
+  int rxsq_pos;
+  rxpow_t rxpow_sum;
+  rxpow4_t rxpow4_sum;
+  rxpow_t rxpow[RXPOW_HIST+MSKMODEM_RX_BLOCK]; // Bit energy by sample, the
+                                               // block after RXPOW_HIST
+  rxpow4_t rxpow4[RXPOW_HIST+MSKMODEM_RX_BLOCK];
+  int rxpow_last; // Length of the last block
+
+  // Decimating demodulator
+  MSKModemDecim* decim;
+
+  // Carrier detector
+  MSKModemCarrier* carrier;
+  MSKModemCarrierMode carrier_mode;        // Requested
+  MSKModemCarrierMode carrier_mode_active; // Running on the audio thread
+  MSKModemCarrierFn carrier_f;
+  int carrier_open; // Carrier was on for the last block
+
+  // Equaliser
+  MSKModemEq* eq;
+  MSKModemEqMode eq_mode;        // Requested
+  MSKModemEqMode eq_mode_active; // Running on the audio thread
+  mskmodem_sound_t rxeq[MSKMODEM_RX_BLOCK];
+
+  // Batch demodulator this channel is attached to (if any)
+  MSKModemBatch* batch;
+  int batch_lane;
+  int running;
 
   // Callbacks to user code
   MSKModemRxFn rx_f; // Modem rx
@@ -104,65 +174,24 @@ struct MSKModemContext_s {
 static void modem_tx(mskmodem_sound_t* buf, int samples, void* userdata)
 {
   MSKModemContext* u = userdata;
-  int i;
 
   u->tx_sound_f(buf, samples, u->userdata);
-
-  for (i=0; i<samples; i++) {
-
-    if (++u->phase > 40) {
-
-      u->phase = 1;
-
-      // If first bit get new codeword
-      if (u->bitmask==0) {
-        u->bitmask = 0x8000000000000000LL;
-        u->current = 0;
-        u->tx_f(&u->current, u->userdata);
-      }
-
-      // Adjust phase for continuity
-      u->padj = u->padj + u->fs;
-      u->padj -= floor(u->padj);
-
-      // Get bit
-      if (u->current & u->bitmask)
-        u->fs = 1.25f - 0.25f;
-      else
-        u->fs = 1.25f + 0.25f;
-
-      // Set next bit
-      u->bitmask >>= 1;
-
-    }
-
-    if (u->current != 0) {
-      buf[i] = sin(2.0*G_PI*(u->fs * (u->phase/40.0) + u->padj));
-    }
-
-  }
-
+  mskmodem_mod_process(u->mod, buf, samples, u->tx_f, u->userdata);
 }
 
-static void modem_rx(const mskmodem_sound_t* s, int samples, void* userdata)
+// Zero crossing discriminator, from u->rxfilt to (low passed) u->rxdisc
+static void discriminate(MSKModemContext* u, int n)
 {
-  MSKModemContext* u = userdata;
-  int i=0, b=0, t=0, snrz=0;
-  float v = 0.0f;
+  int i=0, b=0, t=0;
+  mskmodem_sound_t v = 0;
 
-  int pll_early=0, pll_late=0, pll_reset=0;
+  for (i=0; i<n; i++) {
 
-  u->rx_sound_f(s, samples, u->userdata);
-
-  for (i=0; i<samples-1; i++) {
-
-    // Initial filter
-    u->initfilter[u->filterpos] = s[i];
-    v = convolvesum(u->initfilter, fir900to2100, 50, u->filterpos);
+    v = u->rxfilt[i];
 
     // Zero crossing detector
     if ( (u->last < 0 && v >=0) || (u->last >=0 && v < 0) )
-      u->mst = 40/3;
+      u->mst = u->disc_mst;
     u->last = v;
 
     // Monostable
@@ -174,22 +203,66 @@ static void modem_rx(const mskmodem_sound_t* s, int samples, void* userdata)
 
     // Discriminator
     u->discqueue[u->discpos] = b;
-    if ((t = u->discpos - (40/3)) < 0)
-      t += 15;
+    if ((t = u->discpos - u->disc_mst) < 0)
+      t += u->disc_mst+2;
     b &= u->discqueue[t];
-    if ((t = u->discpos - (40/6)) < 0)
-      t += 15;
+    if ((t = u->discpos - u->disc_half) < 0)
+      t += u->disc_mst+2;
     b &= u->discqueue[t];
     b = 1 - b;
-    if (++u->discpos >= 15)
+    if (++u->discpos >= u->disc_mst+2)
       u->discpos = 0;
 
-    // Low pass output of discriminator
-    u->discfilter[u->filterpos] = b;
-    v = convolvesum(u->discfilter, fir600, 50, u->filterpos);
+    u->rxdisc[i] = b * MSKMODEM_SOUND_FULLSCALE;
+
+  }
+
+  // Low pass output of discriminator
+  mskmodem_fir_process(u->discfilter, u->rxdisc, u->rxdisc, n);
+}
+
+// Mean discriminator output for a tone, from a fresh start, which is left
+static float disc_level(MSKModemContext* u, double f)
+{
+  float sum = 0;
+  int n, i;
+
+  for (n=0; n<8; n++) {
+    for (i=0; i<MSKMODEM_RX_BLOCK; i++)
+      u->rxfilt[i] = MSKMODEM_SOUND_FULLSCALE/2 *
+                     sin(2.0*G_PI*f*(n*MSKMODEM_RX_BLOCK+i)/u->rate);
+    discriminate(u, MSKMODEM_RX_BLOCK);
+    for (i=0; n>=2 && i<MSKMODEM_RX_BLOCK; i++)
+      sum += u->rxdisc[i];
+  }
+
+  u->last = 0;
+  u->mst = 0;
+  u->discpos = 0;
+  memset(u->discqueue, 0, sizeof(u->discqueue));
+  mskmodem_fir_reset(u->discfilter);
+
+  return sum / (6*MSKMODEM_RX_BLOCK);
+}
+
+// Incoherent demodulator, on a block of u->rxfilt. The PLL's bit clock
+// counts Q16 samples, a bit ending when it passes a bit length (less a
+// twentieth if early, plus a tenth if late: 2 and 4 samples at 48kHz) and
+// carrying the remainder over.
+static void demod_incoherent(MSKModemContext* u, int n)
+{
+  int i=0, b=0, snrz=0;
+  gint32 half = u->bitlen/2, gate = MAX(u->bitlen/40, CLK_ONE), end = 0;
+  mskmodem_sound_t v = 0;
+
+  discriminate(u, n);
+
+  for (i=0; i<n; i++) {
+
+    v = u->rxdisc[i];
 
     // Bit detector
-    if (v>0.5f)
+    if (v > u->disc_slice)
       b = 1;
     else
       b = 0;
@@ -199,47 +272,338 @@ static void modem_rx(const mskmodem_sound_t* s, int samples, void* userdata)
     if (b != u->slast) {
       u->slast = b;
       snrz = 1;
+      mskmodem_quality_timing(&u->quality[0],
+                              (float)(u->pll_count - half) / CLK_ONE);
     }
 
     // PLL early/late gate
-    pll_reset = 0;
-    if (u->pll_count < 40/2-1 && snrz)
-      pll_early = 1;
-    else if (u->pll_count > 40/2+1 && snrz)
-      pll_late = 1;
-
-    // PLL reference adjust
-    if (u->pll_count == 40-1-2 && pll_early && !pll_late)
-      pll_reset = 1;
-    if (u->pll_count == 40-1 && !pll_early && !pll_late)
-      pll_reset = 1;
-    if (u->pll_count == 40-1 && pll_early && pll_late)
-      pll_reset = 1;
-    if (u->pll_count == 40+1+2)
-      pll_reset = 1;
+    if (u->pll_count < half-gate && snrz)
+      u->pll_early = 1;
+    else if (u->pll_count > half+gate && snrz)
+      u->pll_late = 1;
+
+    // PLL reference adjust: the bit end this sample reaches, if any
+#define PLL_ENDS(x) (u->pll_count < (x) && u->pll_count+CLK_ONE >= (x))
+    end = 0;
+    if (PLL_ENDS(u->bitlen-u->bitlen/20) && u->pll_early && !u->pll_late)
+      end = u->bitlen-u->bitlen/20;
+    if (PLL_ENDS(u->bitlen) && !u->pll_early && !u->pll_late)
+      end = u->bitlen;
+    if (PLL_ENDS(u->bitlen) && u->pll_early && u->pll_late)
+      end = u->bitlen;
+    if (PLL_ENDS(u->bitlen+u->bitlen/10))
+      end = u->bitlen+u->bitlen/10;
+#undef PLL_ENDS
 
     // PLL reference generator
-    if (u->pll_count > 40/2)
+    if (u->pll_count > half)
       u->pll = 0;
     else {
-      if (u->pll==0)
-        u->rx_f(b, u->userdata);
+      if (u->pll==0) {
+        mskmodem_quality_bit(&u->quality[0], b,
+                             v - u->disc_slice,
+                             u->rxpow[RXPOW_HIST+i-u->quality_delay] /
+                             (float)u->bitwin,
+                             u->rxpow4[RXPOW_HIST+i-u->quality_delay] /
+                             (float)u->bitwin);
+        u->rx_f(b, 0, u->userdata);
+      }
       u->pll = 1;
     }
 
     // PLL reference adjust
-    if (pll_reset) {
-      u->pll_count = 0;
-      pll_early = 0;
-      pll_late = 0;
-    } else
-      u->pll_count += 1;
+    u->pll_count += CLK_ONE;
+    if (end) {
+      if (end != u->bitlen)
+        mskmodem_quality_correction(&u->quality[0]);
+      u->pll_count -= end;
+      u->pll_early = 0;
+      u->pll_late = 0;
+    }
 
-    // Update filterpos for next samples
-    if (++u->filterpos >= 50) u->filterpos = 0;
+  }
 
+}
+
+// Coherent demodulator, on a block of u->rxfilt. Each tone is correlated
+// in I and Q over the last bit; the correlators are running sums over a
+// ring of products so a sample costs the same whatever the window length.
+// The decision changes sign when the window straddles a bit edge, half a
+// bit before the best sampling slot; bit timing follows those changes on
+// a bit clock counting 1/COH_FRAC samples.
+static void demod_coherent(MSKModemContext* u, int path, int n)
+{
+  int i, k, b, slot, clk, delta, len = u->coh_len;
+  mskmodem_sound_t v;
+  coh_acc_t p;
+  coh_energy_t e0, e1, d;
+
+  for (i=0; i<n; i++) {
+
+    v = u->rxfilt[i];
+    k = u->curr_sample;
+    slot = u->corr;
+    clk = u->coh_clk;
+
+    // Correlators
+    p = COH_PRODUCT(v, u->lo_i0[k]);
+    u->sum_i0 += p - u->corr_i0[slot];
+    u->corr_i0[slot] = p;
+    p = COH_PRODUCT(v, u->lo_q0[k]);
+    u->sum_q0 += p - u->corr_q0[slot];
+    u->corr_q0[slot] = p;
+    p = COH_PRODUCT(v, u->lo_i1[k]);
+    u->sum_i1 += p - u->corr_i1[slot];
+    u->corr_i1[slot] = p;
+    p = COH_PRODUCT(v, u->lo_q1[k]);
+    u->sum_q1 += p - u->corr_q1[slot];
+    u->corr_q1[slot] = p;
+
+    if (++u->curr_sample >= u->lo_len)
+      u->curr_sample = 0;
+
+    // Tone energies: a one is 1200Hz
+    e0 = (coh_energy_t)u->sum_i0*u->sum_i0 + (coh_energy_t)u->sum_q0*u->sum_q0;
+    e1 = (coh_energy_t)u->sum_i1*u->sum_i1 + (coh_energy_t)u->sum_q1*u->sum_q1;
+    d = e1 - e0;
+
+    // Track bit edges
+    b = d > 0;
+    if (b != u->coh_last) {
+      u->coh_last = b;
+      delta = (clk + len/2 - u->coh_phase + len*3/2) % len - len/2;
+      mskmodem_quality_timing(&u->quality[path], (float)delta / COH_FRAC);
+      u->coh_phase = (u->coh_phase + delta/4 + len) % len;
+    }
+
+    if (++u->corr >= u->bitwin) {
+      u->corr = 0;
+
+      // Re-sum once a bit so rounding can't build up in the running sums
+      u->sum_i0 = u->sum_q0 = u->sum_i1 = u->sum_q1 = 0;
+      for (k=0; k<u->bitwin; k++) {
+        u->sum_i0 += u->corr_i0[k];
+        u->sum_q0 += u->corr_q0[k];
+        u->sum_i1 += u->corr_i1[k];
+        u->sum_q1 += u->corr_q1[k];
+      }
+    }
+
+    if ((u->coh_clk += COH_FRAC) >= len)
+      u->coh_clk -= len;
+
+    // Half way between bits, steer the next one towards the estimate,
+    // to the nearest sample
+    u->coh_count += COH_FRAC;
+    if (u->coh_count >= len/2 && u->coh_count-COH_FRAC < len/2) {
+      delta = (int)floor((u->coh_phase - u->coh_slot + COH_FRAC/2) /
+                         (double)COH_FRAC) * COH_FRAC;
+      delta = (delta + len + len/2) % len - len/2;
+      u->coh_next = len + CLAMP(delta, -COH_SLEW*COH_FRAC, COH_SLEW*COH_FRAC);
+      if (u->coh_next != len)
+        mskmodem_quality_correction(&u->quality[path]);
+    }
+
+    if (u->coh_count >= u->coh_next) {
+      mskmodem_quality_bit(&u->quality[path], b,
+                           (float)d / ((float)e0 + (float)e1 + 1e-12f),
+                           u->rxpow[RXPOW_HIST+i] / (float)u->bitwin,
+                           u->rxpow4[RXPOW_HIST+i] / (float)u->bitwin);
+      u->rx_f(b, path, u->userdata);
+      u->coh_slot = clk;
+      u->coh_count -= u->coh_next;
+    }
+
+  }
+}
+
+// Multiphase slicer, on a block of u->rxfilt. Rather than recover bit
+// timing, the discriminator output is sliced at evenly spaced phases
+// through the bit and each phase is its own path. Whichever phase is best
+// placed gives good codewords straight away, with no PLL to pull in.
+static void demod_multiphase(MSKModemContext* u, int n)
+{
+  int i, b, path;
+
+  discriminate(u, n);
+
+  for (i=0; i<n; i++) {
+    while (u->mp_path < MSKMODEM_PHASES &&
+           u->mp_clk >= (gint64)u->bitlen * u->mp_path / MSKMODEM_PHASES) {
+      b = u->rxdisc[i] > u->disc_slice;
+      path = u->mp_path++;
+      mskmodem_quality_bit(&u->quality[path], b,
+                           u->rxdisc[i] - u->disc_slice,
+                           u->rxpow[RXPOW_HIST+i-u->quality_delay] /
+                           (float)u->bitwin,
+                           u->rxpow4[RXPOW_HIST+i-u->quality_delay] /
+                           (float)u->bitwin);
+      u->rx_f(b, path, u->userdata);
+    }
+    if ((u->mp_clk += CLK_ONE) >= u->bitlen) {
+      u->mp_clk -= u->bitlen;
+      u->mp_path = 0;
+    }
+  }
+}
+
+// Bit energy of each sample of a block of u->rxfilt, after the last
+// RXPOW_HIST of the block before
+static void bit_energy(MSKModemContext* u, int n)
+{
+  rxpow_t x;
+  int i, k;
+
+  memmove(u->rxpow, u->rxpow+u->rxpow_last, RXPOW_HIST*sizeof(*u->rxpow));
+  memmove(u->rxpow4, u->rxpow4+u->rxpow_last,
+          RXPOW_HIST*sizeof(*u->rxpow4));
+  for (i=0; i<n; i++) {
+    x = RXPOW_SQUARE(u->rxfilt[i]);
+    u->rxpow_sum += x - u->rxsq[u->rxsq_pos];
+    u->rxpow4_sum += (rxpow4_t)x*x -
+                     (rxpow4_t)u->rxsq[u->rxsq_pos]*u->rxsq[u->rxsq_pos];
+    u->rxsq[u->rxsq_pos] = x;
+    if (++u->rxsq_pos >= u->bitwin) {
+      u->rxsq_pos = 0;
+      // Re-sum once a bit so rounding can't build up
+      u->rxpow_sum = 0;
+      u->rxpow4_sum = 0;
+      for (k=0; k<u->bitwin; k++) {
+        u->rxpow_sum += u->rxsq[k];
+        u->rxpow4_sum += (rxpow4_t)u->rxsq[k]*u->rxsq[k];
+      }
+    }
+    u->rxpow[RXPOW_HIST+i] = u->rxpow_sum;
+    u->rxpow4[RXPOW_HIST+i] = u->rxpow4_sum;
+  }
+  u->rxpow_last = n;
+}
+
+static void demod_block(MSKModemContext* u, const mskmodem_sound_t* s,
+                        int samples)
+{
+  int p, n;
+
+  // Early/late flags last for one period
+  u->pll_early = u->pll_late = 0;
+
+  for (p=0; p<samples; p+=n) {
+
+    n = MIN(samples-p, MSKMODEM_RX_BLOCK);
+
+    // Initial filter
+    mskmodem_fir_process(u->initfilter, s+p, u->rxfilt, n);
+    bit_energy(u, n);
+
+    switch (u->demod_active) {
+      case MSKMODEM_DEMOD_COHERENT:
+        demod_coherent(u, 0, n);
+        break;
+      case MSKMODEM_DEMOD_DIVERSITY:
+        demod_incoherent(u, n);
+        demod_coherent(u, 1, n);
+        break;
+      case MSKMODEM_DEMOD_MULTIPHASE:
+        demod_multiphase(u, n);
+        break;
+      default:
+        demod_incoherent(u, n);
+        break;
+    }
+
+  }
+}
+
+static void demod_select(MSKModemContext* u, const mskmodem_sound_t* s,
+                         int samples)
+{
+  switch (u->demod_active) {
+    case MSKMODEM_DEMOD_DECIMATING:
+      mskmodem_decim_process(u->decim, s, samples, &u->quality[0],
+                             u->rx_f, u->userdata);
+      break;
+    default:
+      demod_block(u, s, samples);
+      break;
+  }
+}
+
+// Through the equaliser, if it's on, then the demodulator
+static void demodulate(MSKModemContext* u, const mskmodem_sound_t* s,
+                       int samples)
+{
+  int p, n;
+
+  if (u->eq_mode_active == MSKMODEM_EQ_OFF) {
+    demod_select(u, s, samples);
+    return;
+  }
+
+  for (p=0; p<samples; p+=n) {
+    n = MIN(samples-p, MSKMODEM_RX_BLOCK);
+    mskmodem_eq_process(u->eq, s+p, u->rxeq, n);
+    demod_select(u, u->rxeq, n);
+  }
+}
+
+static void modem_rx(const mskmodem_sound_t* s, int samples, void* userdata)
+{
+  MSKModemContext* u = userdata;
+  const mskmodem_sound_t* back = NULL;
+  int batched, gate, open, nback, n;
+
+  u->rx_sound_f(s, samples, u->userdata);
+
+  // Demodulator changed: start the new one from a clean state. The batch
+  // only runs the incoherent demodulator.
+  if (u->demod != u->demod_active) {
+    u->demod_active = u->demod;
+    mskmodem_decim_reset(u->decim);
+    for (n=0; n<MSKMODEM_PHASES; n++)
+      mskmodem_quality_reset(&u->quality[n]);
+    if (u->batch)
+      mskmodem_batch_set_active(u->batch, u->batch_lane, u->running &&
+                                u->demod_active == MSKMODEM_DEMOD_INCOHERENT);
+  }
+
+  // Carrier detector changed: start it afresh
+  if (u->carrier_mode != u->carrier_mode_active) {
+    u->carrier_mode_active = u->carrier_mode;
+    mskmodem_carrier_reset(u->carrier);
+  }
+
+  // Equaliser changed: start it afresh
+  if (u->eq_mode != u->eq_mode_active) {
+    u->eq_mode_active = u->eq_mode;
+    mskmodem_eq_reset(u->eq, u->eq_mode_active);
+    if (u->carrier_mode_active != MSKMODEM_CARRIER_OFF && !u->carrier_open)
+      mskmodem_eq_carrier(u->eq, 0, 0);
   }
 
+  // Without carrier there's nothing to demodulate. When it comes on, the
+  // samples skipped just before go first so the preamble isn't lost to
+  // the detection delay. The batch runs every lane, so isn't gated.
+  batched = u->batch && u->demod_active == MSKMODEM_DEMOD_INCOHERENT;
+  gate = u->carrier_mode_active == MSKMODEM_CARRIER_GATE && !batched;
+  nback = 0;
+  open = u->carrier_mode_active != MSKMODEM_CARRIER_OFF &&
+         mskmodem_carrier_process(u->carrier, s, samples, &back, &nback,
+                                  u->carrier_f, u->userdata);
+  if (open != u->carrier_open)
+    mskmodem_eq_carrier(u->eq, open, MAX(nback + samples -
+                                         mskmodem_carrier_onset(u->carrier), 0));
+  u->carrier_open = open;
+  if (!open && gate)
+    return;
+
+  // Batched channels are demodulated together with the others
+  if (batched && !mskmodem_batch_deposit(u->batch, u->batch_lane, s, samples))
+    return;
+
+  if (gate && nback)
+    demodulate(u, back, nback);
+  demodulate(u, s, samples);
+
 }
 
 int
@@ -256,6 +620,9 @@ mskmodem_init
 {
 
   MSKModemContext* ctx = g_new0(MSKModemContext, 1);
+  float coeff[FILTER_TAPS_MAX];
+  double spb;
+  int n, taps, a, b;
   *ppCtx = ctx;
 
   ctx->tx_f = tx_f;
@@ -264,17 +631,71 @@ mskmodem_init
   ctx->rx_sound_f = rx_sound_f;
   ctx->userdata = userdata;
 
-  ctx->corr_i0 = g_new0(float, 40);
-  ctx->corr_q0 = g_new0(float, 40);
-  ctx->corr_i1 = g_new0(float, 40);
-  ctx->corr_q1 = g_new0(float, 40);
+  mskmodem_q15_init();
+
+  // The sound backend sets the rate. Nothing runs until it's started.
+  mskmodem_sound_init(&ctx->sctx, channelId, modem_rx, modem_tx, ctx);
+  ctx->rate = mskmodem_sound_rate(ctx->sctx);
+  if (ctx->rate < MSKMODEM_RATE_MIN || ctx->rate > MSKMODEM_RATE_MAX)
+    g_error("unsupported sample rate %d", ctx->rate);
+
+  spb = ctx->rate / 1200.0;
+  ctx->bitlen = lrint(spb * CLK_ONE);
+  ctx->bitwin = lrint(spb);
+  ctx->disc_mst = spb / 3;
+  ctx->disc_half = spb / 6;
+  ctx->quality_delay = lrint(QUALITY_DELAY_DISC * ctx->rate / 48000.0);
+
+  ctx->corr_i0 = g_new0(coh_acc_t, ctx->bitwin);
+  ctx->corr_q0 = g_new0(coh_acc_t, ctx->bitwin);
+  ctx->corr_i1 = g_new0(coh_acc_t, ctx->bitwin);
+  ctx->corr_q1 = g_new0(coh_acc_t, ctx->bitwin);
   ctx->pll = 40;
+  if (ctx->rate < MSKMODEM_RATE_DISC_MIN)
+    ctx->demod = ctx->demod_active = MSKMODEM_DEMOD_COHERENT;
+  ctx->coh_len = lrint(spb * COH_FRAC);
+  ctx->coh_next = ctx->coh_len;
+
+  // Coherent demodulator local oscillators, over the fewest samples
+  // holding whole cycles of both tones
+  a = ctx->rate;
+  b = 600;
+  while (b) {
+    n = a % b;
+    a = b;
+    b = n;
+  }
+  ctx->lo_len = ctx->rate / a;
+  ctx->lo_i0 = g_new(mskmodem_sound_t, ctx->lo_len);
+  ctx->lo_q0 = g_new(mskmodem_sound_t, ctx->lo_len);
+  ctx->lo_i1 = g_new(mskmodem_sound_t, ctx->lo_len);
+  ctx->lo_q1 = g_new(mskmodem_sound_t, ctx->lo_len);
+  for (n=0; n<ctx->lo_len; n++) {
+    ctx->lo_i0[n] = MSKMODEM_SOUND_FULLSCALE * cos(2.0*G_PI*1.5*n/spb);
+    ctx->lo_q0[n] = MSKMODEM_SOUND_FULLSCALE * sin(2.0*G_PI*1.5*n/spb);
+    ctx->lo_i1[n] = MSKMODEM_SOUND_FULLSCALE * cos(2.0*G_PI*n/spb);
+    ctx->lo_q1[n] = MSKMODEM_SOUND_FULLSCALE * sin(2.0*G_PI*n/spb);
+  }
+
+  taps = mskmodem_filter_rx_bandpass(ctx->rate, coeff);
+  ctx->initfilter = mskmodem_fir_new(coeff, taps);
+  ctx->decim = mskmodem_decim_new(ctx->rate, coeff, taps);
+  taps = mskmodem_filter_rx_lowpass(ctx->rate, coeff);
+  ctx->discfilter = mskmodem_fir_new(coeff, taps);
 
-  ctx->initfilter = g_new0(float, 50);
-  ctx->discqueue  = g_new0(int, 50);
-  ctx->discfilter = g_new0(float, 50);
+  // The discriminator is sliced midway between its outputs for the two
+  // tones. With few samples a bit they're lopsided; at 48kHz half scale
+  // is near enough, and the batch demodulator slices there.
+  if (ctx->rate == 48000)
+    ctx->disc_slice = MSKMODEM_SOUND_FULLSCALE/2;
+  else
+    ctx->disc_slice = (disc_level(ctx, 1200) + disc_level(ctx, 1800)) / 2;
 
-  mskmodem_sound_init(&ctx->sctx, channelId, modem_rx, modem_tx, ctx); 
+  ctx->mod = mskmodem_mod_new(ctx->rate, MSKMODEM_TX_TABLE,
+                              MSKMODEM_SHAPE_NONE, 1.0f);
+
+  ctx->carrier = mskmodem_carrier_new(ctx->rate);
+  ctx->eq = mskmodem_eq_new(ctx->rate);
 
   return 0;
 }
@@ -289,27 +710,269 @@ mskmodem_free
   {
     MSKModemContext* ctx = *ppCtx;
     mskmodem_sound_free(&ctx->sctx);
+    ctx->running = 0;
+    mskmodem_batch_detach(ctx);
     g_free(ctx->corr_i0);
     g_free(ctx->corr_q0);
     g_free(ctx->corr_i1);
     g_free(ctx->corr_q1);
+    g_free(ctx->lo_i0);
+    g_free(ctx->lo_q0);
+    g_free(ctx->lo_i1);
+    g_free(ctx->lo_q1);
     
-    g_free(ctx->initfilter);
-    g_free(ctx->discqueue);
-    g_free(ctx->discfilter);
+    mskmodem_fir_free(&ctx->initfilter);
+    mskmodem_fir_free(&ctx->discfilter);
+    mskmodem_decim_free(&ctx->decim);
+    mskmodem_mod_free(&ctx->mod);
+    mskmodem_carrier_free(&ctx->carrier);
+    mskmodem_eq_free(&ctx->eq);
 
     g_free(ctx);
     *ppCtx = NULL;
   }
 }
 
+int
+mskmodem_rate
+(
+  MSKModemContext* ctx
+)
+{
+  return ctx->rate;
+}
+
+int
+mskmodem_set_demod
+(
+  MSKModemContext* ctx,
+  MSKModemDemod demod
+)
+{
+  if (demod < 0 || demod >= MSKMODEM_DEMOD_COUNT)
+    return 1;
+  if (ctx->rate < MSKMODEM_RATE_DISC_MIN && demod != MSKMODEM_DEMOD_DECIMATING
+      && demod != MSKMODEM_DEMOD_COHERENT)
+    return 1;
+
+  ctx->demod = demod;
+
+  return 0;
+}
+
+int
+mskmodem_set_carrier
+(
+  MSKModemContext* ctx,
+  MSKModemCarrierMode mode,
+  MSKModemCarrierFn f
+)
+{
+  if (mode < 0 || mode >= MSKMODEM_CARRIER_COUNT)
+    return 1;
+
+  ctx->carrier_f = f;
+  ctx->carrier_mode = mode;
+
+  return 0;
+}
+
+int
+mskmodem_set_eq
+(
+  MSKModemContext* ctx,
+  MSKModemEqMode mode
+)
+{
+  if (mode < 0 || mode >= MSKMODEM_EQ_COUNT)
+    return 1;
+
+  ctx->eq_mode = mode;
+
+  return 0;
+}
+
+void
+mskmodem_rx_eq
+(
+  MSKModemContext* ctx,
+  MSKModemEqState* state
+)
+{
+  mskmodem_eq_state(ctx->eq, state);
+}
+
+int
+mskmodem_rx_quality
+(
+  MSKModemContext* ctx,
+  int path,
+  int bits,
+  MSKModemRxQuality* q
+)
+{
+  if (path < 0 || path >= MSKMODEM_PHASES)
+    return 1;
+
+  // Batched channels are demodulated elsewhere, and not measured
+  if (ctx->batch && ctx->demod_active == MSKMODEM_DEMOD_INCOHERENT)
+    memset(q, 0, sizeof(*q));
+  else
+    mskmodem_quality_get(&ctx->quality[path], bits, q);
+
+  return 0;
+}
+
+int
+mskmodem_set_modulator
+(
+  MSKModemContext* ctx,
+  MSKModemTxMode mode,
+  MSKModemShape shape,
+  float level
+)
+{
+  MSKModemMod* mod;
+
+  if (ctx->running)
+    return 1;
+
+  mod = mskmodem_mod_new(ctx->rate, mode, shape, level);
+  if (!mod)
+    return 1;
+
+  mskmodem_mod_free(&ctx->mod);
+  ctx->mod = mod;
+
+  return 0;
+}
+
+int
+mskmodem_tx_prefill
+(
+  MSKModemContext* ctx,
+  const guint64* cw,
+  int count
+)
+{
+  if (ctx->running)
+    return 1;
+
+  return mskmodem_mod_prefill(ctx->mod, cw, count);
+}
+
+void
+mskmodem_tx_cache_stats
+(
+  MSKModemContext* ctx,
+  guint32* hits,
+  guint32* misses
+)
+{
+  mskmodem_mod_cache_stats(ctx->mod, hits, misses);
+}
+
+int
+mskmodem_set_sound_split
+(
+  MSKModemContext* ctx,
+  const char* capture,
+  const char* playback
+)
+{
+  if (ctx->running)
+    return 1;
+
+  return mskmodem_sound_split(ctx->sctx, capture, playback);
+}
+
+void
+mskmodem_sound_stats
+(
+  MSKModemContext* ctx,
+  MSKModemSoundSplitStats* capture,
+  MSKModemSoundSplitStats* playback
+)
+{
+  mskmodem_sound_split_stats(ctx->sctx, capture, playback);
+}
+
+int
+mskmodem_set_pipeline
+(
+  MSKModemContext* ctx,
+  int lookahead
+)
+{
+  if (ctx->running)
+    return 1;
+
+  return mskmodem_sound_pipeline(ctx->sctx, lookahead);
+}
+
+void
+mskmodem_pipeline_stats
+(
+  MSKModemContext* ctx,
+  MSKModemSoundPipelineStats* stats
+)
+{
+  mskmodem_sound_pipeline_stats(ctx->sctx, stats);
+}
+
+int
+mskmodem_batch_attach
+(
+  MSKModemBatch* batch,
+  MSKModemContext* ctx
+)
+{
+  int lane;
+
+  // The batch kernels are written for 48kHz
+  if (ctx->batch || ctx->running || ctx->rate != 48000)
+    return 1;
+
+  lane = mskmodem_batch_add_lane(batch, ctx->rx_f, ctx->userdata);
+  if (lane < 0)
+    return 1;
+
+  mskmodem_batch_set_active(batch, lane, ctx->running &&
+                            ctx->demod_active == MSKMODEM_DEMOD_INCOHERENT);
+  ctx->batch_lane = lane;
+  ctx->batch = batch;
+
+  return 0;
+}
+
+int
+mskmodem_batch_detach
+(
+  MSKModemContext* ctx
+)
+{
+  if (ctx->running)
+    return 1;
+
+  if (ctx->batch) {
+    mskmodem_batch_remove_lane(ctx->batch, ctx->batch_lane);
+    ctx->batch = NULL;
+  }
+
+  return 0;
+}
+
 int
 mskmodem_run
 (
   MSKModemContext* ctx
 )
 {
-  mskmodem_sound_run(ctx->sctx);
+  ctx->running = 1;
+  if (ctx->batch)
+    mskmodem_batch_set_active(ctx->batch, ctx->batch_lane,
+                              ctx->demod_active == MSKMODEM_DEMOD_INCOHERENT);
+  return mskmodem_sound_run(ctx->sctx);
 }
 
 int
@@ -318,6 +981,9 @@ mskmodem_stop
   MSKModemContext* ctx
 )
 {
-  mskmodem_sound_stop(ctx->sctx);
+  ctx->running = 0;
+  if (ctx->batch)
+    mskmodem_batch_set_active(ctx->batch, ctx->batch_lane, FALSE);
+  return mskmodem_sound_stop(ctx->sctx);
 }
 
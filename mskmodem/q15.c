@@ -0,0 +1,94 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+* 
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+#include <math.h>
+
+#include "q15.h"
+
+// Sine table, one cycle plus a guard entry for interpolation
+#define Q15_SIN_BITS 10
+#define Q15_SIN_SIZE (1<<Q15_SIN_BITS)
+
+// tanh table covering 0 <= x < 8 in steps of 1/128
+#define Q15_TANH_SHIFT 8
+#define Q15_TANH_SIZE 1024
+
+static gint16 q15_sin_table[Q15_SIN_SIZE+1];
+static gint16 q15_tanh_table[Q15_TANH_SIZE+1];
+
+static gpointer q15_tables(gpointer data)
+{
+  int n;
+
+  for (n=0; n<=Q15_SIN_SIZE; n++)
+    q15_sin_table[n] = q15_sat(lrint(32767.0 * sin(2.0*G_PI*n/Q15_SIN_SIZE)));
+
+  for (n=0; n<=Q15_TANH_SIZE; n++)
+    q15_tanh_table[n] = q15_sat(lrint(32767.0 *
+                                tanh((double)(n<<Q15_TANH_SHIFT)/Q15_ONE)));
+
+  return NULL;
+}
+
+void
+mskmodem_q15_init
+(
+  void
+)
+{
+  static GOnce once = G_ONCE_INIT;
+  g_once(&once, q15_tables, NULL);
+}
+
+gint16
+mskmodem_q15_sin
+(
+  guint32 phase
+)
+{
+  int n = phase >> (32-Q15_SIN_BITS);
+  gint32 f = (phase >> (32-Q15_SIN_BITS-15)) & 0x7FFF;
+  gint32 a = q15_sin_table[n];
+  gint32 b = q15_sin_table[n+1];
+
+  return a + (((b-a)*f + (1<<14)) >> 15);
+}
+
+gint16
+mskmodem_q15_tanh
+(
+  gint32 x
+)
+{
+  gint32 ax = ABS(x);
+  int n = ax >> Q15_TANH_SHIFT;
+  gint32 f, a, b;
+
+  if (n >= Q15_TANH_SIZE)
+    return x < 0 ? -q15_tanh_table[Q15_TANH_SIZE]
+                 : q15_tanh_table[Q15_TANH_SIZE];
+
+  f = ax & ((1<<Q15_TANH_SHIFT)-1);
+  a = q15_tanh_table[n];
+  b = q15_tanh_table[n+1];
+  a += ((b-a)*f + (1<<(Q15_TANH_SHIFT-1))) >> Q15_TANH_SHIFT;
+
+  return x < 0 ? -a : a;
+}
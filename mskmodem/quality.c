@@ -0,0 +1,92 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "quality.h"
+
+// Reported SNR is capped: with no noise at all the noise estimate is
+// only rounding
+#define QUALITY_SNR_MAX 60.0f
+
+void
+mskmodem_quality_reset
+(
+  MSKModemQuality* q
+)
+{
+  memset(q, 0, sizeof(*q));
+}
+
+void
+mskmodem_quality_get
+(
+  const MSKModemQuality* q,
+  int bits,
+  MSKModemRxQuality* out
+)
+{
+  double sum = 0, e[2] = {0, 0}, e4 = 0, timing = 0;
+  double m2, m4, sig, noise;
+  float least = G_MAXFLOAT, m, mean;
+  int n[2] = {0, 0}, transitions = 0;
+  int i, k, b;
+
+  memset(out, 0, sizeof(*out));
+  out->timing = -1.0f;
+
+  bits = MIN(bits, q->count);
+  if (bits <= 0)
+    return;
+
+  for (i=0; i<bits; i++) {
+    k = (q->pos - 1 - i + QUALITY_BITS) % QUALITY_BITS;
+    m = q->margin[k];
+    sum += m;
+    least = MIN(least, m);
+    b = q->bit[k];
+    e[b] += q->energy[k];
+    e4 += q->energy4[k];
+    n[b]++;
+    if (q->timing[k] >= 0) {
+      timing += q->timing[k];
+      transitions++;
+    }
+    out->corrections += q->corrected[k];
+  }
+
+  // Signal power S and noise power N from the moments of sinusoid plus
+  // Gaussian noise: M2 = S+N, M4 = 3/2 S^2 + 6SN + 3N^2
+  m2 = (e[0] + e[1]) / bits;
+  m4 = e4 / bits;
+  sig = sqrt(MAX(3.0*m2*m2 - m4, 0) / 1.5);
+  noise = m2 - sig;
+  out->snr = noise > 0 ? MIN(10.0*log10(sig/noise + 1e-12), QUALITY_SNR_MAX)
+                       : QUALITY_SNR_MAX;
+
+  mean = sum / bits;
+  out->bits = bits;
+  out->eye = mean > 0 ? least / mean : 0;
+  if (transitions)
+    out->timing = timing / transitions;
+  if (n[0] && n[1] && e[0] > 0 && e[1] > 0)
+    out->imbalance = 10.0 * log10((e[1]/n[1]) / (e[0]/n[0]));
+}
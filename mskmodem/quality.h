@@ -0,0 +1,102 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef MSKMODEM_QUALITY_H
+#define MSKMODEM_QUALITY_H
+
+#include "mskmodem.h"
+
+// Bits of history kept per path: a codeword's worth
+#define QUALITY_BITS 64
+
+// Receive quality of one demodulator path. The demodulator reports each
+// bit decision with its margin (distance from the slicing threshold, in
+// any units as long as they're consistent) and the mean square and mean
+// fourth power of the band passed signal over the bit. Between bits
+// it reports any timing errors it measures and corrections it makes.
+// Figures are worked out from the last few bits on request.
+//
+// MSK has a constant envelope, so the second and fourth moments of the
+// signal give the signal and noise powers apart (the M2M4 estimator).
+typedef struct MSKModemQuality_s
+{
+  float margin[QUALITY_BITS];
+  float energy[QUALITY_BITS];     // Mean square over the bit
+  float energy4[QUALITY_BITS];    // ...and mean fourth power
+  float timing[QUALITY_BITS];     // Mean timing error, <0 where none
+  guint8 bit[QUALITY_BITS];
+  guint8 corrected[QUALITY_BITS]; // Bit clock corrections made
+  int pos;                        // Next entry
+  int count;                      // Entries filled
+
+  // For the bit in progress
+  float timing_sum;
+  int timing_count;
+  int corrections;
+} MSKModemQuality;
+
+void
+mskmodem_quality_reset
+(
+  MSKModemQuality* q
+);
+
+// Timing error (samples) seen in the bit in progress
+static inline void mskmodem_quality_timing(MSKModemQuality* q, float err)
+{
+  q->timing_sum += err < 0 ? -err : err;
+  q->timing_count++;
+}
+
+// Bit clock moved in the bit in progress
+static inline void mskmodem_quality_correction(MSKModemQuality* q)
+{
+  q->corrections++;
+}
+
+// Bit decided
+static inline void mskmodem_quality_bit(MSKModemQuality* q, int bit,
+                                        float margin, float energy,
+                                        float energy4)
+{
+  int p = q->pos;
+
+  q->margin[p] = margin < 0 ? -margin : margin;
+  q->energy[p] = energy;
+  q->energy4[p] = energy4;
+  q->timing[p] = q->timing_count ? q->timing_sum / q->timing_count : -1.0f;
+  q->bit[p] = bit;
+  q->corrected[p] = MIN(q->corrections, 255);
+  q->pos = (p + 1) % QUALITY_BITS;
+  q->count = MIN(q->count + 1, QUALITY_BITS);
+
+  q->timing_sum = 0;
+  q->timing_count = 0;
+  q->corrections = 0;
+}
+
+// Figures over the last bits bits (at most QUALITY_BITS)
+void
+mskmodem_quality_get
+(
+  const MSKModemQuality* q,
+  int bits,
+  MSKModemRxQuality* out
+);
+
+#endif /* MSKMODEM_QUALITY_H */
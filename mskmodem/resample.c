@@ -0,0 +1,155 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <glib.h>
+
+#include "resample.h"
+
+// Fill averaging time, seconds. It smooths out the sawtooth of the two
+// sides' periods.
+#define RS_AVERAGE 0.5
+
+// Loop natural frequency (rad/s) and damping. A step in clock offset of
+// 100ppm at 48kHz moves the fill by about 10 samples, back within 20s.
+#define RS_OMEGA 0.25
+#define RS_ZETA  0.7
+
+// Largest correction. Sound card clocks are within 100ppm or so.
+#define RS_CORR_MAX 2000e-6
+
+struct MSKModemResampler_s {
+
+  double ratio;    // Nominal step, input samples per output sample
+  double step;     // ...steered
+  double mu;       // Position between x[1] and x[2]
+  float x[4];      // Last four input samples, oldest first
+
+  // Loop
+  double rate;     // Samples a second the buffer moves at
+  double avg;      // Average fill, <0 until measured
+  double integ;    // Integral term, as a correction
+  double corr;     // Correction now
+
+};
+
+MSKModemResampler*
+mskmodem_resample_new
+(
+  double ratio,
+  int rate
+)
+{
+  MSKModemResampler* rs = g_new0(MSKModemResampler, 1);
+
+  rs->ratio = ratio;
+  rs->rate = rate;
+  rs->step = ratio;
+  rs->avg = -1;
+
+  return rs;
+}
+
+void
+mskmodem_resample_free
+(
+  MSKModemResampler** ppRs
+)
+{
+  if (ppRs && *ppRs) {
+    g_free(*ppRs);
+    *ppRs = NULL;
+  }
+}
+
+int
+mskmodem_resample
+(
+  MSKModemResampler* rs,
+  const float* in,
+  int nin,
+  int* used,
+  float* out,
+  int nout
+)
+{
+  const float* x = rs->x;
+  float mu, a, b, c;
+  int i = 0, o = 0;
+
+  while (o < nout) {
+
+    // Bring in input until x[1] <= t < x[2]
+    while (rs->mu >= 1.0 && i < nin) {
+      rs->x[0] = rs->x[1];
+      rs->x[1] = rs->x[2];
+      rs->x[2] = rs->x[3];
+      rs->x[3] = in[i++];
+      rs->mu -= 1.0;
+    }
+    if (rs->mu >= 1.0)
+      break;
+
+    mu = rs->mu;
+    a = 0.5f*(x[3]-x[0]) + 1.5f*(x[1]-x[2]);
+    b = x[0] - 2.5f*x[1] + 2.0f*x[2] - 0.5f*x[3];
+    c = 0.5f*(x[2]-x[0]);
+    out[o++] = ((a*mu + b)*mu + c)*mu + x[1];
+    rs->mu += rs->step;
+  }
+
+  *used = i;
+  return o;
+}
+
+double
+mskmodem_resample_track
+(
+  MSKModemResampler* rs,
+  double fill,
+  double target,
+  double dt
+)
+{
+  double err;
+
+  if (rs->avg < 0)
+    rs->avg = fill;
+  else
+    rs->avg += (fill - rs->avg) * MIN(dt / RS_AVERAGE, 1.0);
+
+  // The buffer integrates the clock error: a correction c moves it by
+  // c*rate samples a second
+  err = (rs->avg - target) / rs->rate;
+  rs->integ = CLAMP(rs->integ + RS_OMEGA*RS_OMEGA * err * dt,
+                    -RS_CORR_MAX, RS_CORR_MAX);
+  rs->corr = CLAMP(2.0*RS_ZETA*RS_OMEGA * err + rs->integ,
+                   -RS_CORR_MAX, RS_CORR_MAX);
+  rs->step = rs->ratio * (1.0 + rs->corr);
+
+  return rs->corr * 1e6;
+}
+
+double
+mskmodem_resample_fill
+(
+  MSKModemResampler* rs
+)
+{
+  return rs->avg;
+}
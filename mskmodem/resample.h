@@ -0,0 +1,85 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MSKMODEM_RESAMPLE_H
+#define MSKMODEM_RESAMPLE_H
+
+#include <glib.h>
+
+// Adaptive resampler joining two sample clocks that drift.
+//
+// Output samples are cubic (Catmull-Rom) interpolations of the input at a
+// step of input samples per output sample. The signals it carries are
+// a few kHz wide at 8kHz or more, where that is good to well under the
+// modem's noise. The step is steered by a PI loop on the fill of the
+// buffer on the far side of the resampler, so the buffer, and the latency
+// through it, is held constant however the two clocks drift.
+
+struct MSKModemResampler_s;
+typedef struct MSKModemResampler_s MSKModemResampler;
+
+// ratio is the nominal input rate over the output rate, and rate the
+// sample rate of the buffer the loop holds
+MSKModemResampler*
+mskmodem_resample_new
+(
+  double ratio,
+  int rate
+);
+
+void
+mskmodem_resample_free
+(
+  MSKModemResampler** ppRs
+);
+
+// Resamples in until it is used up or out is full. Returns the samples
+// made, and the input samples taken in *used.
+int
+mskmodem_resample
+(
+  MSKModemResampler* rs,
+  const float* in,
+  int nin,
+  int* used,
+  float* out,
+  int nout
+);
+
+// Steers the step with a measurement of the buffer, dt seconds after the
+// last. A fill over target speeds up taking input (or slows making
+// output), whichever side the buffer is on. Returns the correction to the
+// nominal ratio, in ppm.
+double
+mskmodem_resample_track
+(
+  MSKModemResampler* rs,
+  double fill,
+  double target,
+  double dt
+);
+
+// Average fill the loop sees
+double
+mskmodem_resample_fill
+(
+  MSKModemResampler* rs
+);
+
+#endif /* MSKMODEM_RESAMPLE_H */
@@ -0,0 +1,143 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <glib.h>
+
+#include "ring.h"
+
+// One slot is always left empty, so rd == wr is empty
+struct MSKModemRing_s {
+  float* buf;
+  int size;
+  gint rd;
+  gint wr;
+};
+
+MSKModemRing*
+mskmodem_ring_new
+(
+  int size
+)
+{
+  MSKModemRing* r = g_new0(MSKModemRing, 1);
+
+  r->size = size + 1;
+  r->buf = g_new0(float, r->size);
+
+  return r;
+}
+
+void
+mskmodem_ring_free
+(
+  MSKModemRing** ppRing
+)
+{
+  if (ppRing && *ppRing) {
+    g_free((*ppRing)->buf);
+    g_free(*ppRing);
+    *ppRing = NULL;
+  }
+}
+
+void
+mskmodem_ring_reset
+(
+  MSKModemRing* r,
+  int fill
+)
+{
+  fill = MIN(fill, r->size - 1);
+  memset(r->buf, 0, fill * sizeof(float));
+  g_atomic_int_set(&r->rd, 0);
+  g_atomic_int_set(&r->wr, fill);
+}
+
+int
+mskmodem_ring_fill
+(
+  MSKModemRing* r
+)
+{
+  return (g_atomic_int_get(&r->wr) - g_atomic_int_get(&r->rd) + r->size) %
+         r->size;
+}
+
+int
+mskmodem_ring_put
+(
+  MSKModemRing* r,
+  const float* s,
+  int n
+)
+{
+  int wr = r->wr;
+  int k, space;
+
+  space = (g_atomic_int_get(&r->rd) - wr - 1 + r->size) % r->size;
+  n = MIN(n, space);
+  k = MIN(n, r->size - wr);
+  memcpy(r->buf + wr, s, k * sizeof(*s));
+  memcpy(r->buf, s + k, (n - k) * sizeof(*s));
+  g_atomic_int_set(&r->wr, (wr + n) % r->size);
+
+  return n;
+}
+
+int
+mskmodem_ring_get
+(
+  MSKModemRing* r,
+  float* s,
+  int n
+)
+{
+  int rd = r->rd;
+  int k;
+
+  n = MIN(n, mskmodem_ring_fill(r));
+  k = MIN(n, r->size - rd);
+  memcpy(s, r->buf + rd, k * sizeof(*s));
+  memcpy(s + k, r->buf, (n - k) * sizeof(*s));
+  g_atomic_int_set(&r->rd, (rd + n) % r->size);
+
+  return n;
+}
+
+int
+mskmodem_ring_peek
+(
+  MSKModemRing* r,
+  const float** s
+)
+{
+  *s = r->buf + r->rd;
+  return MIN(mskmodem_ring_fill(r), r->size - r->rd);
+}
+
+void
+mskmodem_ring_drop
+(
+  MSKModemRing* r,
+  int n
+)
+{
+  g_atomic_int_set(&r->rd, (r->rd + n) % r->size);
+}
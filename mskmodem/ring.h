@@ -0,0 +1,95 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MSKMODEM_RING_H
+#define MSKMODEM_RING_H
+
+#include <glib.h>
+
+// Single producer, single consumer ring of audio samples between the JACK
+// process callback and another thread. Neither side ever waits for the
+// other, so it is safe in the callback.
+
+struct MSKModemRing_s;
+typedef struct MSKModemRing_s MSKModemRing;
+
+// Holds up to size samples
+MSKModemRing*
+mskmodem_ring_new
+(
+  int size
+);
+
+void
+mskmodem_ring_free
+(
+  MSKModemRing** ppRing
+);
+
+// Empties it then adds fill samples of silence. Only while neither side
+// is using it.
+void
+mskmodem_ring_reset
+(
+  MSKModemRing* r,
+  int fill
+);
+
+int
+mskmodem_ring_fill
+(
+  MSKModemRing* r
+);
+
+// Producer: adds up to n samples, returning how many there was room for
+int
+mskmodem_ring_put
+(
+  MSKModemRing* r,
+  const float* s,
+  int n
+);
+
+// Consumer: takes up to n samples, returning how many there were...
+int
+mskmodem_ring_get
+(
+  MSKModemRing* r,
+  float* s,
+  int n
+);
+
+// ...or looks at those in place: returns how many follow on in memory
+// from *s
+int
+mskmodem_ring_peek
+(
+  MSKModemRing* r,
+  const float** s
+);
+
+// Consumer: takes n samples (no more than the fill) without looking
+void
+mskmodem_ring_drop
+(
+  MSKModemRing* r,
+  int n
+);
+
+#endif /* MSKMODEM_RING_H */
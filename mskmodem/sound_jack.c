@@ -18,10 +18,25 @@
 */
 
 #include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <glib.h>
 #include <jack/jack.h>
+#include <jack/thread.h>
 
 #include "sound.h"
+#include "sound_split.h"
+#include "ring.h"
+#include "q15.h"
+
+// JACK periods are handled in blocks of this size where they have to be
+// converted or copied
+#define SOUND_BLOCK 1024
+
+// Pipelined: longest transmit lookahead, and received audio kept for the
+// worker, seconds
+#define SOUND_LOOKAHEAD_MAX 0.2
+#define SOUND_RX_BACKLOG    0.5
 
 struct MSKModemSoundContext_s {
   jack_client_t* client; 
@@ -33,25 +48,171 @@ struct MSKModemSoundContext_s {
   void* userdata;
 
   int isStarted;
+
+  // Sides on their own devices, NULL for JACK's physical ports
+  MSKModemSplit* capture;
+  MSKModemSplit* playback;
+  jack_default_audio_sample_t capbuf[SOUND_BLOCK];
+
+  // Pipelined: the process callback only moves audio through the rings,
+  // and the modem runs on the worker thread
+  int lookahead_req;    // Transmit lookahead asked for, 0 for none...
+  int lookahead;        // ...and running with
+  MSKModemRing* rxring;
+  MSKModemRing* txring;
+  int tx_owed;          // Transmit audio late and played as silence: it
+                        // is dropped when it comes to keep the delay
+  jack_native_thread_t worker;
+  sem_t wake;
+  gint quit;
+  gint underruns;
+  gint overruns;
+  gint tx_overruns;
+  gint backlog;         // Most received audio waiting for the worker
+  float workin[SOUND_BLOCK];
+  float workout[SOUND_BLOCK];
+
+#ifdef MSKMODEM_FIXED_POINT
+  mskmodem_sound_t rxbuf[SOUND_BLOCK];
+  mskmodem_sound_t txbuf[SOUND_BLOCK];
+#endif
 };
 
+// Runs the modem over a block
+static void
+modem_block (
+  MSKModemSoundContext* ctx,
+  const jack_default_audio_sample_t* in,
+  jack_default_audio_sample_t* out,
+  jack_nframes_t n
+)
+{
+#ifdef MSKMODEM_FIXED_POINT
+  // The modem works in Q15: this is the only place floats are used
+  jack_nframes_t i;
+  for (i=0; i<n; i++)
+    ctx->rxbuf[i] = q15_from_float(in[i]);
+  ctx->rx_f(ctx->rxbuf, n, ctx->userdata);
+  ctx->tx_f(ctx->txbuf, n, ctx->userdata);
+  for (i=0; i<n; i++)
+    out[i] = q15_to_float(ctx->txbuf[i]);
+#else
+  ctx->rx_f(in, n, ctx->userdata);
+  ctx->tx_f(out, n, ctx->userdata);
+#endif
+}
+
+// Pipelined: hands a block to the worker, and plays what it made from the
+// block lookahead samples back
+static void
+pipeline_block (
+  MSKModemSoundContext* ctx,
+  const jack_default_audio_sample_t* in,
+  jack_default_audio_sample_t* out,
+  jack_nframes_t n
+)
+{
+  int k;
+
+  if (mskmodem_ring_put(ctx->rxring, in, n) < n)
+    g_atomic_int_inc(&ctx->overruns);
+
+  if (ctx->tx_owed) {
+    k = MIN(ctx->tx_owed, mskmodem_ring_fill(ctx->txring));
+    mskmodem_ring_drop(ctx->txring, k);
+    ctx->tx_owed -= k;
+  }
+
+  k = mskmodem_ring_get(ctx->txring, out, n);
+  if (k < n) {
+    memset(out+k, 0, (n-k) * sizeof(*out));
+    ctx->tx_owed += n-k;
+    g_atomic_int_inc(&ctx->underruns);
+  }
+}
+
+static void
+process_block (
+  MSKModemSoundContext* ctx,
+  const jack_default_audio_sample_t* in,
+  jack_default_audio_sample_t* out,
+  jack_nframes_t n
+)
+{
+  // Capture from its own device stands in for the Rx port
+  if (ctx->capture) {
+    mskmodem_split_read(ctx->capture, ctx->capbuf, n);
+    in = ctx->capbuf;
+  }
+
+  if (ctx->lookahead)
+    pipeline_block(ctx, in, out, n);
+  else
+    modem_block(ctx, in, out, n);
+
+  // Playback on its own device still goes to the Tx port too
+  if (ctx->playback)
+    mskmodem_split_write(ctx->playback, out, n);
+}
+
 int
 process (jack_nframes_t nframes, void *arg)
 {
   MSKModemSoundContext* ctx = arg;
   jack_default_audio_sample_t *out;
   jack_default_audio_sample_t *in;
+  jack_nframes_t p, n;
 
   in = jack_port_get_buffer(ctx->inport, nframes);
   out = jack_port_get_buffer(ctx->outport, nframes);
 
-  ctx->rx_f(in, nframes, ctx->userdata);
-  ctx->tx_f(out, nframes, ctx->userdata);
+#ifndef MSKMODEM_FIXED_POINT
+  if (!ctx->capture && !ctx->lookahead) {
+    process_block(ctx, in, out, nframes);
+    return 0;
+  }
+#endif
+
+  for (p=0; p<nframes; p+=n) {
+    n = MIN(nframes-p, SOUND_BLOCK);
+    process_block(ctx, in+p, out+p, n);
+  }
+
+  if (ctx->lookahead)
+    sem_post(&ctx->wake);
 
   return 0;
 
 }
 
+// Pipelined: runs the modem over received audio as it comes, which also
+// tops the transmit ring back up to the lookahead
+static void*
+sound_worker (
+  void* arg
+)
+{
+  MSKModemSoundContext* ctx = arg;
+  int n;
+
+  for (;;) {
+    sem_wait(&ctx->wake);
+    if (g_atomic_int_get(&ctx->quit))
+      break;
+
+    while ((n = mskmodem_ring_fill(ctx->rxring)) > 0) {
+      if (n > g_atomic_int_get(&ctx->backlog))
+        g_atomic_int_set(&ctx->backlog, n);
+      n = mskmodem_ring_get(ctx->rxring, ctx->workin, SOUND_BLOCK);
+      modem_block(ctx, ctx->workin, ctx->workout, n);
+      if (mskmodem_ring_put(ctx->txring, ctx->workout, n) < n)
+        g_atomic_int_inc(&ctx->tx_overruns);
+    }
+  }
+
+  return NULL;
+}
+
 int
 mskmodem_sound_init (
   MSKModemSoundContext** ppCtx,
@@ -68,6 +229,7 @@ mskmodem_sound_init (
   ctx->userdata = context;
   ctx->rx_f = rx_f;
   ctx->tx_f = tx_f;
+  sem_init(&ctx->wake, 0, 0);
 
   // Set up jack audio
   ctx->client = jack_client_open(channelId, options, &status, NULL);
@@ -106,13 +268,135 @@ mskmodem_sound_free (
   {
     MSKModemSoundContext* ctx = *ppCtx;
 
+    mskmodem_sound_stop(ctx);
     jack_client_close(ctx->client);
+    mskmodem_split_free(&ctx->capture);
+    mskmodem_split_free(&ctx->playback);
+    mskmodem_ring_free(&ctx->rxring);
+    mskmodem_ring_free(&ctx->txring);
+    sem_destroy(&ctx->wake);
 
     g_free(ctx);
     *ppCtx = NULL;
   }
 }
 
+int
+mskmodem_sound_rate (
+  MSKModemSoundContext* ctx
+)
+{
+  return jack_get_sample_rate(ctx->client);
+}
+
+int
+mskmodem_sound_split (
+  MSKModemSoundContext* ctx,
+  const char* capture,
+  const char* playback
+)
+{
+  int rate = jack_get_sample_rate(ctx->client);
+
+  if (ctx->isStarted)
+    return 1;
+
+  if (capture) {
+    mskmodem_split_free(&ctx->capture);
+    ctx->capture = mskmodem_split_new(capture, 0, rate);
+    if (!ctx->capture)
+      return 1;
+  }
+  if (playback) {
+    mskmodem_split_free(&ctx->playback);
+    ctx->playback = mskmodem_split_new(playback, 1, rate);
+    if (!ctx->playback)
+      return 1;
+  }
+
+  return 0;
+}
+
+void
+mskmodem_sound_split_stats (
+  MSKModemSoundContext* ctx,
+  MSKModemSoundSplitStats* capture,
+  MSKModemSoundSplitStats* playback
+)
+{
+  memset(capture, 0, sizeof(*capture));
+  memset(playback, 0, sizeof(*playback));
+  if (ctx->capture)
+    mskmodem_split_stats(ctx->capture, capture);
+  if (ctx->playback)
+    mskmodem_split_stats(ctx->playback, playback);
+}
+
+int
+mskmodem_sound_pipeline (
+  MSKModemSoundContext* ctx,
+  int lookahead
+)
+{
+  if (ctx->isStarted || lookahead < 0)
+    return 1;
+
+  ctx->lookahead_req = lookahead;
+  return 0;
+}
+
+void
+mskmodem_sound_pipeline_stats (
+  MSKModemSoundContext* ctx,
+  MSKModemSoundPipelineStats* stats
+)
+{
+  stats->lookahead = ctx->isStarted ? ctx->lookahead : ctx->lookahead_req;
+  stats->period = jack_get_buffer_size(ctx->client);
+  stats->backlog = g_atomic_int_get(&ctx->backlog);
+  stats->underruns = g_atomic_int_get(&ctx->underruns);
+  stats->overruns = g_atomic_int_get(&ctx->overruns);
+  stats->tx_overruns = g_atomic_int_get(&ctx->tx_overruns);
+}
+
+// Sets up the rings and starts the worker, if pipelined
+static int
+pipeline_start (
+  MSKModemSoundContext* ctx,
+  int period
+)
+{
+  int rate = jack_get_sample_rate(ctx->client);
+
+  ctx->lookahead = 0;
+  if (!ctx->lookahead_req)
+    return 0;
+
+  // At least a period: the worker has until the next to fill it
+  ctx->lookahead = CLAMP(ctx->lookahead_req, period,
+                         (int)(SOUND_LOOKAHEAD_MAX * rate));
+  mskmodem_ring_free(&ctx->rxring);
+  mskmodem_ring_free(&ctx->txring);
+  ctx->rxring = mskmodem_ring_new(MAX((int)(SOUND_RX_BACKLOG * rate),
+                                      2*ctx->lookahead));
+  ctx->txring = mskmodem_ring_new(2*ctx->lookahead + SOUND_BLOCK);
+  mskmodem_ring_reset(ctx->rxring, 0);
+  mskmodem_ring_reset(ctx->txring, ctx->lookahead);
+  ctx->tx_owed = 0;
+
+  // Just under JACK's priority, so it never holds up the callback
+  ctx->quit = 0;
+  if (jack_client_create_thread(ctx->client, &ctx->worker,
+                                jack_client_real_time_priority(ctx->client)-1,
+                                jack_is_realtime(ctx->client),
+                                sound_worker, ctx)) {
+    ctx->lookahead = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
 int
 mskmodem_sound_run (
   MSKModemSoundContext* ctx
@@ -120,11 +404,26 @@ mskmodem_sound_run (
 {
 
   const char **ports;
+  jack_nframes_t period;
   
   // Are we running?
   if (ctx->isStarted)
     return 0;
 
+  // Split devices run before JACK hands them anything
+  period = jack_get_buffer_size(ctx->client);
+  if ((ctx->capture &&
+       mskmodem_split_start(ctx->capture, ctx->client, period)) ||
+      (ctx->playback &&
+       mskmodem_split_start(ctx->playback, ctx->client, period))) {
+    g_error("cannot start split sound devices");
+    return 1;
+  }
+  if (pipeline_start(ctx, period)) {
+    g_error("cannot start sound worker");
+    return 1;
+  }
+
   // Ready to start processing audio!
   if (jack_activate (ctx->client)) {
     g_error("cannot activate client");
@@ -132,32 +431,36 @@ mskmodem_sound_run (
   }
 
   // Connect outputs ports (JackPortIsInput - perspective of Jack)
-  ports = jack_get_ports (ctx->client, NULL, NULL, 
-                          JackPortIsPhysical|JackPortIsInput);
-  if (ports == NULL) {
-    g_error("no physical playback ports");
-    return 1;
-  }
-  if (jack_connect (ctx->client, jack_port_name (ctx->outport), ports[0])) {
-    g_error("cannot connect output ports");
+  if (!ctx->playback) {
+    ports = jack_get_ports (ctx->client, NULL, NULL, 
+                            JackPortIsPhysical|JackPortIsInput);
+    if (ports == NULL) {
+      g_error("no physical playback ports");
+      return 1;
+    }
+    if (jack_connect (ctx->client, jack_port_name (ctx->outport), ports[0])) {
+      g_error("cannot connect output ports");
+      jack_free(ports);
+      return 1;
+    }
     jack_free(ports);
-    return 1;
   }
-  jack_free(ports);
 
   // Connect input ports
-  ports = jack_get_ports (ctx->client, NULL, NULL, 
-                          JackPortIsPhysical|JackPortIsOutput);
-  if (ports == NULL) {
-    g_error("no physical input ports");
-    return 1;
-  }
-  if (jack_connect (ctx->client, ports[0], jack_port_name (ctx->inport) )) {
-    g_error("cannot connect input ports");
+  if (!ctx->capture) {
+    ports = jack_get_ports (ctx->client, NULL, NULL, 
+                            JackPortIsPhysical|JackPortIsOutput);
+    if (ports == NULL) {
+      g_error("no physical input ports");
+      return 1;
+    }
+    if (jack_connect (ctx->client, ports[0], jack_port_name (ctx->inport) )) {
+      g_error("cannot connect input ports");
+      jack_free(ports);
+      return 1;
+    }
     jack_free(ports);
-    return 1;
   }
-  jack_free(ports);
 
   ctx->isStarted = 1;
 
@@ -178,6 +481,15 @@ mskmodem_sound_stop (
     g_error("cannot deactivate client");
     return 1;
   }
+  if (ctx->capture)
+    mskmodem_split_stop(ctx->capture);
+  if (ctx->playback)
+    mskmodem_split_stop(ctx->playback);
+  if (ctx->lookahead) {
+    g_atomic_int_set(&ctx->quit, 1);
+    sem_post(&ctx->wake);
+    pthread_join(ctx->worker, NULL);
+  }
   
   ctx->isStarted = 0;
 
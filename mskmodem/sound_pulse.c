@@ -23,6 +23,8 @@
 
 #include "sound.h"
 
+#define SOUND_RATE 48000
+
 struct MSKModemSoundContext_s {
   pa_mainloop* paloop;
   pa_context* pactx;
@@ -64,7 +66,7 @@ static void context_state_callback(pa_context* c, void* userdata)
   MSKModemSoundContext* ctx = userdata;
   const pa_sample_spec ss = {
     .format = PA_SAMPLE_FLOAT32LE,
-    .rate = 48000,
+    .rate = SOUND_RATE,
     .channels = 1
   };
   const pa_buffer_attr sbp = {
@@ -106,6 +108,14 @@ static void context_state_callback(pa_context* c, void* userdata)
   }
 }
 
+int
+mskmodem_sound_rate (
+  MSKModemSoundContext* ctx
+)
+{
+  return SOUND_RATE;
+}
+
 int
 mskmodem_sound_init (
   MSKModemSoundContext** ppCtx,
@@ -157,6 +167,47 @@ mskmodem_sound_free (
   }
 }
 
+int
+mskmodem_sound_split (
+  MSKModemSoundContext* ctx,
+  const char* capture,
+  const char* playback
+)
+{
+  // PulseAudio does its own rate matching between devices
+  return 1;
+}
+
+void
+mskmodem_sound_split_stats (
+  MSKModemSoundContext* ctx,
+  MSKModemSoundSplitStats* capture,
+  MSKModemSoundSplitStats* playback
+)
+{
+  memset(capture, 0, sizeof(*capture));
+  memset(playback, 0, sizeof(*playback));
+}
+
+int
+mskmodem_sound_pipeline (
+  MSKModemSoundContext* ctx,
+  int lookahead
+)
+{
+  // The main loop already runs apart from the sound server
+  return 1;
+}
+
+void
+mskmodem_sound_pipeline_stats (
+  MSKModemSoundContext* ctx,
+  MSKModemSoundPipelineStats* stats
+)
+{
+  memset(stats, 0, sizeof(*stats));
+}
+
 int
 mskmodem_sound_run (
   MSKModemSoundContext* ctx
@@ -0,0 +1,372 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <pthread.h>
+#include <glib.h>
+#include <alsa/asoundlib.h>
+#include <jack/thread.h>
+
+#include "sound_split.h"
+#include "resample.h"
+#include "ring.h"
+
+// Device period (us) and periods in its buffer
+#define SPLIT_PERIOD_TIME 5000
+#define SPLIT_PERIODS     4
+
+// Ring fill held, over a period of each side, seconds
+#define SPLIT_MARGIN 0.002
+
+struct MSKModemSplit_s {
+
+  snd_pcm_t* pcm;
+  int playback;
+  int rate;                  // JACK's sample rate
+  int dev_rate;              // ...and the device's
+  int period;                // Device period, frames
+  int buffer;                // ...and buffer
+
+  MSKModemResampler* rs;
+  float* devbuf;   // A device period
+  float* rsbuf;    // Capture: resampler output
+  int rsbuf_len;
+
+  // Ring at JACK's rate, between the device thread and the process
+  // callback
+  MSKModemRing* ring;
+  int target;      // Fill held
+  gint primed;     // Capture: fill has reached target since it ran dry
+
+  jack_native_thread_t thread;
+  gint quit;
+  int running;
+
+  float ppm;
+  float fill;
+  gint slips;
+  gint xruns;
+
+};
+
+static int split_open(MSKModemSplit* sp, const char* device)
+{
+  snd_pcm_hw_params_t* hw;
+  snd_pcm_sw_params_t* sw;
+  unsigned int rate = sp->rate;
+  unsigned int time = SPLIT_PERIOD_TIME;
+  unsigned int periods = SPLIT_PERIODS;
+  snd_pcm_uframes_t period, buffer;
+  int dir = 0;
+
+  if (snd_pcm_open(&sp->pcm, device, sp->playback ?
+                   SND_PCM_STREAM_PLAYBACK : SND_PCM_STREAM_CAPTURE, 0) < 0)
+    return 1;
+
+  // The device's own rate: ALSA's rate converter is no use for drift
+  snd_pcm_hw_params_alloca(&hw);
+  if (snd_pcm_hw_params_any(sp->pcm, hw) < 0 ||
+      snd_pcm_hw_params_set_rate_resample(sp->pcm, hw, 0) < 0 ||
+      snd_pcm_hw_params_set_access(sp->pcm, hw,
+                                   SND_PCM_ACCESS_RW_INTERLEAVED) < 0 ||
+      snd_pcm_hw_params_set_format(sp->pcm, hw, SND_PCM_FORMAT_FLOAT) < 0 ||
+      snd_pcm_hw_params_set_channels(sp->pcm, hw, 1) < 0 ||
+      snd_pcm_hw_params_set_rate_near(sp->pcm, hw, &rate, &dir) < 0 ||
+      snd_pcm_hw_params_set_period_time_near(sp->pcm, hw, &time, &dir) < 0 ||
+      snd_pcm_hw_params_set_periods_near(sp->pcm, hw, &periods, &dir) < 0 ||
+      snd_pcm_hw_params(sp->pcm, hw) < 0)
+    return 1;
+  snd_pcm_hw_params_get_period_size(hw, &period, &dir);
+  snd_pcm_hw_params_get_buffer_size(hw, &buffer);
+  sp->period = period;
+  sp->buffer = buffer;
+  sp->dev_rate = rate;
+
+  // Playback starts with its buffer full, then the thread waits for a
+  // period's room at a time
+  snd_pcm_sw_params_alloca(&sw);
+  if (snd_pcm_sw_params_current(sp->pcm, sw) < 0 ||
+      snd_pcm_sw_params_set_start_threshold(sp->pcm, sw,
+                                            sp->playback ? sp->buffer : 1) < 0 ||
+      snd_pcm_sw_params_set_avail_min(sp->pcm, sw, sp->period) < 0 ||
+      snd_pcm_sw_params(sp->pcm, sw) < 0)
+    return 1;
+
+  return 0;
+}
+
+// Fills the playback buffer with silence, which starts it
+static void split_prime(MSKModemSplit* sp)
+{
+  int n;
+
+  memset(sp->devbuf, 0, sp->period * sizeof(float));
+  for (n=0; n+sp->period <= sp->buffer; n+=sp->period)
+    if (snd_pcm_writei(sp->pcm, sp->devbuf, sp->period) < 0)
+      break;
+}
+
+static void split_xrun(MSKModemSplit* sp, int err)
+{
+  g_atomic_int_inc(&sp->xruns);
+  if (snd_pcm_recover(sp->pcm, err, 1) < 0) {
+    g_usleep(SPLIT_PERIOD_TIME);
+    return;
+  }
+  if (sp->playback)
+    split_prime(sp);
+}
+
+static void split_track(MSKModemSplit* sp)
+{
+  sp->ppm = mskmodem_resample_track(sp->rs, mskmodem_ring_fill(sp->ring),
+                                    sp->target,
+                                    (double)sp->period / sp->dev_rate);
+  sp->fill = mskmodem_resample_fill(sp->rs);
+}
+
+static void* split_playback(void* arg)
+{
+  MSKModemSplit* sp = arg;
+  snd_pcm_sframes_t r;
+  const float* in;
+  int n, k, avail, used;
+
+  split_prime(sp);
+
+  while (!g_atomic_int_get(&sp->quit)) {
+
+    // A period from the ring, as far as it goes
+    for (n=0; n<sp->period; n+=k) {
+      avail = mskmodem_ring_peek(sp->ring, &in);
+      if (!avail) {
+        memset(sp->devbuf+n, 0, (sp->period-n) * sizeof(float));
+        g_atomic_int_inc(&sp->slips);
+        break;
+      }
+      k = mskmodem_resample(sp->rs, in, avail, &used,
+                            sp->devbuf+n, sp->period-n);
+      mskmodem_ring_drop(sp->ring, used);
+    }
+    split_track(sp);
+
+    r = snd_pcm_writei(sp->pcm, sp->devbuf, sp->period);
+    if (r < 0)
+      split_xrun(sp, r);
+  }
+
+  return NULL;
+}
+
+static void* split_capture(void* arg)
+{
+  MSKModemSplit* sp = arg;
+  snd_pcm_sframes_t r;
+  int i, k, used;
+
+  while (!g_atomic_int_get(&sp->quit)) {
+
+    r = snd_pcm_readi(sp->pcm, sp->devbuf, sp->period);
+    if (r < 0) {
+      split_xrun(sp, r);
+      continue;
+    }
+
+    for (i=0; i<r; i+=used) {
+      k = mskmodem_resample(sp->rs, sp->devbuf+i, r-i, &used,
+                            sp->rsbuf, sp->rsbuf_len);
+      if (mskmodem_ring_put(sp->ring, sp->rsbuf, k) < k)
+        g_atomic_int_inc(&sp->slips);
+    }
+
+    // The fill only means anything once JACK is taking from the ring
+    if (g_atomic_int_get(&sp->primed))
+      split_track(sp);
+  }
+
+  return NULL;
+}
+
+MSKModemSplit*
+mskmodem_split_new
+(
+  const char* device,
+  int playback,
+  int rate
+)
+{
+  MSKModemSplit* sp = g_new0(MSKModemSplit, 1);
+
+  sp->playback = playback;
+  sp->rate = rate;
+  if (split_open(sp, device)) {
+    g_message("Can't open %s for %s", device,
+              playback ? "playback" : "capture");
+    mskmodem_split_free(&sp);
+    return NULL;
+  }
+
+  sp->devbuf = g_new0(float, sp->period);
+  sp->rsbuf_len = sp->period * rate / sp->dev_rate + 8;
+  sp->rsbuf = g_new0(float, sp->rsbuf_len);
+
+  return sp;
+}
+
+void
+mskmodem_split_free
+(
+  MSKModemSplit** ppSplit
+)
+{
+  if (ppSplit && *ppSplit) {
+    MSKModemSplit* sp = *ppSplit;
+
+    mskmodem_split_stop(sp);
+    if (sp->pcm)
+      snd_pcm_close(sp->pcm);
+    mskmodem_resample_free(&sp->rs);
+    g_free(sp->devbuf);
+    g_free(sp->rsbuf);
+    mskmodem_ring_free(&sp->ring);
+    g_free(sp);
+    *ppSplit = NULL;
+  }
+}
+
+int
+mskmodem_split_start
+(
+  MSKModemSplit* sp,
+  jack_client_t* client,
+  int period
+)
+{
+  if (sp->running)
+    return 0;
+
+  // Enough for a period of each side to come and go, and a margin
+  sp->target = period + sp->period * sp->rate / sp->dev_rate +
+               (int)(SPLIT_MARGIN * sp->rate);
+  mskmodem_ring_free(&sp->ring);
+  sp->ring = mskmodem_ring_new(4 * sp->target);
+
+  // Playback starts with the ring at its target (of silence); capture
+  // fills it first
+  mskmodem_ring_reset(sp->ring, sp->playback ? sp->target : 0);
+  sp->primed = 0;
+
+  mskmodem_resample_free(&sp->rs);
+  if (sp->playback)
+    sp->rs = mskmodem_resample_new((double)sp->rate / sp->dev_rate,
+                                   sp->rate);
+  else
+    sp->rs = mskmodem_resample_new((double)sp->dev_rate / sp->rate,
+                                   sp->rate);
+
+  if (snd_pcm_prepare(sp->pcm) < 0)
+    return 1;
+
+  sp->quit = 0;
+  if (jack_client_create_thread(client, &sp->thread,
+                                jack_client_real_time_priority(client),
+                                jack_is_realtime(client),
+                                sp->playback ? split_playback : split_capture,
+                                sp))
+    return 1;
+  sp->running = 1;
+
+  return 0;
+}
+
+void
+mskmodem_split_stop
+(
+  MSKModemSplit* sp
+)
+{
+  if (!sp->running)
+    return;
+
+  // The thread sees this within a device period
+  g_atomic_int_set(&sp->quit, 1);
+  pthread_join(sp->thread, NULL);
+  snd_pcm_drop(sp->pcm);
+  sp->running = 0;
+}
+
+void
+mskmodem_split_read
+(
+  MSKModemSplit* sp,
+  float* s,
+  int samples
+)
+{
+  int primed = g_atomic_int_get(&sp->primed);
+  int n = 0;
+
+  if (!primed && mskmodem_ring_fill(sp->ring) >= sp->target) {
+    primed = 1;
+    g_atomic_int_set(&sp->primed, 1);
+  }
+  if (primed)
+    n = mskmodem_ring_get(sp->ring, s, samples);
+
+  // Ran dry: silence until the ring is back at its target
+  if (n < samples) {
+    memset(s+n, 0, (samples-n) * sizeof(*s));
+    if (primed) {
+      g_atomic_int_inc(&sp->slips);
+      g_atomic_int_set(&sp->primed, 0);
+    }
+  }
+}
+
+void
+mskmodem_split_write
+(
+  MSKModemSplit* sp,
+  const float* s,
+  int samples
+)
+{
+  if (mskmodem_ring_put(sp->ring, s, samples) < samples)
+    g_atomic_int_inc(&sp->slips);
+}
+
+void
+mskmodem_split_stats
+(
+  MSKModemSplit* sp,
+  MSKModemSoundSplitStats* stats
+)
+{
+  // Playback keeps its device buffer full, capture keeps it empty
+  int dev = sp->playback ? sp->buffer - sp->period/2 : sp->period/2;
+
+  stats->active = 1;
+  stats->rate = sp->dev_rate;
+  stats->ppm = sp->ppm;
+  stats->fill = sp->fill;
+  stats->target = sp->target;
+  stats->latency = sp->target + dev * sp->rate / sp->dev_rate;
+  stats->slips = g_atomic_int_get(&sp->slips);
+  stats->xruns = g_atomic_int_get(&sp->xruns);
+}
@@ -0,0 +1,98 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MSKMODEM_SOUND_SPLIT_H
+#define MSKMODEM_SOUND_SPLIT_H
+
+#include <glib.h>
+#include <jack/jack.h>
+
+#include "sound.h"
+
+// One side (capture or playback) of the JACK backend's audio on its own
+// ALSA device, for a radio on a sound card with its own clock.
+//
+// A thread paced by the device moves audio between it and a ring buffer
+// through an adaptive resampler; the JACK process callback takes from or
+// adds to the ring. The resampler holds the ring's fill, and so the
+// latency, constant as the device's clock drifts against JACK's: the
+// device's own buffer needs no watching since the thread keeps pace with
+// it.
+
+struct MSKModemSplit_s;
+typedef struct MSKModemSplit_s MSKModemSplit;
+
+// Opens device for capture or playback near rate (JACK's). NULL if it
+// can't be opened.
+MSKModemSplit*
+mskmodem_split_new
+(
+  const char* device,
+  int playback,
+  int rate
+);
+
+void
+mskmodem_split_free
+(
+  MSKModemSplit** ppSplit
+);
+
+// Starts the device thread, at JACK's realtime priority. period is JACK's
+// buffer size.
+int
+mskmodem_split_start
+(
+  MSKModemSplit* sp,
+  jack_client_t* client,
+  int period
+);
+
+void
+mskmodem_split_stop
+(
+  MSKModemSplit* sp
+);
+
+// From the JACK process callback: capture to s...
+void
+mskmodem_split_read
+(
+  MSKModemSplit* sp,
+  float* s,
+  int samples
+);
+
+// ...or s to playback
+void
+mskmodem_split_write
+(
+  MSKModemSplit* sp,
+  const float* s,
+  int samples
+);
+
+void
+mskmodem_split_stats
+(
+  MSKModemSplit* sp,
+  MSKModemSoundSplitStats* stats
+);
+
+#endif /* MSKMODEM_SOUND_SPLIT_H */
@@ -0,0 +1,27 @@
+# Decodes the same test signal with the floating point and fixed point
+# (Q15) modems, and fails if they decode more than 1% of the codewords
+# apart. Run as
+#   cmake -DFLOAT=<modem_test> -DQ15=<modem_test_q15> -DDEMOD=n -DSNR=dB
+#         -P compare.cmake
+
+foreach(build FLOAT Q15)
+  execute_process(COMMAND ${${build}} rate ${DEMOD} ${SNR}
+                  OUTPUT_VARIABLE out RESULT_VARIABLE ret)
+  if(ret)
+    message(FATAL_ERROR "${build} modem test failed: ${ret}")
+  endif()
+  string(REGEX MATCH "^([0-9]+) ([0-9]+)" out "${out}")
+  set(${build}_decoded ${CMAKE_MATCH_1})
+  set(sent ${CMAKE_MATCH_2})
+endforeach()
+
+math(EXPR diff "${FLOAT_decoded} - ${Q15_decoded}")
+if(diff LESS 0)
+  math(EXPR diff "-(${diff})")
+endif()
+math(EXPR tolerance "${sent} / 100")
+
+message("${sent} codewords: float ${FLOAT_decoded}, Q15 ${Q15_decoded}")
+if(diff GREATER tolerance)
+  message(FATAL_ERROR "Q15 decode rate differs from float's")
+endif()
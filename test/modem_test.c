@@ -0,0 +1,396 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "mskmodem.h"
+#include "sound_test.h"
+
+// Modem tests, on a test signal: FFSK codewords (each after a preamble
+// and SYNC) in gaussian noise, made the same way by every build.
+//
+//   modem_test rate DEMOD SNR  prints the codewords DEMOD decodes, for the
+//                              fixed and floating point builds to compare,
+//                              and checks each is passed once (and that
+//                              diversity beats its paths alone)
+//   modem_test bench DEMOD SECONDS
+//                              times DEMOD over that much of the signal:
+//                              the front end (the modem, its bits thrown
+//                              away) and the decode on each path
+//   modem_test batch           checks the batch demodulator gives each
+//                              channel the bits its own demodulator would
+
+#define RATE     48000
+#define PERIOD   1024
+#define SECONDS  20
+#define BIT      40       // Samples per bit
+#define LEVEL    0.25f    // Headroom for the noise, so Q15 doesn't clip
+#define BATCH_CHANNELS 11 // Two batch groups, one partly used
+
+typedef struct {
+  guint64 sent[SECONDS*1200/64];
+  int nsent;
+  float* s;
+  int samples;
+} TestSignal;
+
+// Codewords from each path are merged as the channel merges them: the
+// same codeword within 32 bits of the last is a copy from another path
+typedef struct {
+  const TestSignal* sig;
+  guint64 sr[MSKMODEM_PHASES]; // Each path's last 64 bits
+  guint32 rx_bits;             // Path 0 bit count
+  guint64 last_cw;             // Last codeword passed, and rx_bits then
+  guint32 last_bit;
+  int next;       // Next sent codeword to look for
+  int decoded;
+  int repeats;    // Codewords passed more than once
+  int paths;      // Paths bits came on
+  char* bits;     // Bits from path 0, when kept
+  int nbits;
+} TestRx;
+
+static guint64 rng;
+
+static guint64 test_random(void)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static double test_gauss(void)
+{
+  double u = ((test_random() >> 11) + 1.0) / 9007199254740993.0;
+  double v = (test_random() >> 11) / 9007199254740992.0;
+  return sqrt(-2*log(u)) * cos(2*G_PI*v);
+}
+
+// MPT1327 FCS of 48 data bits
+static guint16 test_fcs(guint64 cw)
+{
+  guint32 ck = 0;
+  int parity = 0, n, b;
+
+  for (n=0; n<48; n++) {
+    b = cw >> (47-n) & 1;
+    parity ^= b;
+    if ((b ^ (ck >> 15)) & 1)
+      ck ^= 0x6815;
+    ck = ck << 1 & 0xFFFF;
+  }
+  ck = (ck ^ 0x0002) & 0xFFFE;
+  for (n=0; n<16; n++)
+    parity ^= ck >> (15-n) & 1;
+
+  return ck | parity;
+}
+
+static void test_signal(TestSignal* sig, double snr, guint64 seed)
+{
+  double phase = 0, noise;
+  guint64 cw = 0;
+  int i, bit = 64;
+
+  rng = seed;
+  sig->samples = RATE * SECONDS;
+  sig->s = g_new0(float, sig->samples);
+  sig->nsent = 0;
+
+  // 1200Hz for a 1, 1800Hz for a 0, continuous phase. Every other
+  // codeword is preamble and SYNC.
+  for (i=0; i<sig->samples; i++) {
+    if (i % BIT == 0 && ++bit >= 64) {
+      bit = 0;
+      if (sig->nsent % 2 == 0 && (i / BIT / 64) % 2 == 0)
+        cw = G_GUINT64_CONSTANT(0xAAAAAAAAAAAAC4D7);
+      else {
+        cw = test_random() & G_GUINT64_CONSTANT(0xFFFFFFFFFFFF);
+        sig->sent[sig->nsent++] = cw;
+        cw = cw << 16 | test_fcs(cw);
+      }
+    }
+    phase += 2*G_PI * ((cw >> (63-bit) & 1) ? 1200 : 1800) / RATE;
+    sig->s[i] = LEVEL * sin(phase);
+  }
+
+  noise = LEVEL / sqrt(2) / pow(10, snr/20);
+  for (i=0; i<sig->samples; i++)
+    sig->s[i] += noise * test_gauss();
+}
+
+static void test_rx(guint32 bit, int path, void* userdata)
+{
+  TestRx* rx = userdata;
+  guint64 d;
+  int n;
+
+  if (path < 0 || path >= MSKMODEM_PHASES)
+    return;
+  if (path == 0) {
+    rx->rx_bits++;
+    if (rx->bits)
+      rx->bits[rx->nbits++] = '0' + bit;
+  }
+
+  rx->sr[path] = rx->sr[path] << 1 | bit;
+  d = rx->sr[path] >> 16;
+  if (test_fcs(d) != (rx->sr[path] & 0xFFFF))
+    return;
+  if (d == rx->last_cw && rx->rx_bits - rx->last_bit < 32)
+    return;
+  rx->last_cw = d;
+  rx->last_bit = rx->rx_bits;
+
+  for (n=MAX(rx->next-8, 0); n<rx->sig->nsent && n<rx->next+8; n++)
+    if (rx->sig->sent[n] == d) {
+      if (n < rx->next)
+        rx->repeats++;
+      else {
+        rx->decoded++;
+        rx->next = n+1;
+      }
+      break;
+    }
+}
+
+static void test_rx_null(guint32 bit, int path, void* userdata)
+{
+  TestRx* rx = userdata;
+
+  if (path >= rx->paths)
+    rx->paths = path+1;
+}
+
+static void test_tx(guint64* cw, void* userdata)
+{
+  *cw = 0;
+}
+
+static void test_sound_rx(const mskmodem_sound_t* s, gint32 n, void* userdata)
+{
+}
+
+static void test_sound_tx(mskmodem_sound_t* s, gint32 n, void* userdata)
+{
+  memset(s, 0, n * sizeof(*s));
+}
+
+// Codewords DEMOD decodes from the signal
+static int test_decode(const TestSignal* sig, int demod, int* repeats)
+{
+  MSKModemContext* modem;
+  MSKModemSoundContext* snd;
+  TestRx rx = { sig };
+  int p;
+
+  mskmodem_init(&modem, "test", test_rx, test_tx,
+                test_sound_rx, test_sound_tx, &rx);
+  snd = sound_test_last();
+  if (mskmodem_set_demod(modem, demod)) {
+    mskmodem_free(&modem);
+    return -1;
+  }
+  mskmodem_run(modem);
+
+  for (p=0; p+PERIOD<=sig->samples; p+=PERIOD)
+    sound_test_rx(snd, sig->s+p, PERIOD);
+
+  mskmodem_free(&modem);
+  *repeats = rx.repeats;
+
+  return rx.decoded;
+}
+
+static int test_rate(int demod, double snr)
+{
+  TestSignal sig;
+  int decoded, repeats, incoherent, coherent, ret = 0;
+
+  test_signal(&sig, snr, 88172645463325252ULL);
+  decoded = test_decode(&sig, demod, &repeats);
+  if (decoded < 0)
+    return 1;
+  printf("%d %d\n", decoded, sig.nsent);
+
+  if (repeats) {
+    printf("%d codewords passed more than once\n", repeats);
+    ret = 1;
+  }
+
+  // Diversity takes whichever path's codeword passes, so must decode at
+  // least what each path would alone
+  if (demod == MSKMODEM_DEMOD_DIVERSITY) {
+    incoherent = test_decode(&sig, MSKMODEM_DEMOD_INCOHERENT, &repeats);
+    coherent = test_decode(&sig, MSKMODEM_DEMOD_COHERENT, &repeats);
+    printf("incoherent %d, coherent %d\n", incoherent, coherent);
+    if (decoded < MAX(incoherent, coherent)) {
+      printf("diversity decodes fewer than its paths\n");
+      ret = 1;
+    }
+  }
+
+  g_free(sig.s);
+
+  return ret;
+}
+
+// Seconds taken to demodulate SECONDS of the signal, over and over
+static double test_time(const TestSignal* sig, int demod, int seconds,
+                        MSKModemRxFn rx_f, int* paths)
+{
+  MSKModemContext* modem;
+  MSKModemSoundContext* snd;
+  TestRx rx = { sig };
+  int p, length = sig->samples / PERIOD * PERIOD;
+  gint64 t;
+
+  mskmodem_init(&modem, "test", rx_f, test_tx,
+                test_sound_rx, test_sound_tx, &rx);
+  snd = sound_test_last();
+  mskmodem_set_demod(modem, demod);
+  mskmodem_run(modem);
+
+  t = g_get_monotonic_time();
+  for (p=0; p+PERIOD<=seconds*RATE; p+=PERIOD)
+    sound_test_rx(snd, sig->s + p % length, PERIOD);
+  t = g_get_monotonic_time() - t;
+
+  mskmodem_free(&modem);
+  if (paths)
+    *paths = rx.paths;
+
+  return t / 1e6;
+}
+
+static int test_bench(int demod, int seconds)
+{
+  TestSignal sig;
+  double front, decode;
+  int paths;
+
+  if (demod < 0 || demod >= MSKMODEM_DEMOD_COUNT || seconds < 1)
+    return 1;
+
+  test_signal(&sig, 0, 88172645463325252ULL);
+  front = test_time(&sig, demod, seconds, test_rx_null, &paths);
+  decode = test_time(&sig, demod, seconds, test_rx, NULL);
+
+  printf("%ds of audio, %d paths\n", seconds, paths);
+  printf("front end: %.3fs (%.3f%% of a core)\n",
+         front, 100 * front / seconds);
+  printf("per path:  %.3fs (%.3f%% of a core)\n",
+         (decode - front) / paths, 100 * (decode - front) / paths / seconds);
+  printf("total:     %.3fs (%.3f%% of a core)\n",
+         decode, 100 * decode / seconds);
+
+  g_free(sig.s);
+
+  return 0;
+}
+
+static int test_batch(void)
+{
+  MSKModemContext* modem[2][BATCH_CHANNELS];
+  MSKModemSoundContext* snd[2][BATCH_CHANNELS];
+  MSKModemBatch* batch = mskmodem_batch_new(BATCH_CHANNELS);
+  TestSignal sig[BATCH_CHANNELS];
+  TestRx rx[2][BATCH_CHANNELS];
+  float silence[PERIOD] = { 0 };
+  int signal_bits[BATCH_CHANNELS];
+  int k, c, p, ret = 0;
+
+  // Each channel its own signal, demodulated alone (k 0) and batched (1)
+  for (c=0; c<BATCH_CHANNELS; c++) {
+    test_signal(&sig[c], 3 - c, c+1);
+    for (k=0; k<2; k++) {
+      rx[k][c] = (TestRx){ &sig[c] };
+      rx[k][c].bits = g_new0(char, SECONDS*1200 + 64*PERIOD/BIT);
+      mskmodem_init(&modem[k][c], "test", test_rx, test_tx,
+                    test_sound_rx, test_sound_tx, &rx[k][c]);
+      snd[k][c] = sound_test_last();
+      mskmodem_set_demod(modem[k][c], MSKMODEM_DEMOD_INCOHERENT);
+      if (k && mskmodem_batch_attach(batch, modem[k][c]))
+        return 1;
+      mskmodem_run(modem[k][c]);
+    }
+  }
+
+  for (p=0; p+PERIOD<=sig[0].samples; p+=PERIOD)
+    for (k=0; k<2; k++)
+      for (c=0; c<BATCH_CHANNELS; c++)
+        sound_test_rx(snd[k][c], sig[c].s+p, PERIOD);
+  for (c=0; c<BATCH_CHANNELS; c++)
+    signal_bits[c] = rx[0][c].nbits;
+
+  // Batched channels get their bits with their next periods: silence
+  // until the batch thread has caught up
+  for (p=0; p<8; p++) {
+    g_usleep(20000);
+    for (k=0; k<2; k++)
+      for (c=0; c<BATCH_CHANNELS; c++)
+        sound_test_rx(snd[k][c], silence, PERIOD);
+  }
+
+  for (c=0; c<BATCH_CHANNELS; c++) {
+    if (rx[1][c].nbits < signal_bits[c] ||
+        rx[1][c].nbits > rx[0][c].nbits ||
+        memcmp(rx[0][c].bits, rx[1][c].bits, rx[1][c].nbits)) {
+      printf("channel %d: batch bits differ\n", c);
+      ret = 1;
+    }
+    printf("channel %d: %d bits, %d codewords\n", c, signal_bits[c],
+           rx[1][c].decoded);
+  }
+  if (mskmodem_batch_overruns(batch)) {
+    printf("batch overruns\n");
+    ret = 1;
+  }
+
+  for (c=0; c<BATCH_CHANNELS; c++) {
+    for (k=0; k<2; k++) {
+      mskmodem_stop(modem[k][c]);
+      mskmodem_free(&modem[k][c]);
+      g_free(rx[k][c].bits);
+    }
+    g_free(sig[c].s);
+  }
+  mskmodem_batch_free(&batch);
+
+  return ret;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc == 4 && !strcmp(argv[1], "rate"))
+    return test_rate(atoi(argv[2]), atof(argv[3]));
+  if (argc == 4 && !strcmp(argv[1], "bench"))
+    return test_bench(atoi(argv[2]), atoi(argv[3]));
+  if (argc == 2 && !strcmp(argv[1], "batch"))
+    return test_batch();
+
+  fprintf(stderr, "usage: %s rate DEMOD SNR | bench DEMOD SECONDS | batch\n",
+          argv[0]);
+  return 2;
+}
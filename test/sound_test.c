@@ -0,0 +1,155 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <glib.h>
+
+#include "sound.h"
+#include "q15.h"
+#include "sound_test.h"
+
+// Sound backend for the tests: the test hands the modem its received audio
+// and takes its transmit audio, as a backend's callback would
+
+struct MSKModemSoundContext_s {
+  MSKModemSoundRxFn rx_f;
+  MSKModemSoundTxFn tx_f;
+  void* context;
+};
+
+static MSKModemSoundContext* sound_last;
+
+int
+mskmodem_sound_init (
+  MSKModemSoundContext** pCtx,
+  const char* channelId,
+  MSKModemSoundRxFn rx_f,
+  MSKModemSoundTxFn tx_f,
+  void* context
+)
+{
+  MSKModemSoundContext* ctx = g_new0(MSKModemSoundContext, 1);
+
+  ctx->rx_f = rx_f;
+  ctx->tx_f = tx_f;
+  ctx->context = context;
+  *pCtx = ctx;
+  sound_last = ctx;
+
+  return 0;
+}
+
+void
+mskmodem_sound_free (
+  MSKModemSoundContext** ctx
+)
+{
+  g_free(*ctx);
+  *ctx = NULL;
+}
+
+int
+mskmodem_sound_rate (
+  MSKModemSoundContext* ctx
+)
+{
+  return 48000;
+}
+
+int
+mskmodem_sound_split (
+  MSKModemSoundContext* ctx,
+  const char* capture,
+  const char* playback
+)
+{
+  return 1;
+}
+
+void
+mskmodem_sound_split_stats (
+  MSKModemSoundContext* ctx,
+  MSKModemSoundSplitStats* capture,
+  MSKModemSoundSplitStats* playback
+)
+{
+  memset(capture, 0, sizeof(*capture));
+  memset(playback, 0, sizeof(*playback));
+}
+
+int
+mskmodem_sound_pipeline (
+  MSKModemSoundContext* ctx,
+  int lookahead
+)
+{
+  return 1;
+}
+
+void
+mskmodem_sound_pipeline_stats (
+  MSKModemSoundContext* ctx,
+  MSKModemSoundPipelineStats* stats
+)
+{
+  memset(stats, 0, sizeof(*stats));
+}
+
+int
+mskmodem_sound_run (
+  MSKModemSoundContext* ctx
+)
+{
+  return 0;
+}
+
+int
+mskmodem_sound_stop (
+  MSKModemSoundContext* ctx
+)
+{
+  return 0;
+}
+
+MSKModemSoundContext*
+sound_test_last (
+  void
+)
+{
+  return sound_last;
+}
+
+void
+sound_test_rx (
+  MSKModemSoundContext* ctx,
+  const float* s,
+  int samples
+)
+{
+  mskmodem_sound_t buf[SOUND_TEST_PERIOD_MAX];
+  int n;
+
+  for (n=0; n<samples; n++)
+#ifdef MSKMODEM_FIXED_POINT
+    buf[n] = q15_from_float(s[n]);
+#else
+    buf[n] = s[n];
+#endif
+  ctx->rx_f(buf, samples, ctx->context);
+}
@@ -0,0 +1,43 @@
+/* SoftTSC - Software MPT1327 Trunking System Controller
+* Copyright (C) 2013-2014 Paul Banks (http://paulbanks.org)
+*
+* This file is part of SoftTSC
+*
+* SoftTSC is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* SoftTSC is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with SoftTSC.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOUND_TEST_H
+#define SOUND_TEST_H
+
+#include "sound.h"
+
+// Longest period the tests hand the modem
+#define SOUND_TEST_PERIOD_MAX 4096
+
+// The backend of the modem set up last (by mskmodem_init)
+MSKModemSoundContext*
+sound_test_last (
+  void
+);
+
+// Passes the modem a period of received audio, converting it as a sound
+// backend would
+void
+sound_test_rx (
+  MSKModemSoundContext* ctx,
+  const float* s,
+  int samples
+);
+
+#endif /* SOUND_TEST_H */